@@ -4,885 +4,7573 @@
 #include <algorithm>
 #include <sstream>
 #include <fstream>
+// Storage backends: ODBC to SQL Server (the Windows default) and an embedded
+// SQLite database (the default elsewhere). Either can be forced with
+// -DLIBRARY_WITH_ODBC=0/1 and -DLIBRARY_WITH_SQLITE=0/1; --backend picks one at run time.
+//   Windows: g++ -std=c++17 -O2 library.cpp -lodbc32
+//   Linux:   g++ -std=c++17 -O2 library.cpp -lsqlite3 -pthread
+#ifdef _WIN32
 #include <windows.h>
+#include <direct.h>
+#include <io.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <csignal>
+#include <sys/ioctl.h>
+#define _getcwd getcwd
+#endif
+#ifndef LIBRARY_WITH_ODBC
+#ifdef _WIN32
+#define LIBRARY_WITH_ODBC 1
+#else
+#define LIBRARY_WITH_ODBC 0
+#endif
+#endif
+#ifndef LIBRARY_WITH_SQLITE
+#ifdef _WIN32
+#define LIBRARY_WITH_SQLITE 0
+#else
+#define LIBRARY_WITH_SQLITE 1
+#endif
+#endif
+#if LIBRARY_WITH_ODBC
 #include <sql.h>
 #include <sqlext.h>
-#include <direct.h>
+#endif
+#if LIBRARY_WITH_SQLITE
+#include <sqlite3.h>
+#include <regex>
+#include <ctime>
+#endif
 #include <iomanip>
 #include <cerrno>
 #include <cstring>
 #include <limits>
+#include <new>
+#include <cstdlib>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CSV_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define CSV_SIMD_X86 0
+#endif
+#include <unordered_map>
+#include <shared_mutex>
+#include <deque>
+#include <queue>
+#include <list>
+#include <map>
+#include <set>
+#include <random>
+#include <array>
+#include <numeric>
+#include <charconv>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <array>
+#include <string_view>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
 
 using namespace std;
  
-SQLHANDLE envHandle, connHandle, stmtHandle;
+ 
 string currentUserRole;
-wstring stringToWstring(const string& str) {
-    wstring wstr(str.begin(), str.end());
-    return wstr;
-}
-string wstring_to_string(const wstring& wstr) {
-    return string(wstr.begin(), wstr.end());
-}
-void showError(SQLHANDLE handle, SQLSMALLINT type) {
-    SQLWCHAR state[1024], message[1024];
-    if (SQL_SUCCESS == SQLGetDiagRecW(type, handle, 1, state, NULL, message, 1024, NULL)) {
-        cout << "SQL Error: " << wstring_to_string(message) << " (State: " << wstring_to_string(state) << ")" << endl;
+#ifdef _WIN32
+const char* pathSeparator = "\\";
+#else
+const char* pathSeparator = "/";
+#endif
+
+// Where status and error messages go: the console, or the log of the
+// background job running on this thread.
+thread_local ostream* jobOutput = nullptr;
+ostream& statusOut() { return jobOutput ? *jobOutput : cout; }
+
+// UTF-8 <-> UTF-16 at the ODBC wide-character boundary. Strings are UTF-8 everywhere
+// else; these convert into caller-owned buffers so nothing is allocated per call.
+// ASCII runs, most of a catalogue, are converted 16 units at a time; the rest is
+// decoded per code point. Malformed input becomes U+FFFD rather than being dropped.
+const char16_t replacementChar = 0xFFFD;
+
+// Widens the leading ASCII run of in and returns its length.
+size_t widenAscii(const char* in, size_t len, char16_t* out) {
+    size_t i = 0;
+#if CSV_SIMD_X86
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        if (_mm_movemask_epi8(v)) break;
+        _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(v, zero));
     }
-}
-bool connectDB() {
-    if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &envHandle)) return false;
-    if (SQL_SUCCESS != SQLSetEnvAttr(envHandle, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, 0)) return false;
-    if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_DBC, envHandle, &connHandle)) return false;
-    wstring connStr = L"DRIVER={ODBC Driver 17 for SQL Server};SERVER=PSILENL060;DATABASE=library_management;Trusted_Connection=Yes;Integrated Security=SSPI;";
-    SQLWCHAR retConnStr[1024];
-    SQLSMALLINT retConnStrLen;
-    SQLRETURN ret = SQLDriverConnectW(connHandle, NULL, (SQLWCHAR*)connStr.c_str(), SQL_NTS, retConnStr, 1024, &retConnStrLen, SQL_DRIVER_NOPROMPT);
-    if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
-        showError(connHandle, SQL_HANDLE_DBC);
-        return false;
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, in + i, 8);
+        if (word & 0x8080808080808080ull) break;
+        for (size_t k = 0; k < 8; ++k) out[i + k] = (char16_t)(unsigned char)in[i + k];
     }
-    cout << "Connected to database: LibDB" << endl;
-    return true;
+#endif
+    return i;
 }
-void disconnectDB() {
-    SQLFreeHandle(SQL_HANDLE_STMT, stmtHandle);
-    SQLDisconnect(connHandle);
-    SQLFreeHandle(SQL_HANDLE_DBC, connHandle);
-    SQLFreeHandle(SQL_HANDLE_ENV, envHandle);
-}
-bool runQuery(const string& query, bool useTransaction = false) {
-    if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_STMT, connHandle, &stmtHandle)) return false;
-    if (useTransaction) {
-        SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, 0);
-    }
-    wstring wquery = stringToWstring(query);
-    SQLRETURN ret = SQLExecDirectW(stmtHandle, (SQLWCHAR*)wquery.c_str(), SQL_NTS);
-    if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
-        showError(stmtHandle, SQL_HANDLE_STMT);
-        SQLFreeHandle(SQL_HANDLE_STMT, stmtHandle);
-        if (useTransaction) SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0);
-        return false;
+
+// Narrows the leading ASCII run of in and returns its length.
+size_t narrowAscii(const char16_t* in, size_t len, char* out) {
+    size_t i = 0;
+#if CSV_SIMD_X86
+    const __m128i high = _mm_set1_epi16((short)0xFF80), zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 8));
+        __m128i nonAscii = _mm_and_si128(_mm_or_si128(a, b), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, zero)) != 0xFFFF) break;
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
     }
-    if (useTransaction) {
-        SQLEndTran(SQL_HANDLE_DBC, connHandle, SQL_COMMIT);
-        SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0);
+#else
+    for (; i + 4 <= len; i += 4) {
+        uint64_t word;
+        memcpy(&word, in + i, 8);
+        if (word & 0xFF80FF80FF80FF80ull) break;
+        for (size_t k = 0; k < 4; ++k) out[i + k] = (char)in[i + k];
     }
-    SQLFreeHandle(SQL_HANDLE_STMT, stmtHandle);
-    return true;
+#endif
+    return i;
 }
-vector<vector<string>> getResults(const string& query) {
-    vector<vector<string>> results;
-    if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_STMT, connHandle, &stmtHandle)) return results;
-    wstring wquery = stringToWstring(query);
-    SQLRETURN ret = SQLExecDirectW(stmtHandle, (SQLWCHAR*)wquery.c_str(), SQL_NTS);
-    if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
-        showError(stmtHandle, SQL_HANDLE_STMT);
-        SQLFreeHandle(SQL_HANDLE_STMT, stmtHandle);
-        return results;
-    }
-    SQLSMALLINT numCols;
-    SQLNumResultCols(stmtHandle, &numCols);
-    while (SQLFetch(stmtHandle) == SQL_SUCCESS) {
-        vector<string> row;
-        for (SQLSMALLINT i = 1; i <= numCols; ++i) {
-            SQLWCHAR data[1024];
-            SQLLEN dataLen;
-            SQLGetData(stmtHandle, i, SQL_C_WCHAR, data, 1024 * sizeof(SQLWCHAR), &dataLen);
-            row.push_back(dataLen != SQL_NULL_DATA ? wstring_to_string(wstring(data)) : "NULL");
-        }
-        results.push_back(row);
-    }
-    SQLFreeHandle(SQL_HANDLE_STMT, stmtHandle);
-    return results;
-}
-string escapeCSV(const string& field) {
-    string result = field;
-    if (field.find(',') != string::npos || field.find('"') != string::npos) {
-        string escaped;
-        escaped += '"';
-        for (char c : field) {
-            if (c == '"') escaped += "\"\"";
-            else escaped += c;
-        }
-        escaped += '"';
-        return escaped;
+
+// Converts len bytes of UTF-8 and returns the number of UTF-16 units written;
+// out must hold len units. vectorized=false skips the ASCII fast path (--bench-text).
+size_t utf8ToUtf16(const char* in, size_t len, char16_t* out, bool vectorized = true) {
+    size_t i = 0, n = 0;
+    while (i < len) {
+        unsigned char c = in[i];
+        if (c < 0x80) {
+            size_t run = vectorized ? widenAscii(in + i, len - i, out + n) : 0;
+            if (run == 0) {
+                out[n++] = c;
+                run = 1;
+            } else {
+                n += run;
+            }
+            i += run;
+            continue;
+        }
+        // Well-formed two- and three-byte sequences (Devanagari is all three-byte).
+        if (c >= 0xC2 && c <= 0xDF && i + 1 < len && ((unsigned char)in[i + 1] & 0xC0) == 0x80) {
+            out[n++] = (char16_t)(((c & 0x1F) << 6) | ((unsigned char)in[i + 1] & 0x3F));
+            i += 2;
+            continue;
+        }
+        if (c >= 0xE0 && c <= 0xEF && i + 2 < len) {
+            unsigned char c1 = in[i + 1], c2 = in[i + 2];
+            uint32_t cp = ((c & 0x0F) << 12) | ((c1 & 0x3F) << 6) | (c2 & 0x3F);
+            if ((c1 & 0xC0) == 0x80 && (c2 & 0xC0) == 0x80 && cp >= 0x800 && (cp < 0xD800 || cp > 0xDFFF)) {
+                out[n++] = (char16_t)cp;
+                i += 3;
+                continue;
+            }
+        }
+        uint32_t cp;
+        size_t need;
+        if (c >= 0xC2 && c <= 0xDF) cp = c & 0x1F, need = 1;
+        else if (c >= 0xE0 && c <= 0xEF) cp = c & 0x0F, need = 2;
+        else if (c >= 0xF0 && c <= 0xF4) cp = c & 0x07, need = 3;
+        else {
+            out[n++] = replacementChar;
+            ++i;
+            continue;
+        }
+        size_t k = 1;
+        for (; k <= need && i + k < len && ((unsigned char)in[i + k] & 0xC0) == 0x80; ++k) {
+            cp = (cp << 6) | ((unsigned char)in[i + k] & 0x3F);
+        }
+        i += k;
+        bool bad = k <= need || (need == 2 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) ||
+                   (need == 3 && (cp < 0x10000 || cp > 0x10FFFF));
+        if (bad) {
+            out[n++] = replacementChar;
+        } else if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out[n++] = (char16_t)(0xD800 + (cp >> 10));
+            out[n++] = (char16_t)(0xDC00 + (cp & 0x3FF));
+        } else {
+            out[n++] = (char16_t)cp;
+        }
     }
-    return result;
+    return n;
 }
-void exportReportsToCSV() {
-    char cwd[256];
-    if (_getcwd(cwd, sizeof(cwd)) == nullptr) {  // Check if _getcwd succeeded
-        cout << "Failed to get current working directory." << endl;
-        return;
-    }
-
-    string basePath = string(cwd) + "\\";
 
-    auto exportToFile = [&](const string& filename, const vector<vector<string>>& data, const string& header) {
-        ofstream file(basePath + filename);
-        if (!file.is_open()) {
-            cout << "Failed to create " << filename << endl;
-            return;
+// Converts len UTF-16 units and returns the number of bytes written; out must hold
+// 3 * len bytes. Unpaired surrogates become U+FFFD.
+size_t utf16ToUtf8(const char16_t* in, size_t len, char* out, bool vectorized = true) {
+    size_t i = 0, n = 0;
+    while (i < len) {
+        uint32_t cp = in[i];
+        if (cp < 0x80) {
+            size_t run = vectorized ? narrowAscii(in + i, len - i, out + n) : 0;
+            if (run == 0) {
+                out[n++] = (char)cp;
+                run = 1;
+            } else {
+                n += run;
+            }
+            i += run;
+            continue;
         }
-        file << header << "\n";
-        for (const auto& row : data) {
-            file << row[0] << "," << escapeCSV(row[1]) << "," << row[2] << "\n";
+        ++i;
+        if (cp >= 0xD800 && cp <= 0xDFFF) {
+            if (cp <= 0xDBFF && i < len && in[i] >= 0xDC00 && in[i] <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (in[i++] - 0xDC00);
+            } else {
+                cp = replacementChar;
+            }
         }
-        file.close();
-        cout << "Exported " << filename << " to " << basePath << endl;
-    };
+        if (cp < 0x800) {
+            out[n++] = (char)(0xC0 | (cp >> 6));
+        } else if (cp < 0x10000) {
+            out[n++] = (char)(0xE0 | (cp >> 12));
+            out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        } else {
+            out[n++] = (char)(0xF0 | (cp >> 18));
+            out[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+            out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        }
+        out[n++] = (char)(0x80 | (cp & 0x3F));
+    }
+    return n;
+}
 
-    auto topBooks = getResults("SELECT b.BookID, b.Title, COUNT(t.TransactionID) as IssueCount FROM dbo.Books b LEFT JOIN dbo.Transactions t ON b.BookID = t.BookID GROUP BY b.BookID, b.Title ORDER BY IssueCount DESC");
-    exportToFile("top_issued_books.csv", topBooks, "BookID,Title,IssueCount");
+// Appends the UTF-8 form of in to out, e.g. straight into a ResultSet pool.
+void appendUtf8(const char16_t* in, size_t len, string& out) {
+    size_t start = out.size();
+    out.resize(start + 3 * len);
+    out.resize(start + utf16ToUtf8(in, len, &out[start]));
+}
 
-    auto activeMembers = getResults("SELECT m.MemberID, m.Name, COUNT(t.TransactionID) as BooksIssued FROM dbo.Members m LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID, m.Name ORDER BY BooksIssued DESC");
-    exportToFile("active_members.csv", activeMembers, "MemberID,Name,BooksIssued");
+string toUtf8(const char16_t* in, size_t len) {
+    string out;
+    appendUtf8(in, len, out);
+    return out;
+}
 
-    auto fineSummary = getResults("SELECT m.MemberID, m.Name, SUM(t.FineAmount) as TotalFine FROM dbo.Members m LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID, m.Name ORDER BY TotalFine DESC");
-    exportToFile("fine_summary.csv", fineSummary, "MemberID,Name,TotalFine");
+// Replaces out with the UTF-16 form of text, reusing out's capacity.
+void assignUtf16(string_view text, u16string& out) {
+    out.resize(text.size());
+    out.resize(utf8ToUtf16(text.data(), text.size(), &out[0]));
 }
 
-bool login() {
-    int roleChoice;
-    string username, password, role;
+// NUL-terminated UTF-16 in a buffer reused by the calling thread; valid until the
+// thread's next call.
+const char16_t* toUtf16(string_view text) {
+    thread_local u16string buffer;
+    assignUtf16(text, buffer);
+    return buffer.c_str();
+}
 
-    cout << "Who wants to login?\n1) Admin\n2) User\nChoice: ";
-    cin >> roleChoice;
-    while (cin.fail() || roleChoice < 1 || roleChoice > 2) {
-        cout << "Invalid choice! Enter 1 for Admin or 2 for User: ";
-        cin.clear();
-        cin.ignore(10000, '\n');  // clear bad input
-        cin >> roleChoice;
-    }
+// Length of the longest prefix of s that does not end inside a multi-byte sequence,
+// for text the driver truncated to a byte count.
+size_t utf8CompleteLength(const char* s, size_t len) {
+    size_t lead = len;
+    while (lead > 0 && len - lead < 4 && ((unsigned char)s[lead - 1] & 0xC0) == 0x80) --lead;
+    if (lead == 0) return len;
+    unsigned char c = s[lead - 1];
+    size_t expected = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return len - (lead - 1) < expected ? lead - 1 : len;
+}
 
-    role = (roleChoice == 1) ? "Admin" : "User";
+// A value bound to a '?' placeholder. Strings, ints and doubles convert implicitly,
+// so call sites can pass {bookID, memberID} or {title, publishedYear, price}.
+struct SqlParam {
+    enum Kind { Text, Int, Double };
+    Kind kind;
+    string text;
+    long long intValue = 0;
+    double doubleValue = 0.0;
+
+    SqlParam(const string& value) : kind(Text), text(value) {}
+    SqlParam(const char* value) : SqlParam(string(value)) {}
+    SqlParam(int value) : kind(Int), intValue(value) {}
+    SqlParam(double value) : kind(Double), doubleValue(value) {}
+};
 
-    cout << "Enter Username: ";
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');  // clear leftover newline
-    getline(cin, username);
+enum class ColumnType { Int, Double, Date, Text };
 
-    cout << "Enter Password: ";
-    cin >> password;
+struct DateTimeValue {
+    short year = 0;
+    unsigned short month = 0, day = 0, hour = 0, minute = 0, second = 0;
+    unsigned fraction = 0;              // nanoseconds
+};
 
-    string query = "SELECT Role FROM dbo.Members WHERE Name = '" + username + "' AND Password = '" + password + "' AND Role = '" + role + "'";
-    auto res = getResults(query);
+struct ResultColumn {
+    string name;
+    ColumnType type = ColumnType::Text;
+    int scale = 0;                      // fractional digits for Double and Date columns
+    bool hasTime = false;               // Date columns: datetime rather than date
+};
 
-    if (res.empty()) {
-        cout << "Invalid credentials for " << role << "!" << endl;
-        return false;
-    }
+// One cell of a ResultSet row. Numbers are stored in place; text and dates live
+// in the set's pool at offset.
+struct ResultCell {
+    union {
+        long long intValue;
+        double doubleValue;
+        uint64_t offset;
+    };
+    uint32_t length;                    // Text: bytes in the pool
+    uint8_t null;
+};
 
-    currentUserRole = res[0][0];
-    cout << "Logged in as " << currentUserRole << endl;
-    return true;
-}
+// Row-major result set backed by two arenas: the cells, a fixed stride of
+// columnCount() per row, and one pool holding every text cell (and date) back to
+// back. Growing a set costs a handful of allocations however many rows and
+// columns it has, text is handed out as string_views into the pool, and the
+// whole thing is freed, or emptied for the next block, in one go.
+class ResultSet {
+public:
+    vector<ResultColumn> columns;
+    vector<ResultCell> cells;
+    string pool;
+
+    size_t size() const { return columns.empty() ? 0 : cells.size() / columns.size(); }
+    bool empty() const { return cells.empty(); }
+    size_t columnCount() const { return columns.size(); }
+
+    const ResultCell& at(size_t row, size_t col) const { return cells[row * columns.size() + col]; }
+    bool isNull(size_t row, size_t col) const { return at(row, col).null != 0; }
+    long long intAt(size_t row, size_t col) const { return at(row, col).intValue; }
+    double doubleAt(size_t row, size_t col) const { return at(row, col).doubleValue; }
+    DateTimeValue dateAt(size_t row, size_t col) const {
+        DateTimeValue d;
+        const ResultCell& c = at(row, col);
+        if (c.length == sizeof(d)) memcpy(&d, pool.data() + c.offset, sizeof(d));
+        return d;
+    }
+    string_view text(size_t row, size_t col) const {
+        const ResultCell& c = at(row, col);
+        return string_view(pool.data() + c.offset, c.length);
+    }
 
-void showPaginated(const vector<vector<string>>& data, const string& type) {
-    if (data.empty()) {
-        cout << "No " << type << " found." << endl;
-        return;
+    // Formats a cell for display (NULL as "NULL") into buf and returns a view of
+    // it; Text cells are returned straight from the pool.
+    string_view cell(size_t row, size_t col, char* buf, size_t bufSize) const {
+        const ResultColumn& c = columns[col];
+        const ResultCell& v = at(row, col);
+        if (v.null) return "NULL";
+        int n = 0;
+        switch (c.type) {
+            case ColumnType::Text:
+                return text(row, col);
+            case ColumnType::Int:
+                n = snprintf(buf, bufSize, "%lld", v.intValue);
+                break;
+            case ColumnType::Double:
+                if (c.scale > 0) n = snprintf(buf, bufSize, "%.*f", c.scale, v.doubleValue);
+                else n = snprintf(buf, bufSize, "%.15g", v.doubleValue);
+                break;
+            case ColumnType::Date: {
+                DateTimeValue d = dateAt(row, col);
+                n = snprintf(buf, bufSize, "%04d-%02u-%02u", d.year, d.month, d.day);
+                if (c.hasTime) {
+                    n += snprintf(buf + n, bufSize - n, " %02u:%02u:%02u", d.hour, d.minute, d.second);
+                    if (c.scale > 0) {
+                        char frac[16];
+                        snprintf(frac, sizeof(frac), "%09u", d.fraction);
+                        n += snprintf(buf + n, bufSize - n, ".%.*s", min(c.scale, 9), frac);
+                    }
+                }
+                break;
+            }
+        }
+        return string_view(buf, min<size_t>(max(n, 0), bufSize - 1));
+    }
+    string cellString(size_t row, size_t col) const {
+        char buf[64];
+        return string(cell(row, col, buf, sizeof(buf)));
     }
 
-    const int pageSize = 5;
-    int page = 0;
-    char choice;
+    // Appends count rows of NULL cells and returns the first; fetchers fill them in.
+    ResultCell* appendRows(size_t count) {
+        size_t first = cells.size();
+        ResultCell blank = {};
+        blank.null = 1;
+        cells.resize(first + count * columns.size(), blank);
+        return cells.data() + first;
+    }
+    void setText(ResultCell& cell, const char* text, size_t len) {
+        cell.null = 0;
+        cell.offset = pool.size();
+        cell.length = (uint32_t)len;
+        pool.append(text, len);
+    }
+    void setDate(ResultCell& cell, const DateTimeValue& d) {
+        setText(cell, (const char*)&d, sizeof(d));
+    }
 
-    do {
-        system("cls");
-        int start = page * pageSize;
-        int end = min(start + pageSize, static_cast<int>(data.size()));
+    // Drops the rows but keeps the column layout and the arenas' capacity, so a
+    // streaming fetch can refill it without allocating.
+    void clearRows() {
+        cells.clear();
+        pool.clear();
+    }
 
-        if (type == "Books") {
-            cout << left << setw(5) << "ID"
-                 << setw(25) << "Title"
-                 << setw(20) << "Authors"
-                 << setw(12) << "Genre"
-                 << setw(15) << "Publisher"
-                 << setw(8) << "Ed."
-                 << setw(6) << "Year"
-                 << setw(8) << "Price"
-                 << setw(10) << "Rack"
-                 << setw(12) << "Language"
-                 << setw(8) << "Avail" << endl;
-            cout << string(125, '-') << endl;
-
-            for (int i = start; i < end; ++i) {
-                if (data[i].size() < 11) {
-                    cout << "Warning: Row " << i << " has incomplete data." << endl;
-                    continue;
-                }
-                cout << left << setw(5) << data[i][0]
-                     << setw(25) << data[i][1].substr(0, 24)
-                     << setw(20) << data[i][2].substr(0, 19)
-                     << setw(12) << data[i][3].substr(0, 11)
-                     << setw(15) << data[i][4].substr(0, 14)
-                     << setw(8)  << data[i][5]
-                     << setw(6)  << data[i][6]
-                     << setw(8)  << data[i][7]
-                     << setw(10) << data[i][8].substr(0, 8)
-                     << setw(12) << data[i][9].substr(0, 10)
-                     << setw(8)  << data[i][10]
-                     << endl;
-            }
-        } else if (type == "Members") {
-            cout << left << setw(8) << "ID"
-                 << setw(30) << "Name"
-                 << setw(30) << "Email"
-                 << setw(10) << "Type" << endl;
-            cout << string(78, '-') << endl;
-
-            for (int i = start; i < end; ++i) {
-                cout << left << setw(8) << data[i][0]
-                     << setw(30) << data[i][1].substr(0, 29)
-                     << setw(30) << data[i][2].substr(0, 29)
-                     << setw(10) << data[i][3] << endl;
-            }
-        } else if (type == "Transactions") {
-            cout << left << setw(8) << "ID"
-                 << setw(10) << "BookID"
-                 << setw(10) << "MemberID"
-                 << setw(12) << "IssueDate"
-                 << setw(12) << "DueDate"
-                 << setw(10) << "Status"
-                 << setw(8)  << "Fine" << endl;
-            cout << string(78, '-') << endl;
-
-            for (int i = start; i < end; ++i) {
-                cout << left << setw(8) << data[i][0]
-                     << setw(10) << data[i][1]
-                     << setw(10) << data[i][2]
-                     << setw(12) << data[i][3]
-                     << setw(12) << data[i][4]
-                     << setw(10) << data[i][5]
-                     << setw(8)  << data[i][6] << endl;
-            }
-        } else if (type == "TopBooks") {
-            cout << left << setw(8) << "BookID"
-                 << setw(30) << "Title"
-                 << setw(12) << "IssueCount" << endl;
-            cout << string(50, '-') << endl;
-
-            for (int i = start; i < end; ++i) {
-                cout << left << setw(8) << data[i][0]
-                     << setw(30) << data[i][1].substr(0, 29)
-                     << setw(12) << data[i][2] << endl;
-            }
-        } else if (type == "ActiveMembers" || type == "Fines") {
-            string label = (type == "ActiveMembers") ? "BooksIssued" : "TotalFine";
-            cout << left << setw(10) << "MemberID"
-                 << setw(30) << "Name"
-                 << setw(15) << label << endl;
-            cout << string(55, '-') << endl;
-
-            for (int i = start; i < end; ++i) {
-                cout << left << setw(10) << data[i][0]
-                     << setw(30) << data[i][1].substr(0, 29)
-                     << setw(15) << data[i][2] << endl;
-            }
+    // Builds a result in memory, e.g. from a cache instead of a query.
+    void addColumn(const string& name, ColumnType type, int scale = 0) {
+        ResultColumn col;
+        col.name = name;
+        col.type = type;
+        col.scale = scale;
+        col.hasTime = type == ColumnType::Date;
+        columns.push_back(move(col));
+    }
+    void addTextColumn(const string& name) { addColumn(name, ColumnType::Text); }
+    void addTextRow(initializer_list<string_view> cells) { addTextCells(cells); }
+    void addTextRow(const vector<string>& cells) { addTextCells(cells); }
+
+private:
+    template <typename Cells>
+    void addTextCells(const Cells& values) {
+        ResultCell* row = appendRows(1);
+        size_t c = 0;
+        for (string_view value : values) {
+            if (c == columns.size()) break;
+            setText(row[c++], value.data(), value.size());
         }
+    }
+};
 
-        int totalPages = (data.size() + pageSize - 1) / pageSize;
-        cout << "\nPage " << (page + 1) << " of " << totalPages;
-        cout << " | [N]ext, [P]revious, [Q]uit: ";
-        cin >> choice;
-        choice = toupper(choice);
-        cin.ignore(10000, '\n');  // clear input buffer after reading choice
+const size_t resultBlockRows = 256;
+const size_t maxTextColumnChars = 1023;
 
-        if (choice == 'N' && end < static_cast<int>(data.size()))
-            ++page;
-        else if (choice == 'P' && page > 0)
-            --page;
+// Receives a streamed result one block (up to resultBlockRows rows) at a time;
+// the block is reused afterwards. Return false to stop the fetch.
+using RowBlockSink = function<bool(const ResultSet& block)>;
 
-    } while (choice != 'Q');
+struct BookImportRow;
 
-    cout << "Exiting view. Press Enter to continue...";
-    cin.ignore();
-    cin.get();
-}
 struct Config {
-    double fineRate;
-    int maxBooksPerMember;
-    int reservationDurationDays;
+    double fineRate = 1.00;
+    int maxBooksPerMember = 5;
+    int reservationDurationDays = 7;
 };
 
-Config getConfig() {
-    Config config = {1.00, 5, 7};
-    auto res = getResults("SELECT FineRate, MaxBooksPerMember, ReservationDurationDays FROM dbo.Config WHERE ConfigID = 1");
-    if (!res.empty()) {
-        try {
-            config.fineRate = stod(res[0][0]);
-            config.maxBooksPerMember = stoi(res[0][1]);
-            config.reservationDurationDays = stoi(res[0][2]);
-        } catch (const std::exception& e) {
-            cout << "Error parsing config values: " << e.what() << endl;
-            // fallback to defaults already set
-        }
+// OnShelf is for reservations only: the book is available, so issue it instead.
+enum class CirculationStatus { Done, NotFound, Unavailable, LimitReached, OnShelf, Failed };
+
+// Outcome of an issue or return, with how long each step took.
+struct CirculationResult {
+    CirculationStatus status = CirculationStatus::Failed;
+    int transactionID = 0;
+    int bookID = 0;
+    int memberID = 0;
+    int maxBooks = 0;
+    double fine = 0.0;
+    bool replayed = false;      // a journal key that had already been applied; nothing was written
+    uint64_t journalSeq = 0;    // set when the desk journal accepted it; the database write follows
+    vector<pair<string, double>> steps;  // step name, milliseconds
+};
+
+// Appends the time since the previous mark to a result's step list.
+class StepTimer {
+public:
+    explicit StepTimer(vector<pair<string, double>>& steps) : steps(steps), last(chrono::steady_clock::now()) {}
+    void mark(const string& step) {
+        auto now = chrono::steady_clock::now();
+        steps.emplace_back(step, chrono::duration<double, milli>(now - last).count());
+        last = now;
     }
-    return config;
-}
 
-void addBook() {
-    string title, authors, genre, publisher, isbn, edition, rackLocation, language, availability;
-    int publishedYear = 0;
-    double price = 0.0;
+private:
+    vector<pair<string, double>>& steps;
+    chrono::steady_clock::time_point last;
+};
 
-    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // clear input buffer
-    cout << "Enter Title: "; getline(cin, title);
-    cout << "Enter Authors: "; getline(cin, authors);
-    cout << "Enter Genre: "; getline(cin, genre);
-    cout << "Enter Publisher: "; getline(cin, publisher);
-    cout << "Enter ISBN: "; getline(cin, isbn);
-    cout << "Enter Edition: "; getline(cin, edition);
-    cout << "Enter Published Year: "; cin >> publishedYear;
-    cout << "Enter Price: "; cin >> price;
-    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    cout << "Enter Rack Location: "; getline(cin, rackLocation);
-    cout << "Enter Language: "; getline(cin, language);
-    cout << "Is Available (Yes/No): "; getline(cin, availability);
+// Latency histogram with log-spaced buckets about 4% wide, from a microsecond
+// to several minutes. It has a fixed size and merges by adding counts, so each
+// thread keeps its own and the totals are combined afterwards.
+class LatencyHistogram {
+public:
+    static const size_t bucketCount = 512;
 
-    if (title.empty() || authors.empty() || isbn.empty()) {
-        cout << "Title, Authors, and ISBN are required!" << endl;
-        return;
+    LatencyHistogram() : counts(bucketCount) {}
+
+    void record(double ms) {
+        counts[bucketFor(ms)]++;
+        total++;
+        sum += ms;
+        maxMs = max(maxMs, ms);
     }
 
-    // Normalize availability to lowercase for comparison
-    string availabilityLower = availability;
-    transform(availabilityLower.begin(), availabilityLower.end(), availabilityLower.begin(), ::tolower);
-    if (availabilityLower != "yes" && availabilityLower != "no") {
-        cout << "Availability must be 'Yes' or 'No'." << endl;
-        return;
+    void merge(const LatencyHistogram& other) {
+        for (size_t b = 0; b < bucketCount; ++b) counts[b] += other.counts[b];
+        total += other.total;
+        sum += other.sum;
+        maxMs = max(maxMs, other.maxMs);
     }
 
-    auto escape = [](string& str) {
-        for (size_t i = 0; i < str.length(); ++i) {
-            if (str[i] == '\'') str.insert(i++, "'");
+    size_t count() const { return total; }
+    double mean() const { return total ? sum / total : 0.0; }
+    double maximum() const { return maxMs; }
+
+    // Upper edge of the bucket holding the p-th percentile, capped at the maximum seen.
+    double percentile(double p) const {
+        if (total == 0) return 0.0;
+        uint64_t rank = (uint64_t)ceil(p / 100.0 * total);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < bucketCount; ++b) {
+            seen += counts[b];
+            if (seen >= max<uint64_t>(rank, 1)) return min(upperMs(b), maxMs);
         }
-    };
-
-    escape(title);
-    escape(authors);
-    escape(genre);
-    escape(publisher);
-    escape(isbn);
-    escape(edition);
-    escape(rackLocation);
-    escape(language);
-    escape(availability);
-
-    auto res = getResults("SELECT ISBN FROM dbo.Books WHERE ISBN = '" + isbn + "'");
-    if (!res.empty()) {
-        cout << "ISBN already exists!" << endl;
-        return;
+        return maxMs;
     }
 
-    string query = "INSERT INTO dbo.Books "
-                   "(Title, Authors, Genre, Publisher, ISBN, Edition, PublishedYear, Price, RackLocation, Language, Availability) "
-                   "VALUES ('" + title + "', '" + authors + "', '" + genre + "', '" + publisher + "', '" + isbn + "', '" + edition + "', "
-                   + to_string(publishedYear) + ", " + to_string(price) + ", '" + rackLocation + "', '" + language + "', '" + availability + "')";
+    static double upperMs(size_t bucket) { return pow(growth, (double)bucket) / 1000.0; }
+    uint64_t bucket(size_t b) const { return counts[b]; }
 
-    if (runQuery(query)) {
-        cout << "Book added!" << endl;
-    } else {
-        cout << "Failed to add book." << endl;
+private:
+    static constexpr double growth = 1.04;
+
+    static size_t bucketFor(double ms) {
+        double us = ms * 1000.0;
+        if (us <= 1.0) return 0;
+        return min(bucketCount - 1, (size_t)ceil(log(us) / log(growth)));
     }
+
+    vector<uint64_t> counts;
+    uint64_t total = 0;
+    double sum = 0.0;
+    double maxMs = 0.0;
+};
+
+// ---- Metrics ----
+// Counters for every statement sent to the backend and every desk operation.
+// Each thread writes only its own block of relaxed atomics, so the hot path
+// takes no lock and shares no cache line; readers (the Diagnostics menu and
+// the metrics file) add the blocks up.
+
+// Upper bounds of the latency buckets in milliseconds; one more bucket is +Inf.
+const double metricBucketsMs[] = {0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 10000};
+const size_t metricBucketCount = sizeof(metricBucketsMs) / sizeof(metricBucketsMs[0]) + 1;
+// Statement templates and operations beyond this share the last slot.
+const size_t maxMetricSlots = 256;
+
+enum class MetricKind { Statement, Operation };
+
+// Heap allocations made by this thread. The global operator new below counts
+// them so statements and operations can report how many they cost.
+thread_local uint64_t threadAllocations = 0;
+
+// Kept out of line: once inlined, GCC sees malloc() paired with operator delete
+// and warns of a mismatch.
+#ifdef __GNUC__
+#define LIBRARY_NOINLINE __attribute__((noinline))
+#else
+#define LIBRARY_NOINLINE
+#endif
+LIBRARY_NOINLINE void* operator new(size_t size) {
+    ++threadAllocations;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
 }
+LIBRARY_NOINLINE void operator delete(void* p) noexcept { free(p); }
+LIBRARY_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
 
-void updateBook() {
-    string bookID;
-    cout << "Enter BookID: ";
-    cin >> bookID;
+struct MetricCounters {
+    atomic<uint64_t> calls{0}, errors{0}, rows{0}, bytes{0}, roundTrips{0}, micros{0}, allocations{0};
+    atomic<uint64_t> buckets[metricBucketCount] = {};
+};
 
-    if (!all_of(bookID.begin(), bookID.end(), ::isdigit)) {
-        cout << "BookID must be numeric!" << endl;
-        return;
+// A plain copy of MetricCounters, for summing and printing.
+struct MetricTotals {
+    uint64_t calls = 0, errors = 0, rows = 0, bytes = 0, roundTrips = 0, micros = 0, allocations = 0;
+    uint64_t buckets[metricBucketCount] = {};
+
+    void add(const MetricCounters& c) {
+        calls += c.calls.load(memory_order_relaxed);
+        errors += c.errors.load(memory_order_relaxed);
+        rows += c.rows.load(memory_order_relaxed);
+        bytes += c.bytes.load(memory_order_relaxed);
+        roundTrips += c.roundTrips.load(memory_order_relaxed);
+        micros += c.micros.load(memory_order_relaxed);
+        allocations += c.allocations.load(memory_order_relaxed);
+        for (size_t b = 0; b < metricBucketCount; ++b) buckets[b] += c.buckets[b].load(memory_order_relaxed);
     }
-
-    auto res = getResults("SELECT BookID FROM dbo.Books WHERE BookID = '" + bookID + "'");
-    if (res.empty()) {
-        cout << "Book not found!" << endl;
-        return;
+    void add(const MetricTotals& t) {
+        calls += t.calls;
+        errors += t.errors;
+        rows += t.rows;
+        bytes += t.bytes;
+        roundTrips += t.roundTrips;
+        micros += t.micros;
+        allocations += t.allocations;
+        for (size_t b = 0; b < metricBucketCount; ++b) buckets[b] += t.buckets[b];
+    }
+    double meanMs() const { return calls ? micros / 1000.0 / calls : 0.0; }
+    // Upper bound of the bucket holding the p-th percentile.
+    double percentileMs(double p) const {
+        uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(p / 100.0 * calls)), seen = 0;
+        for (size_t b = 0; b + 1 < metricBucketCount; ++b) {
+            seen += buckets[b];
+            if (seen >= rank) return metricBucketsMs[b];
+        }
+        return calls ? metricBucketsMs[metricBucketCount - 2] : 0.0;
     }
+};
 
-    string title, authors, isbn;
-    cout << "Enter new Title (blank to skip): ";
-    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    getline(cin, title);
-    cout << "Enter new Authors (blank to skip): ";
-    getline(cin, authors);
-    cout << "Enter new ISBN (blank to skip): ";
-    getline(cin, isbn);
+struct ThreadMetrics {
+    MetricCounters slots[maxMetricSlots];
+};
 
-    string query = "UPDATE dbo.Books SET ";
-    bool hasUpdate = false;
+// Only the owning thread writes its counters, so a load and a store are enough.
+inline void bumpMetric(atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+struct MetricKey {
+    MetricKind kind;
+    string name;
+};
 
-    auto escape = [](string& str) {
-        for (size_t i = 0; i < str.length(); ++i) {
-            if (str[i] == '\'') str.insert(i++, "'");
+// Names the slots and keeps the list of live thread blocks. Counts from threads
+// that have exited are folded into retired so they are not lost.
+class MetricRegistry {
+public:
+    size_t slot(MetricKind kind, const string& name) {
+        string key = (kind == MetricKind::Statement ? "s:" : "o:") + name;
+        {
+            shared_lock<shared_mutex> lock(keyMutex);
+            auto it = slotByKey.find(key);
+            if (it != slotByKey.end()) return it->second;
         }
-    };
+        unique_lock<shared_mutex> lock(keyMutex);
+        auto it = slotByKey.find(key);
+        if (it != slotByKey.end()) return it->second;
+        size_t index = maxMetricSlots - 1;
+        if (keys.size() < index) {
+            index = keys.size();
+            keys.push_back({kind, name});
+        } else if (keys.size() == index) {
+            keys.push_back({kind, "(other)"});
+        }
+        slotByKey.emplace(key, index);
+        return index;
+    }
 
-    if (!title.empty()) {
-        escape(title);
-        query += "Title = '" + title + "'";
-        hasUpdate = true;
+    void attach(ThreadMetrics* block) {
+        lock_guard<mutex> lock(threadMutex);
+        threads.push_back(block);
     }
-    if (!authors.empty()) {
-        escape(authors);
-        query += (hasUpdate ? ", " : "") + string("Authors = '") + authors + "'";
-        hasUpdate = true;
+    void detach(ThreadMetrics* block) {
+        lock_guard<mutex> lock(threadMutex);
+        for (size_t s = 0; s < maxMetricSlots; ++s) retired[s].add(block->slots[s]);
+        threads.erase(find(threads.begin(), threads.end(), block));
     }
-    if (!isbn.empty()) {
-        escape(isbn);
-        auto res = getResults("SELECT ISBN FROM dbo.Books WHERE ISBN = '" + isbn + "' AND BookID != '" + bookID + "'");
-        if (!res.empty()) {
-            cout << "ISBN already exists!" << endl;
-            return;
+
+    // Every named slot with its totals across all threads, live and exited.
+    vector<pair<MetricKey, MetricTotals>> collect() {
+        vector<MetricKey> names;
+        {
+            shared_lock<shared_mutex> lock(keyMutex);
+            names = keys;
         }
-        query += (hasUpdate ? ", " : "") + string("ISBN = '") + isbn + "'";
-        hasUpdate = true;
+        vector<pair<MetricKey, MetricTotals>> out;
+        lock_guard<mutex> lock(threadMutex);
+        for (size_t s = 0; s < names.size(); ++s) {
+            MetricTotals totals = retired[s];
+            for (ThreadMetrics* block : threads) totals.add(block->slots[s]);
+            out.emplace_back(names[s], totals);
+        }
+        return out;
     }
 
-    if (!hasUpdate) {
-        cout << "No changes provided!" << endl;
-        return;
+private:
+    shared_mutex keyMutex;
+    unordered_map<string, size_t> slotByKey;
+    vector<MetricKey> keys;
+    mutex threadMutex;
+    vector<ThreadMetrics*> threads;
+    MetricTotals retired[maxMetricSlots];
+};
+MetricRegistry metricRegistry;
+
+// The calling thread's counters, registered on first use.
+class ThreadMetricsHandle {
+public:
+    ThreadMetricsHandle() : block(make_unique<ThreadMetrics>()) { metricRegistry.attach(block.get()); }
+    ~ThreadMetricsHandle() { metricRegistry.detach(block.get()); }
+
+    MetricCounters& statement(const string& sqlTemplate) { return lookup(MetricKind::Statement, sqlTemplate); }
+    MetricCounters& operation(const string& name) { return lookup(MetricKind::Operation, name); }
+
+private:
+    MetricCounters& lookup(MetricKind kind, const string& name) {
+        auto& cache = slotCache[(int)kind];
+        auto it = cache.find(name);
+        if (it == cache.end()) it = cache.emplace(name, metricRegistry.slot(kind, name)).first;
+        return block->slots[it->second];
     }
 
-    query += " WHERE BookID = '" + bookID + "'";
+    unique_ptr<ThreadMetrics> block;
+    unordered_map<string, size_t> slotCache[2];  // per MetricKind; spares the registry lock
+};
 
-    if (runQuery(query)) {
-        cout << "Book updated!" << endl;
-    } else {
-        cout << "Failed to update book." << endl;
-    }
+ThreadMetricsHandle& threadMetrics() {
+    thread_local ThreadMetricsHandle handle;
+    return handle;
 }
 
-void deleteBook() {
-    string bookID;
-    cout << "Enter BookID: ";
-    cin >> bookID;
+void recordLatency(MetricCounters& c, double ms) {
+    bumpMetric(c.calls, 1);
+    bumpMetric(c.micros, (uint64_t)(ms * 1000.0));
+    size_t b = 0;
+    while (b + 1 < metricBucketCount && ms > metricBucketsMs[b]) ++b;
+    bumpMetric(c.buckets[b], 1);
+}
 
-    if (!all_of(bookID.begin(), bookID.end(), ::isdigit)) {
-        cout << "BookID must be numeric!" << endl;
-        return;
+// A desk operation (issue, return, search, ...) in progress on this thread.
+// Statements run while it is open count as its round trips, including ones
+// run by QueryPool tasks it submits, so it must outlive those tasks.
+class OperationMetrics {
+public:
+    explicit OperationMetrics(const char* name)
+        : name(name), outer(current), start(chrono::steady_clock::now()), startAllocations(threadAllocations) {
+        current = this;
+    }
+    ~OperationMetrics() {
+        current = outer;
+        uint64_t trips = roundTrips.load(memory_order_relaxed);
+        if (outer) outer->roundTrips.fetch_add(trips, memory_order_relaxed);
+        uint64_t allocations = threadAllocations - startAllocations;
+        MetricCounters& c = threadMetrics().operation(name);
+        recordLatency(c, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        bumpMetric(c.roundTrips, trips);
+        bumpMetric(c.allocations, allocations);
     }
 
-    auto res = getResults("SELECT BookID FROM dbo.Books WHERE BookID = '" + bookID + "'");
-    if (res.empty()) {
-        cout << "Book not found!" << endl;
-        return;
+    static thread_local OperationMetrics* current;
+    atomic<uint64_t> roundTrips{0};
+
+private:
+    const char* name;
+    OperationMetrics* outer;
+    chrono::steady_clock::time_point start;
+    uint64_t startAllocations;  // on this thread only, not in QueryPool tasks
+};
+thread_local OperationMetrics* OperationMetrics::current = nullptr;
+
+// Times one statement (one round trip) on this thread. Call finish() with the
+// outcome; a StatementMetrics destroyed without it counts as an error.
+class StatementMetrics {
+public:
+    explicit StatementMetrics(const string& sqlTemplate)
+        : sqlTemplate(sqlTemplate), start(chrono::steady_clock::now()), startAllocations(threadAllocations) {}
+    // The template is kept by reference, so it must outlive the statement.
+    explicit StatementMetrics(string&&) = delete;
+    ~StatementMetrics() {
+        if (!finished) finish(false);
     }
 
-    string query = "DELETE FROM dbo.Books WHERE BookID = '" + bookID + "'";
-    if (runQuery(query)) {
-        cout << "Book deleted!" << endl;
-    } else {
-        cout << "Failed to delete book." << endl;
+    void finish(bool ok, size_t rows = 0, size_t bytes = 0) {
+        finished = true;
+        uint64_t allocations = threadAllocations - startAllocations;
+        MetricCounters& c = threadMetrics().statement(sqlTemplate);
+        recordLatency(c, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        if (!ok) bumpMetric(c.errors, 1);
+        bumpMetric(c.rows, rows);
+        bumpMetric(c.bytes, bytes);
+        bumpMetric(c.allocations, allocations);
+        bumpMetric(c.roundTrips, 1);
+        if (OperationMetrics::current) OperationMetrics::current->roundTrips.fetch_add(1, memory_order_relaxed);
     }
+
+private:
+    const string& sqlTemplate;
+    chrono::steady_clock::time_point start;
+    uint64_t startAllocations;
+    bool finished = false;
+};
+
+// Names under which transaction control shows up in the statement metrics.
+const string beginStatement = "BEGIN IMMEDIATE", commitStatement = "COMMIT", rollbackStatement = "ROLLBACK";
+
+// One session with the storage backend, with its own prepared statements.
+// Only the thread holding the lease touches it.
+class StorageConnection {
+public:
+    virtual ~StorageConnection() {}
+
+    virtual bool connect() = 0;
+    virtual void disconnect() = 0;
+    // Cheap liveness probe for connections that sat idle.
+    virtual bool isAlive() = 0;
+
+    // Runs a statement that returns no rows.
+    virtual bool execute(const string& sql, const vector<SqlParam>& params, long long* rowsAffected) = 0;
+    // Runs a query and appends its rows to rs.
+    virtual bool fetch(const string& sql, const vector<SqlParam>& params, ResultSet& rs) = 0;
+    // Runs a query and hands its rows to sink block by block without keeping them.
+    virtual bool fetchBlocks(const string& sql, const vector<SqlParam>& params, const RowBlockSink& sink) = 0;
+
+    virtual void begin() = 0;
+    virtual bool commit() = 0;
+    virtual void rollback() = 0;
+
+    // Asks the statement running on this connection to stop. Unlike everything
+    // else here it is called from another thread, while the owner is blocked.
+    virtual void cancel() = 0;
+
+    // Inserts rows[begin, begin + count) of a book import and commits them as one
+    // batch, setting rowOk per row. Returns false if the batch as a whole failed.
+    virtual bool insertBookBatch(const vector<BookImportRow>& rows, size_t begin, size_t count, vector<char>& rowOk) = 0;
+
+    // Issues a book: checks the book, member and loan limit, records the loan and
+    // marks the book out, all in one transaction. Backends with a network hop
+    // override these to do it in a single round trip. A non-empty journalKey is
+    // recorded in JournalApplied with the loan; if it is already there nothing is
+    // written and the result is Done with replayed set.
+    virtual CirculationResult issueBook(int bookID, int memberID, const Config& config, const string& journalKey);
+    // Returns a loan, charging the configured fine per day overdue.
+    virtual CirculationResult returnBook(int transactionID, const Config& config, const string& journalKey);
+    // Reserves a book that is out, checked against the tables rather than the cache.
+    CirculationResult reserveBook(int bookID, int memberID, const Config& config, const string& journalKey);
+    // Creates JournalApplied where the backend's schema does not already have it.
+    virtual bool ensureJournalTable() { return true; }
+
+    virtual size_t cachedStatements() const = 0;
+
+    atomic<size_t> statementHits{0};
+    atomic<size_t> statementMisses{0};
+    chrono::steady_clock::time_point lastUsed;
+    bool broken = false;
+
+protected:
+    // Inside an open transaction: whether journalKey was applied before, filling
+    // in the TransactionID it was applied as.
+    bool journalKeyApplied(const string& journalKey, CirculationResult& result, bool& applied);
+    bool recordJournalKey(const string& journalKey, int transactionID);
+};
+
+bool StorageConnection::journalKeyApplied(const string& journalKey, CirculationResult& result, bool& applied) {
+    applied = false;
+    if (journalKey.empty()) return true;
+    ResultSet rs;
+    if (!fetch("SELECT TransactionID FROM dbo.JournalApplied WHERE JournalKey = ?", {journalKey}, rs)) return false;
+    if (rs.empty()) return true;
+    applied = true;
+    result.status = CirculationStatus::Done;
+    result.replayed = true;
+    result.transactionID = atoi(rs.cellString(0, 0).c_str());
+    return true;
 }
 
-void viewBooks() {
-    auto res = getResults("SELECT DB_NAME() AS DatabaseName");
-    if (!res.empty()) {
-        cout << "Connected to database: " << res[0][0] << endl;
-    } else {
-        cout << "Failed to retrieve database name." << endl;
+bool StorageConnection::recordJournalKey(const string& journalKey, int transactionID) {
+    if (journalKey.empty()) return true;
+    return execute("INSERT INTO dbo.JournalApplied (JournalKey, TransactionID, AppliedAt) VALUES (?, ?, GETDATE())", {journalKey, transactionID},
+                   nullptr);
+}
+
+// Default circulation: one statement at a time inside a transaction. Fine for an
+// embedded database, where a "round trip" is a function call.
+CirculationResult StorageConnection::issueBook(int bookID, int memberID, const Config& config, const string& journalKey) {
+    CirculationResult result;
+    StepTimer timer(result.steps);
+    begin();
+    result.bookID = bookID;
+    result.memberID = memberID;
+    result.maxBooks = config.maxBooksPerMember;
+    bool applied;
+    ResultSet book, member, issued, inserted;
+    bool ok = journalKeyApplied(journalKey, result, applied) &&
+              (applied || (fetch("SELECT Availability FROM dbo.Books WHERE BookID = ?", {bookID}, book) &&
+                           fetch("SELECT MemberID FROM dbo.Members WHERE MemberID = ?", {memberID}, member) &&
+                           fetch("SELECT COUNT(*) FROM dbo.Transactions WHERE MemberID = ? AND Status = 'Issued'", {memberID}, issued)));
+    timer.mark("checks");
+    if (!ok || applied) {
+        rollback();
+        return result;
     }
 
-    res = getResults(
-        "SELECT BookID, Title, Authors, Genre, Publisher, Edition, PublishedYear, Price, RackLocation, Language, Availability "
-        "FROM dbo.Books ORDER BY BookID"
-    );
+    if (book.empty() || member.empty()) {
+        result.status = CirculationStatus::NotFound;
+    } else if (book.cellString(0, 0) == "No") {
+        result.status = CirculationStatus::Unavailable;
+    } else if (atoi(issued.cellString(0, 0).c_str()) >= result.maxBooks) {
+        result.status = CirculationStatus::LimitReached;
+    } else if (fetch("INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, Status) OUTPUT INSERTED.TransactionID "
+                     "VALUES (?, ?, GETDATE(), DATEADD(day, ?, GETDATE()), 'Issued')", {bookID, memberID, config.reservationDurationDays}, inserted) &&
+               execute("UPDATE dbo.Books SET Availability = 'No' WHERE BookID = ?", {bookID}, nullptr)) {
+        result.transactionID = inserted.empty() ? 0 : atoi(inserted.cellString(0, 0).c_str());
+        if (recordJournalKey(journalKey, result.transactionID)) result.status = CirculationStatus::Done;
+    }
+    timer.mark("writes");
 
-    cout << "Fetched " << res.size() << " books from dbo.Books" << endl;
-    showPaginated(res, "Books");
+    if (result.status != CirculationStatus::Done) rollback();
+    else if (!commit()) result.status = CirculationStatus::Failed;
+    timer.mark("commit");
+    return result;
 }
 
-void searchBooks() {
-    string value;
-    cout << "Enter Title or Author to search: ";
-    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    getline(cin, value);
+CirculationResult StorageConnection::returnBook(int transactionID, const Config& config, const string& journalKey) {
+    CirculationResult result;
+    StepTimer timer(result.steps);
+    result.transactionID = transactionID;
+    begin();
+    bool applied;
+    ResultSet loan, fine;
+    bool ok = journalKeyApplied(journalKey, result, applied);
+    if (ok && applied) {
+        // Already returned by this key: report the loan as it was closed.
+        ok = fetch("SELECT BookID, MemberID, ISNULL(FineAmount, 0) FROM dbo.Transactions WHERE TransactionID = ?", {transactionID}, loan);
+        if (ok && !loan.empty()) {
+            result.bookID = atoi(loan.cellString(0, 0).c_str());
+            result.memberID = atoi(loan.cellString(0, 1).c_str());
+            result.fine = atof(loan.cellString(0, 2).c_str());
+        }
+        result.transactionID = transactionID;
+        timer.mark("checks");
+        rollback();
+        if (!ok) result.status = CirculationStatus::Failed;
+        return result;
+    }
+    ok = ok && fetch("SELECT BookID, MemberID FROM dbo.Transactions WHERE TransactionID = ? AND Status = 'Issued'", {transactionID}, loan);
+    timer.mark("checks");
+    if (!ok) {
+        rollback();
+        return result;
+    }
 
-    // Escape single quotes for SQL query safety
-    for (size_t i = 0; i < value.length(); ++i) {
-        if (value[i] == '\'') value.insert(i++, "'");
+    if (loan.empty()) {
+        result.status = CirculationStatus::NotFound;
+    } else {
+        result.bookID = atoi(loan.cellString(0, 0).c_str());
+        result.memberID = atoi(loan.cellString(0, 1).c_str());
+        if (execute("UPDATE dbo.Transactions SET Status = 'Returned', ReturnDate = GETDATE(), "
+                    "FineAmount = CASE WHEN GETDATE() > DueDate THEN DATEDIFF(day, DueDate, GETDATE()) * ? ELSE 0 END "
+                    "WHERE TransactionID = ?", {config.fineRate, transactionID}, nullptr) &&
+            execute("UPDATE dbo.Books SET Availability = 'Yes' WHERE BookID = ?", {result.bookID}, nullptr) &&
+            fetch("SELECT ISNULL(FineAmount, 0) FROM dbo.Transactions WHERE TransactionID = ?", {transactionID}, fine) &&
+            recordJournalKey(journalKey, transactionID)) {
+            result.status = CirculationStatus::Done;
+            result.fine = fine.empty() ? 0.0 : atof(fine.cellString(0, 0).c_str());
+        }
     }
+    timer.mark("writes");
 
-    string query = "SELECT BookID, Title, Authors, Availability FROM dbo.Books WHERE Title LIKE '%" + value + "%' OR Authors LIKE '%" + value + "%'";
-    auto res = getResults(query);
-    showPaginated(res, "Books");
+    if (result.status != CirculationStatus::Done) rollback();
+    else if (!commit()) result.status = CirculationStatus::Failed;
+    timer.mark("commit");
+    return result;
 }
 
-vector<vector<string>> getResults(const string &query);
+CirculationResult StorageConnection::reserveBook(int bookID, int memberID, const Config& config, const string& journalKey) {
+    CirculationResult result;
+    StepTimer timer(result.steps);
+    result.bookID = bookID;
+    result.memberID = memberID;
+    begin();
+    bool applied;
+    ResultSet book, member;
+    bool ok = journalKeyApplied(journalKey, result, applied) &&
+              (applied || (fetch("SELECT Availability FROM dbo.Books WHERE BookID = ?", {bookID}, book) &&
+                           fetch("SELECT MemberID FROM dbo.Members WHERE MemberID = ?", {memberID}, member)));
+    timer.mark("checks");
+    if (!ok || applied) {
+        rollback();
+        return result;
+    }
 
-vector<string> parseCSVLine(const string &line) {
-    vector<string> result;
-    string field;
-    bool inQuotes = false;
+    if (book.empty() || member.empty()) {
+        result.status = CirculationStatus::NotFound;
+    } else if (book.cellString(0, 0) == "Yes") {
+        result.status = CirculationStatus::OnShelf;
+    } else if (execute("INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, Status) "
+                       "VALUES (?, ?, GETDATE(), DATEADD(day, ?, GETDATE()), 'Reserved')", {bookID, memberID, config.reservationDurationDays}, nullptr) &&
+               recordJournalKey(journalKey, 0)) {
+        result.status = CirculationStatus::Done;
+    }
+    timer.mark("writes");
 
-    for (size_t i = 0; i < line.size(); ++i) {
-        char c = line[i];
-        if (c == '"') {
-            if (inQuotes && i + 1 < line.size() && line[i + 1] == '"') {
-                field += '"';
-                i++;
-            } else {
-                inQuotes = !inQuotes;
-            }
-        } else if (c == ',' && !inQuotes) {
-            result.push_back(field);
-            field.clear();
-        } else {
-            field += c;
-        }
-    }
-    result.push_back(field);
+    if (result.status != CirculationStatus::Done) rollback();
+    else if (!commit()) result.status = CirculationStatus::Failed;
+    timer.mark("commit");
     return result;
 }
 
- 
-void bulkImportBooks() {
-    char cwd[256];
-    if (_getcwd(cwd, sizeof(cwd)) == nullptr) {
-        cout << "Error retrieving current directory: " << strerror(errno) << endl;
-        return;
-    }
+class StorageBackend {
+public:
+    virtual ~StorageBackend() {}
+    virtual string name() const = 0;
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    // A new, not yet connected, session.
+    virtual unique_ptr<StorageConnection> newConnection() = 0;
+};
 
-    string filename = "books.csv";
-    int attempts = 3;
-    ifstream file;
+// Days since 1970-01-01 in the proleptic Gregorian calendar, and back.
+long long daysFromCivil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+void civilFromDays(long long z, int& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp + (mp < 10 ? 3 : -9);
+    y = (int)(yoe + era * 400 + (m <= 2));
+}
 
-    while (attempts > 0) {
-        file.open(filename);
-        if (!file.is_open()) {
-            cout << "Failed to open " << filename << " in " << cwd << ": " << strerror(errno) << endl;
-            attempts--;
+#if LIBRARY_WITH_ODBC
+// SQLWCHAR is a UTF-16 code unit under both the Windows driver manager and unixODBC.
+static_assert(sizeof(SQLWCHAR) == sizeof(char16_t), "SQLWCHAR must be a UTF-16 code unit");
+SQLWCHAR* wideText(const char16_t* text) { return (SQLWCHAR*)text; }
+const char16_t* wideText(const SQLWCHAR* text) { return (const char16_t*)text; }
 
-            if (attempts == 0) {
-                cout << "Trying fallback path..." << endl;
-                filename = "C:\\task_4\\books.csv";
-                file.open(filename);
-                if (!file.is_open()) {
-                    cout << "Failed to open fallback file " << filename << ": " << strerror(errno) << endl;
-                    cout << "Please enter the full path to books.csv (or 'q' to quit): ";
-                    cin >> filename;
-                    if (filename == "q" || filename == "Q") {
-                        cout << "Bulk import aborted." << endl;
-                        return;
-                    }
-                    continue;
-                }
-            } else {
-                cout << "Attempts remaining: " << attempts
-                     << ". Please ensure books.csv exists in " << cwd
-                     << " or enter the full path (or 'q' to quit): ";
-                cin >> filename;
-                if (filename == "q" || filename == "Q") {
-                    cout << "Bulk import aborted." << endl;
-                    return;
-                }
-                continue;
-            }
-        } else {
-            // File opened successfully, break the loop
-            break;
+void showError(SQLHANDLE handle, SQLSMALLINT type) {
+    SQLWCHAR state[6], message[1024];
+    SQLSMALLINT messageLen = 0;
+    if (SQL_SUCCESS == SQLGetDiagRecW(type, handle, 1, state, NULL, message, 1024, &messageLen)) {
+        statusOut() << "SQL Error: " << toUtf8(wideText(message), min<SQLSMALLINT>(messageLen, 1023))
+                    << " (State: " << toUtf8(wideText(state), 5) << ")" << endl;
+    }
+}
+// SQLSTATE class 08 means the link to the server is gone, not that the statement was bad.
+bool isConnectionError(SQLHANDLE handle, SQLSMALLINT type) {
+    SQLWCHAR state[6], message[1024];
+    if (SQL_SUCCESS != SQLGetDiagRecW(type, handle, 1, state, NULL, message, 1024, NULL)) return false;
+    return state[0] == L'0' && state[1] == L'8';
+}
+
+const char16_t* connectionString = u"DRIVER={ODBC Driver 17 for SQL Server};SERVER=PSILENL060;DATABASE=library_management;Trusted_Connection=Yes;Integrated Security=SSPI;";
+
+// How text columns are fetched (--odbc-text). Wide binds SQL_C_WCHAR and converts
+// to UTF-8 here; Utf8 binds SQL_C_CHAR and copies the driver's bytes as they are,
+// which is only right when the client encoding is UTF-8 (msodbcsql under a UTF-8
+// locale, or a Windows process with the UTF-8 code page). Auto probes each connection.
+enum class OdbcTextMode { Auto, Wide, Utf8 };
+OdbcTextMode odbcTextMode = OdbcTextMode::Auto;
+
+struct OdbcBookBatch;
+
+// SQL Server over ODBC. Prepared statement handles are cached per connection,
+// keyed by their SQL template (the text with '?' placeholders), so each template
+// is parsed and compiled by the server once per connection.
+class OdbcConnection : public StorageConnection {
+public:
+    explicit OdbcConnection(SQLHENV env) : env(env) {}
+    ~OdbcConnection() override;
+
+    bool connect() override {
+        if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_DBC, env, &dbc)) {
+            dbc = SQL_NULL_HANDLE;
+            return false;
+        }
+        SQLSetConnectAttr(dbc, SQL_ATTR_LOGIN_TIMEOUT, (SQLPOINTER)5, 0);
+        SQLWCHAR retConnStr[1024];
+        SQLSMALLINT retConnStrLen;
+        SQLRETURN ret = SQLDriverConnectW(dbc, NULL, wideText(connectionString), SQL_NTS, retConnStr, 1024, &retConnStrLen, SQL_DRIVER_NOPROMPT);
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+            showError(dbc, SQL_HANDLE_DBC);
+            SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+            dbc = SQL_NULL_HANDLE;
+            return false;
         }
+        broken = false;
+        lastUsed = chrono::steady_clock::now();
+        utf8Results = odbcTextMode == OdbcTextMode::Utf8 || (odbcTextMode == OdbcTextMode::Auto && probeUtf8Results());
+        return true;
     }
 
-    if (!file.is_open()) {
-        cout << "Unable to open books.csv after multiple attempts." << endl;
-        return;
+    void disconnect() override;
+
+    bool isAlive() override {
+        SQLUINTEGER dead = SQL_CD_FALSE;
+        SQLRETURN ret = SQLGetConnectAttr(dbc, SQL_ATTR_CONNECTION_DEAD, &dead, 0, NULL);
+        return (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO) && dead != SQL_CD_TRUE;
     }
 
-    cout << "Reading books from " << filename << endl;
-    string line;
-    int lineNum = 0;
-    int booksAdded = 0;
-
-    auto trim = [](string &s) {
-        const char* whitespace = " \t\n\r\"";
-        size_t start = s.find_first_not_of(whitespace);
-        size_t end = s.find_last_not_of(whitespace);
-        if (start == string::npos || end == string::npos) {
-            s.clear();
-        } else {
-            s = s.substr(start, end - start + 1);
+    bool execute(const string& sql, const vector<SqlParam>& params, long long* rowsAffected) override {
+        StatementMetrics metrics(sql);
+        SQLHSTMT stmt = executePrepared(sql, params);
+        if (stmt == SQL_NULL_HANDLE) return false;
+        if (rowsAffected) {
+            SQLLEN count = 0;
+            SQLRowCount(stmt, &count);
+            *rowsAffected = count;
         }
-    };
+        SQLFreeStmt(stmt, SQL_CLOSE);
+        metrics.finish(true);
+        return true;
+    }
 
-    auto escapeQuotes = [](string &s) {
-        for (size_t i = 0; i < s.length(); ++i) {
-            if (s[i] == '\'') s.insert(i++, "'");
-        }
-    };
+    bool fetch(const string& sql, const vector<SqlParam>& params, ResultSet& rs) override {
+        return fetchRows(sql, params, rs, nullptr);
+    }
+    bool fetchBlocks(const string& sql, const vector<SqlParam>& params, const RowBlockSink& sink) override {
+        ResultSet block;
+        return fetchRows(sql, params, block, &sink);
+    }
 
-    while (getline(file, line)) {
-        lineNum++;
-        if (line.empty() || all_of(line.begin(), line.end(), ::isspace)) {
-            cout << "Skipping empty line " << lineNum << endl;
-            continue;
+    void begin() override {
+        SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, 0);
+    }
+    bool commit() override {
+        StatementMetrics metrics(commitStatement);
+        bool ok = SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT) == SQL_SUCCESS;
+        metrics.finish(ok);
+        if (!ok) {
+            showError(dbc, SQL_HANDLE_DBC);
+            SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK);
         }
+        SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0);
+        return ok;
+    }
+    void rollback() override {
+        StatementMetrics metrics(rollbackStatement);
+        metrics.finish(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK) == SQL_SUCCESS);
+        SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0);
+    }
 
-        vector<string> fields = parseCSVLine(line);
-        if (fields.size() < 11) {
-            cout << "Invalid format at line " << lineNum << ": " << line << endl;
-            continue;
+    // SQLCancel is the one ODBC call documented as safe from another thread; the
+    // blocked SQLExecute or SQLFetch then fails with HY008.
+    void cancel() override {
+        SQLHSTMT stmt = runningStatement;
+        if (stmt != SQL_NULL_HANDLE) SQLCancel(stmt);
+    }
+
+    bool insertBookBatch(const vector<BookImportRow>& rows, size_t begin, size_t count, vector<char>& rowOk) override;
+
+    CirculationResult issueBook(int bookID, int memberID, const Config& config, const string& journalKey) override;
+    CirculationResult returnBook(int transactionID, const Config& config, const string& journalKey) override;
+    bool ensureJournalTable() override;
+
+    size_t cachedStatements() const override { return statements.size(); }
+
+private:
+    SQLHSTMT getPreparedStatement(const string& sqlTemplate) {
+        auto it = statements.find(sqlTemplate);
+        if (it != statements.end()) {
+            statementHits++;
+            return it->second;
         }
+        statementMisses++;
+
+        SQLHSTMT stmt;
+        if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt)) return SQL_NULL_HANDLE;
+        SQLRETURN ret = SQLPrepareW(stmt, wideText(toUtf16(sqlTemplate)), SQL_NTS);
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+            showError(stmt, SQL_HANDLE_STMT);
+            if (isConnectionError(stmt, SQL_HANDLE_STMT)) broken = true;
+            SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+            return SQL_NULL_HANDLE;
+        }
+        statements.emplace(sqlTemplate, stmt);
+        return stmt;
+    }
 
-        string title = fields[0];
-        string author = fields[1];
-        string category = fields[2];
-        string publisher = fields[3];
-        string isbn = fields[4];
-        string edition = fields[5];
+    void evictPreparedStatement(const string& sqlTemplate) {
+        auto it = statements.find(sqlTemplate);
+        if (it == statements.end()) return;
+        SQLFreeHandle(SQL_HANDLE_STMT, it->second);
+        statements.erase(it);
+    }
 
-        int year = 0;
-        try {
-            year = stoi(fields[6]);
-        } catch (...) {
-            cout << "Invalid year at line " << lineNum << ": " << fields[6] << endl;
-            continue;
+    bool bindParams(SQLHSTMT stmt, const vector<SqlParam>& params) {
+        SQLFreeStmt(stmt, SQL_RESET_PARAMS);
+        // The driver reads bound buffers at SQLExecute, so they live on the connection
+        // and keep their capacity from one statement to the next.
+        if (wideParams.size() < params.size()) wideParams.resize(params.size());
+        indicators.assign(params.size(), 0);
+        for (size_t i = 0; i < params.size(); ++i) {
+            const SqlParam& p = params[i];
+            SQLRETURN ret;
+            if (p.kind == SqlParam::Text) {
+                // Declare text as nvarchar(4000) regardless of length so the server
+                // reuses one plan instead of compiling one per distinct value length.
+                u16string& text = wideParams[i];
+                assignUtf16(p.text, text);
+                SQLULEN columnSize = max<SQLULEN>(text.size(), 4000);
+                SQLSMALLINT sqlType = text.size() > 4000 ? SQL_WLONGVARCHAR : SQL_WVARCHAR;
+                indicators[i] = SQL_NTS;
+                ret = SQLBindParameter(stmt, (SQLUSMALLINT)(i + 1), SQL_PARAM_INPUT, SQL_C_WCHAR, sqlType, columnSize, 0,
+                                       (SQLPOINTER)text.c_str(), (text.size() + 1) * sizeof(SQLWCHAR), &indicators[i]);
+            } else if (p.kind == SqlParam::Int) {
+                ret = SQLBindParameter(stmt, (SQLUSMALLINT)(i + 1), SQL_PARAM_INPUT, SQL_C_SBIGINT, SQL_BIGINT, 0, 0,
+                                       (SQLPOINTER)&p.intValue, 0, &indicators[i]);
+            } else {
+                ret = SQLBindParameter(stmt, (SQLUSMALLINT)(i + 1), SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 15, 0,
+                                       (SQLPOINTER)&p.doubleValue, 0, &indicators[i]);
+            }
+            if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+                showError(stmt, SQL_HANDLE_STMT);
+                return false;
+            }
         }
+        return true;
+    }
 
-        float price = 0.0f;
-        try {
-            price = stof(fields[7]);
-        } catch (...) {
-            cout << "Invalid price at line " << lineNum << ": " << fields[7] << endl;
-            continue;
+    // Binds params to the cached statement for sqlTemplate and executes it.
+    // Returns the statement with its cursor open, or SQL_NULL_HANDLE on failure. Callers
+    // must close the cursor with SQLFreeStmt(stmt, SQL_CLOSE) but never free the handle.
+    SQLHSTMT executePrepared(const string& sqlTemplate, const vector<SqlParam>& params) {
+        SQLHSTMT stmt = getPreparedStatement(sqlTemplate);
+        if (stmt == SQL_NULL_HANDLE) return SQL_NULL_HANDLE;
+        if (!bindParams(stmt, params)) {
+            evictPreparedStatement(sqlTemplate);
+            return SQL_NULL_HANDLE;
+        }
+        runningStatement = stmt;
+        SQLRETURN ret = SQLExecute(stmt);
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO && ret != SQL_NO_DATA) {
+            showError(stmt, SQL_HANDLE_STMT);
+            if (isConnectionError(stmt, SQL_HANDLE_STMT)) broken = true;
+            evictPreparedStatement(sqlTemplate);
+            return SQL_NULL_HANDLE;
         }
+        return stmt;
+    }
 
-        string shelf = fields[8];
-        string language = fields[9];
-        string available = fields[10];
+    bool fetchRows(const string& sql, const vector<SqlParam>& params, ResultSet& rs, const RowBlockSink* sink);
+
+    // Fetches a Devanagari literal as SQL_C_CHAR and checks that the bytes are its UTF-8.
+    bool probeUtf8Results() {
+        const char16_t* sample = u"\u092A\u0941\u0938\u094D\u0924\u0915";
+        u16string query = u"SELECT N'" + u16string(sample) + u"'";
+        SQLHSTMT stmt;
+        if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt)) return false;
+        char text[64];
+        SQLLEN len = 0;
+        bool ok = SQL_SUCCEEDED(SQLExecDirectW(stmt, wideText(query.c_str()), SQL_NTS)) && SQL_SUCCEEDED(SQLFetch(stmt)) &&
+                  SQL_SUCCEEDED(SQLGetData(stmt, 1, SQL_C_CHAR, text, sizeof(text), &len)) &&
+                  len >= 0 && len < (SQLLEN)sizeof(text) && string(text, len) == toUtf8(sample, 6);
+        SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+        return ok;
+    }
 
-        trim(title);
-        trim(author);
-        trim(category);
-        trim(publisher);
-        trim(isbn);
-        trim(edition);
-        trim(shelf);
-        trim(language);
-        trim(available);
+    SQLHENV env;
+    SQLHDBC dbc = SQL_NULL_HANDLE;
+    unordered_map<string, SQLHSTMT> statements;
+    vector<u16string> wideParams;
+    bool utf8Results = false;  // text columns bound as SQL_C_CHAR, see OdbcTextMode
+    vector<SQLLEN> indicators;
+    unique_ptr<OdbcBookBatch> bookBatch;  // array-bound INSERT for imports, created on first use
+    atomic<SQLHSTMT> runningStatement{SQL_NULL_HANDLE};  // last statement executed, for cancel()
+};
 
-        if (title.empty() || author.empty() || isbn.empty()) {
-            cout << "Invalid format at line " << lineNum << ": missing required fields" << endl;
-            continue;
+// Executes a statement and fetches it with a block cursor (SQL_ATTR_ROW_ARRAY_SIZE)
+// into column-wise SQLBindCol buffers, appending each block into rs. With a sink,
+// rs only ever holds the current block.
+bool OdbcConnection::fetchRows(const string& query, const vector<SqlParam>& params, ResultSet& rs, const RowBlockSink* sink) {
+    StatementMetrics metrics(query);
+    SQLHSTMT stmt = executePrepared(query, params);
+    if (stmt == SQL_NULL_HANDLE) return false;
+
+    SQLSMALLINT numCols = 0;
+    SQLNumResultCols(stmt, &numCols);
+    rs.columns.resize(numCols);
+
+    struct BoundColumn {
+        vector<SQLBIGINT> ints;
+        vector<double> doubles;
+        vector<SQL_TIMESTAMP_STRUCT> dates;
+        vector<SQLWCHAR> text;
+        vector<char> utf8;
+        SQLULEN width = 0;
+        vector<SQLLEN> indicators;
+    };
+    vector<BoundColumn> bound(numCols);
+
+    for (SQLSMALLINT i = 0; i < numCols; ++i) {
+        SQLWCHAR name[256];
+        SQLSMALLINT nameLen = 0, dataType = 0, decimalDigits = 0, nullable = 0;
+        SQLULEN columnSize = 0;
+        SQLDescribeColW(stmt, i + 1, name, 256, &nameLen, &dataType, &columnSize, &decimalDigits, &nullable);
+
+        ResultColumn& col = rs.columns[i];
+        BoundColumn& b = bound[i];
+        col.name = toUtf8(wideText(name), min<SQLSMALLINT>(nameLen, 255));
+        b.indicators.resize(resultBlockRows);
+
+        switch (dataType) {
+            case SQL_INTEGER: case SQL_SMALLINT: case SQL_TINYINT: case SQL_BIGINT: case SQL_BIT:
+                col.type = ColumnType::Int;
+                b.ints.resize(resultBlockRows);
+                SQLBindCol(stmt, i + 1, SQL_C_SBIGINT, b.ints.data(), sizeof(SQLBIGINT), b.indicators.data());
+                break;
+            case SQL_DECIMAL: case SQL_NUMERIC: case SQL_FLOAT: case SQL_REAL: case SQL_DOUBLE:
+                col.type = ColumnType::Double;
+                col.scale = (dataType == SQL_DECIMAL || dataType == SQL_NUMERIC) ? decimalDigits : 0;
+                b.doubles.resize(resultBlockRows);
+                SQLBindCol(stmt, i + 1, SQL_C_DOUBLE, b.doubles.data(), sizeof(double), b.indicators.data());
+                break;
+            case SQL_TYPE_DATE: case SQL_TYPE_TIMESTAMP: case SQL_DATETIME:
+                col.type = ColumnType::Date;
+                col.hasTime = dataType != SQL_TYPE_DATE;
+                col.scale = decimalDigits;
+                b.dates.resize(resultBlockRows);
+                SQLBindCol(stmt, i + 1, SQL_C_TYPE_TIMESTAMP, b.dates.data(), sizeof(SQL_TIMESTAMP_STRUCT), b.indicators.data());
+                break;
+            default:
+                col.type = ColumnType::Text;
+                b.width = (columnSize == 0 || columnSize > maxTextColumnChars ? maxTextColumnChars : columnSize) + 1;
+                if (utf8Results) {
+                    // Up to three UTF-8 bytes for each UTF-16 unit of the declared size.
+                    b.width = (b.width - 1) * 3 + 1;
+                    b.utf8.resize(resultBlockRows * b.width);
+                    SQLBindCol(stmt, i + 1, SQL_C_CHAR, b.utf8.data(), b.width, b.indicators.data());
+                } else {
+                    b.text.resize(resultBlockRows * b.width);
+                    SQLBindCol(stmt, i + 1, SQL_C_WCHAR, b.text.data(), b.width * sizeof(SQLWCHAR), b.indicators.data());
+                }
+                break;
         }
+    }
 
-        // Check if ISBN already exists
-        auto res = getResults("SELECT ISBN FROM dbo.Books WHERE ISBN = '" + isbn + "'");
-        if (!res.empty()) {
-            cout << "ISBN exists at line " << lineNum << ": " << isbn << endl;
-            continue;
+    SQLULEN fetched = 0;
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)resultBlockRows, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, &fetched, 0);
+
+    size_t total = 0, textBytes = 0;
+    bool stopped = false;
+    SQLRETURN ret;
+    while ((ret = SQLFetch(stmt)) == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO) {
+        ResultCell* block = rs.appendRows(fetched);
+        for (SQLSMALLINT i = 0; i < numCols; ++i) {
+            const ResultColumn& col = rs.columns[i];
+            BoundColumn& b = bound[i];
+            for (SQLULEN r = 0; r < fetched; ++r) {
+                if (b.indicators[r] == SQL_NULL_DATA) continue;
+                ResultCell& cell = block[r * numCols + i];
+                cell.null = 0;
+                switch (col.type) {
+                    case ColumnType::Int: cell.intValue = b.ints[r]; break;
+                    case ColumnType::Double: cell.doubleValue = b.doubles[r]; break;
+                    case ColumnType::Date: {
+                        const SQL_TIMESTAMP_STRUCT& t = b.dates[r];
+                        DateTimeValue d;
+                        d.year = t.year; d.month = t.month; d.day = t.day;
+                        d.hour = t.hour; d.minute = t.minute; d.second = t.second;
+                        d.fraction = t.fraction;
+                        rs.setDate(cell, d);
+                        break;
+                    }
+                    case ColumnType::Text: {
+                        // Cells are converted straight into the pool, with no per-cell string.
+                        cell.offset = rs.pool.size();
+                        if (utf8Results) {
+                            const char* text = &b.utf8[r * b.width];
+                            SQLLEN bytes = b.indicators[r];
+                            bool truncated = bytes < 0 || (SQLULEN)bytes >= b.width;
+                            rs.pool.append(text, truncated ? utf8CompleteLength(text, b.width - 1) : (size_t)bytes);
+                        } else {
+                            size_t len = b.indicators[r] >= 0 ? (size_t)b.indicators[r] / sizeof(SQLWCHAR) : b.width - 1;
+                            appendUtf8(wideText(&b.text[r * b.width]), min<size_t>(len, b.width - 1), rs.pool);
+                        }
+                        cell.length = (uint32_t)(rs.pool.size() - cell.offset);
+                        textBytes += cell.length;
+                        break;
+                    }
+                }
+            }
         }
+        total += fetched;
+        if (sink) {
+            stopped = !(*sink)(rs);
+            rs.clearRows();
+            if (stopped) break;
+        }
+    }
+    bool ok = !stopped && ret == SQL_NO_DATA;
+    if (!ok && !stopped) {
+        showError(stmt, SQL_HANDLE_STMT);
+        if (isConnectionError(stmt, SQL_HANDLE_STMT)) broken = true;
+    }
 
-        escapeQuotes(title);
-        escapeQuotes(author);
-        escapeQuotes(category);
-        escapeQuotes(publisher);
-        escapeQuotes(isbn);
-        escapeQuotes(edition);
-        escapeQuotes(shelf);
-        escapeQuotes(language);
-        escapeQuotes(available);
-
-        string query = "INSERT INTO dbo.Books (Title, Author, Category, Publisher, ISBN, Edition, Year, Price, Shelf, Language, Available) VALUES (";
-        query += "'" + title + "', '" + author + "', '" + category + "', '" + publisher + "', '" + isbn + "', '" + edition + "', ";
-        query += to_string(year) + ", " + to_string(price) + ", '" + shelf + "', '" + language + "', '" + available + "')";
+    // The handle stays in the statement cache, so put it back into single-row mode.
+    SQLFreeStmt(stmt, SQL_CLOSE);
+    SQLFreeStmt(stmt, SQL_UNBIND);
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)1, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, NULL, 0);
+    metrics.finish(ok || stopped, total, textBytes);
+    return ok;
+}
 
-        if (runQuery(query)) {
-            cout << "Added: " << title << " (Line " << lineNum << ")" << endl;
-            booksAdded++;
-        } else {
-            cout << "Failed to add at line " << lineNum << ": " << title << endl;
-        }
+// Issue and return as one parameterised T-SQL batch each: one round trip that
+// validates, checks the loan limit and writes under XACT_ABORT, so any error
+// rolls the whole thing back. UPDLOCK on the book row (and HOLDLOCK on the
+// member's open loans) serialises desks racing for the same book or member.
+// A journal key that is already in JournalApplied (status 4) skips the writes
+// and reports the loan it was applied as. The batch ends with a single status row.
+const char* issueBookBatch =
+    "SET NOCOUNT ON; SET XACT_ABORT ON; "
+    "DECLARE @book int = ?, @member int = ?, @max int = ?, @days int = ?, @key nvarchar(64) = NULLIF(?, ''); "
+    "DECLARE @status int = 0, @txn int = NULL, @avail nvarchar(10) = NULL, @issued int = 0; "
+    "BEGIN TRAN; "
+    "IF @key IS NOT NULL SELECT @status = 4, @txn = TransactionID FROM dbo.JournalApplied WITH (UPDLOCK, HOLDLOCK) WHERE JournalKey = @key; "
+    "IF @status = 0 BEGIN "
+    "  SELECT @avail = Availability FROM dbo.Books WITH (UPDLOCK, ROWLOCK) WHERE BookID = @book; "
+    "  IF @avail IS NULL OR NOT EXISTS (SELECT 1 FROM dbo.Members WHERE MemberID = @member) SET @status = 1; "
+    "  ELSE IF @avail = 'No' SET @status = 2; "
+    "  ELSE BEGIN "
+    "    SELECT @issued = COUNT(*) FROM dbo.Transactions WITH (UPDLOCK, HOLDLOCK) WHERE MemberID = @member AND Status = 'Issued'; "
+    "    IF @issued >= @max SET @status = 3; "
+    "    ELSE BEGIN "
+    "      INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, Status) "
+    "      VALUES (@book, @member, GETDATE(), DATEADD(day, @days, GETDATE()), 'Issued'); "
+    "      SET @txn = SCOPE_IDENTITY(); "
+    "      UPDATE dbo.Books SET Availability = 'No' WHERE BookID = @book; "
+    "      IF @key IS NOT NULL INSERT INTO dbo.JournalApplied (JournalKey, TransactionID, AppliedAt) VALUES (@key, @txn, GETDATE()); "
+    "    END "
+    "  END "
+    "END; "
+    "IF @status = 0 COMMIT; ELSE ROLLBACK; "
+    "SELECT @status AS Outcome, @txn AS TransactionID, @max AS MaxBooks;";
+
+const char* returnBookBatch =
+    "SET NOCOUNT ON; SET XACT_ABORT ON; "
+    "DECLARE @txn int = ?, @rate decimal(10,2) = ?, @key nvarchar(64) = NULLIF(?, ''); "
+    "DECLARE @status int = 0, @book int = NULL, @member int = NULL, @fine decimal(10,2) = 0; "
+    "BEGIN TRAN; "
+    "IF @key IS NOT NULL AND EXISTS (SELECT 1 FROM dbo.JournalApplied WITH (UPDLOCK, HOLDLOCK) WHERE JournalKey = @key) "
+    "  SELECT @status = 4, @book = BookID, @member = MemberID, @fine = ISNULL(FineAmount, 0) FROM dbo.Transactions WHERE TransactionID = @txn; "
+    "ELSE BEGIN "
+    "  SELECT @book = BookID, @member = MemberID FROM dbo.Transactions WITH (UPDLOCK, ROWLOCK) WHERE TransactionID = @txn AND Status = 'Issued'; "
+    "  IF @book IS NULL SET @status = 1; "
+    "  ELSE BEGIN "
+    "    UPDATE dbo.Transactions SET Status = 'Returned', ReturnDate = GETDATE(), "
+    "      @fine = FineAmount = CASE WHEN GETDATE() > DueDate THEN DATEDIFF(day, DueDate, GETDATE()) * @rate ELSE 0 END "
+    "    WHERE TransactionID = @txn; "
+    "    UPDATE dbo.Books SET Availability = 'Yes' WHERE BookID = @book; "
+    "    IF @key IS NOT NULL INSERT INTO dbo.JournalApplied (JournalKey, TransactionID, AppliedAt) VALUES (@key, @txn, GETDATE()); "
+    "  END "
+    "END; "
+    "IF @status = 0 COMMIT; ELSE ROLLBACK; "
+    "SELECT @status AS Outcome, @book AS BookID, @fine AS Fine, @member AS MemberID;";
+
+const char* createJournalTableBatch =
+    "IF OBJECT_ID('dbo.JournalApplied') IS NULL "
+    "CREATE TABLE dbo.JournalApplied (JournalKey nvarchar(64) NOT NULL PRIMARY KEY, TransactionID int NULL, AppliedAt datetime NOT NULL);";
+
+CirculationStatus circulationStatusFromCode(long long code) {
+    switch (code) {
+        case 0: return CirculationStatus::Done;
+        case 1: return CirculationStatus::NotFound;
+        case 2: return CirculationStatus::Unavailable;
+        case 3: return CirculationStatus::LimitReached;
+        case 4: return CirculationStatus::Done;  // already applied under this journal key
+        default: return CirculationStatus::Failed;
     }
+}
 
-    file.close();
-    cout << "Bulk import completed. Added " << booksAdded << " books." << endl;
+CirculationResult OdbcConnection::issueBook(int bookID, int memberID, const Config& config, const string& journalKey) {
+    CirculationResult result;
+    StepTimer timer(result.steps);
+    ResultSet rs;
+    bool ok = fetch(issueBookBatch, {bookID, memberID, config.maxBooksPerMember, config.reservationDurationDays, journalKey}, rs);
+    timer.mark("server batch");
+    if (!ok || rs.empty()) return result;
+    result.status = circulationStatusFromCode(rs.intAt(0, 0));
+    result.replayed = rs.intAt(0, 0) == 4;
+    result.bookID = bookID;
+    result.memberID = memberID;
+    result.transactionID = rs.isNull(0, 1) ? 0 : (int)rs.intAt(0, 1);
+    result.maxBooks = (int)rs.intAt(0, 2);
+    return result;
 }
 
-void booksMenu() {
-    int choice;
-    do {
-        cout << "\n=== Books Management ===\n";
-        cout << "1. Add Book\n";
-        cout << "2. Update Book\n";
-        cout << "3. Delete Book\n";
-        cout << "4. View Books\n";
-        cout << "5. Search Books\n";
-        cout << "6. Bulk Import Books\n";
-        cout << "7. Back to Main Menu\n";
-        cout << "Enter your choice (1-7): ";
-        cin >> choice;
+CirculationResult OdbcConnection::returnBook(int transactionID, const Config& config, const string& journalKey) {
+    CirculationResult result;
+    StepTimer timer(result.steps);
+    result.transactionID = transactionID;
+    ResultSet rs;
+    bool ok = fetch(returnBookBatch, {transactionID, config.fineRate, journalKey}, rs);
+    timer.mark("server batch");
+    if (!ok || rs.empty()) return result;
+    result.status = circulationStatusFromCode(rs.intAt(0, 0));
+    result.replayed = rs.intAt(0, 0) == 4;
+    result.bookID = rs.isNull(0, 1) ? 0 : (int)rs.intAt(0, 1);
+    result.fine = rs.isNull(0, 2) ? 0.0 : rs.doubleAt(0, 2);
+    result.memberID = rs.isNull(0, 3) ? 0 : (int)rs.intAt(0, 3);
+    return result;
+}
 
-        while (cin.fail() || choice < 1 || choice > 7) {
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "Invalid choice! Please enter a number between 1 and 7: ";
-            cin >> choice;
-        }
+bool OdbcConnection::ensureJournalTable() {
+    return execute(createJournalTableBatch, {}, nullptr);
+}
 
-        switch (choice) {
-            case 1: addBook(); break;
-            case 2: updateBook(); break;
-            case 3: deleteBook(); break;
-            case 4: viewBooks(); break;
-            case 5: searchBooks(); break;
-            case 6: bulkImportBooks(); break;
-            case 7: cout << "Returning to main menu...\n"; break;
-        }
-    } while (choice != 7);
+class OdbcBackend : public StorageBackend {
+public:
+    string name() const override { return "SQL Server (ODBC)"; }
+    bool open() override {
+        if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &env)) return false;
+        return SQL_SUCCESS == SQLSetEnvAttr(env, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, 0);
+    }
+    void close() override {
+        if (env != SQL_NULL_HANDLE) SQLFreeHandle(SQL_HANDLE_ENV, env);
+        env = SQL_NULL_HANDLE;
+    }
+    unique_ptr<StorageConnection> newConnection() override { return make_unique<OdbcConnection>(env); }
+
+private:
+    SQLHENV env = SQL_NULL_HANDLE;
+};
+#endif
+
+#if LIBRARY_WITH_SQLITE
+// The embedded database mirrors the SQL Server tables. Text columns compare
+// case-insensitively like the server's default collation, and dates are stored
+// as 'YYYY-MM-DD HH:MM:SS.mmm' text so they sort and compare as strings.
+const char* sqliteSchema = R"(
+CREATE TABLE IF NOT EXISTS Books (
+    BookID INTEGER PRIMARY KEY AUTOINCREMENT,
+    Title NVARCHAR(255) COLLATE NOCASE NOT NULL,
+    Authors NVARCHAR(255) COLLATE NOCASE,
+    Genre NVARCHAR(100) COLLATE NOCASE,
+    Publisher NVARCHAR(255) COLLATE NOCASE,
+    ISBN NVARCHAR(20) COLLATE NOCASE,
+    Edition NVARCHAR(50) COLLATE NOCASE,
+    PublishedYear INT,
+    Price DECIMAL(10,2),
+    RackLocation NVARCHAR(50) COLLATE NOCASE,
+    Language NVARCHAR(50) COLLATE NOCASE,
+    Availability NVARCHAR(10) COLLATE NOCASE DEFAULT 'Yes'
+);
+CREATE INDEX IF NOT EXISTS IX_Books_ISBN ON Books(ISBN);
+CREATE TABLE IF NOT EXISTS Members (
+    MemberID INTEGER PRIMARY KEY AUTOINCREMENT,
+    Name NVARCHAR(255) COLLATE NOCASE NOT NULL,
+    Email NVARCHAR(255) COLLATE NOCASE,
+    MembershipType NVARCHAR(20) COLLATE NOCASE,
+    Role NVARCHAR(10) COLLATE NOCASE,
+    Password NVARCHAR(255)
+);
+CREATE TABLE IF NOT EXISTS Transactions (
+    TransactionID INTEGER PRIMARY KEY AUTOINCREMENT,
+    BookID INT REFERENCES Books(BookID),
+    MemberID INT REFERENCES Members(MemberID),
+    IssueDate DATETIME,
+    DueDate DATETIME,
+    ReturnDate DATETIME,
+    Status NVARCHAR(20) COLLATE NOCASE,
+    FineAmount DECIMAL(10,2)
+);
+CREATE INDEX IF NOT EXISTS IX_Transactions_Member ON Transactions(MemberID);
+CREATE INDEX IF NOT EXISTS IX_Transactions_Book ON Transactions(BookID);
+CREATE TABLE IF NOT EXISTS Config (
+    ConfigID INTEGER PRIMARY KEY,
+    FineRate DECIMAL(10,2),
+    MaxBooksPerMember INT,
+    ReservationDurationDays INT
+);
+INSERT OR IGNORE INTO Config VALUES (1, 1.00, 5, 7);
+CREATE TABLE IF NOT EXISTS JournalApplied (
+    JournalKey NVARCHAR(64) PRIMARY KEY,
+    TransactionID INT,
+    AppliedAt DATETIME NOT NULL
+);
+)";
+
+string sqliteDatabasePath = "library.db";
+
+void showSqliteError(sqlite3* db) {
+    statusOut() << "SQL Error: " << sqlite3_errmsg(db) << " (State: " << sqlite3_extended_errcode(db) << ")" << endl;
 }
 
- 
-void addMember() {
-    string name, email, type, role, pass;
+struct SqliteTime {
+    long long days = 0;
+    int millisOfDay = 0;
+};
 
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');  // Clear leftover input
-    cout << "Enter Name: ";
-    getline(cin, name);
-    cout << "Enter Email: ";
-    getline(cin, email);
-    cout << "Enter Type (Regular/Premium): ";
-    getline(cin, type);
-    cout << "Enter Role (Admin/User): ";
-    getline(cin, role);
-    cout << "Enter Password: ";
-    getline(cin, pass);
+bool parseSqliteTime(const char* s, SqliteTime& t) {
+    int y = 0;
+    unsigned mo = 0, d = 0, h = 0, mi = 0, sec = 0, ms = 0;
+    if (!s || sscanf(s, "%d-%u-%u", &y, &mo, &d) != 3) return false;
+    sscanf(s, "%*d-%*u-%*u %u:%u:%u.%3u", &h, &mi, &sec, &ms);
+    t.days = daysFromCivil(y, mo, d);
+    t.millisOfDay = (int)(((h * 60 + mi) * 60 + sec) * 1000 + ms);
+    return true;
+}
 
-    // Normalize input
-    transform(type.begin(), type.end(), type.begin(), ::tolower);
-    transform(role.begin(), role.end(), role.begin(), ::tolower);
+string formatSqliteTime(const SqliteTime& t) {
+    int y;
+    unsigned m, d;
+    civilFromDays(t.days, y, m, d);
+    int ms = t.millisOfDay;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04d-%02u-%02u %02d:%02d:%02d.%03d", y, m, d, ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+    return buf;
+}
 
-    if (type != "regular" && type != "premium") {
-        cout << "Invalid Type! Use 'Regular' or 'Premium'.\n";
+bool isDayUnit(sqlite3_value* unit) {
+    const char* u = (const char*)sqlite3_value_text(unit);
+    return u && (sqlite3_stricmp(u, "day") == 0 || sqlite3_stricmp(u, "dd") == 0 || sqlite3_stricmp(u, "d") == 0);
+}
+
+// SQL Server functions the app's queries use, registered on every connection.
+void sqliteGetDate(sqlite3_context* ctx, int, sqlite3_value**) {
+    auto now = chrono::system_clock::now();
+    time_t secs = chrono::system_clock::to_time_t(now);
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &secs);
+#else
+    localtime_r(&secs, &local);
+#endif
+    SqliteTime t;
+    t.days = daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+    t.millisOfDay = ((local.tm_hour * 60 + local.tm_min) * 60 + local.tm_sec) * 1000 +
+                    (int)(chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+    sqlite3_result_text(ctx, formatSqliteTime(t).c_str(), -1, SQLITE_TRANSIENT);
+}
+
+void sqliteDateAdd(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (!isDayUnit(argv[0])) {
+        sqlite3_result_error(ctx, "DATEADD: only the day unit is supported", -1);
         return;
     }
-    if (role != "admin" && role != "user") {
-        cout << "Invalid Role! Use 'Admin' or 'User'.\n";
+    SqliteTime t;
+    if (sqlite3_value_type(argv[1]) == SQLITE_NULL || !parseSqliteTime((const char*)sqlite3_value_text(argv[2]), t)) {
+        sqlite3_result_null(ctx);
         return;
     }
-    if (name.empty() || email.empty() || pass.empty()) {
-        cout << "Name, Email, and Password are required!\n";
+    t.days += sqlite3_value_int64(argv[1]);
+    sqlite3_result_text(ctx, formatSqliteTime(t).c_str(), -1, SQLITE_TRANSIENT);
+}
+
+// DATEDIFF(day, a, b) counts midnights crossed, as SQL Server does, not elapsed 24h periods.
+void sqliteDateDiff(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (!isDayUnit(argv[0])) {
+        sqlite3_result_error(ctx, "DATEDIFF: only the day unit is supported", -1);
+        return;
+    }
+    SqliteTime a, b;
+    if (!parseSqliteTime((const char*)sqlite3_value_text(argv[1]), a) || !parseSqliteTime((const char*)sqlite3_value_text(argv[2]), b)) {
+        sqlite3_result_null(ctx);
         return;
     }
+    sqlite3_result_int64(ctx, b.days - a.days);
+}
 
-    // Escape single quotes for SQL safety
-    auto escape = [](string &str) {
-        for (size_t i = 0; i < str.length(); ++i) {
-            if (str[i] == '\'') str.insert(i++, "'");
-        }
-    };
+// Not bit-compatible with SQL Server's checksums; the app only compares values
+// computed by the same backend to notice changed rows.
+void sqliteBinaryChecksum(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < argc; ++i) {
+        int type = sqlite3_value_type(argv[i]);
+        h = (h ^ (uint32_t)type) * 16777619u;
+        if (type == SQLITE_NULL) continue;
+        const unsigned char* p = sqlite3_value_text(argv[i]);
+        int n = sqlite3_value_bytes(argv[i]);
+        for (int k = 0; k < n; ++k) h = (h ^ p[k]) * 16777619u;
+        h = (h ^ 0xff) * 16777619u;
+    }
+    sqlite3_result_int(ctx, (int)h);
+}
 
-    escape(name);
-    escape(email);
-    escape(type);
-    escape(role);
-    escape(pass);
+void sqliteChecksumAggStep(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    int* acc = (int*)sqlite3_aggregate_context(ctx, sizeof(int));
+    if (acc && sqlite3_value_type(argv[0]) != SQLITE_NULL) *acc ^= sqlite3_value_int(argv[0]);
+}
+void sqliteChecksumAggFinal(sqlite3_context* ctx) {
+    int* acc = (int*)sqlite3_aggregate_context(ctx, 0);
+    if (acc) sqlite3_result_int(ctx, *acc);
+    else sqlite3_result_null(ctx);
+}
 
-    auto res = getResults("SELECT Email FROM dbo.Members WHERE Email = '" + email + "'");
-    if (!res.empty()) {
-        cout << "Email already exists!\n";
-        return;
+void sqliteDbName(sqlite3_context* ctx, int, sqlite3_value**) {
+    sqlite3_result_text(ctx, ((const string*)sqlite3_user_data(ctx))->c_str(), -1, SQLITE_TRANSIENT);
+}
+
+// Rewrites the T-SQL the app sends into SQLite's dialect. Placeholders are
+// numbered first (?1, ?2, ...) so TOP and OFFSET/FETCH can move to the end of
+// the statement without re-ordering the caller's parameters.
+string translateToSqlite(const string& sql) {
+    static const pair<regex, string> rules[] = {
+        {regex(R"(\bdbo\.)", regex::icase), ""},
+        {regex(R"(\bISNULL\s*\()", regex::icase), "IFNULL("},
+        {regex(R"(\b(DATEADD|DATEDIFF)\s*\(\s*(\w+)\s*,)", regex::icase), "$1('$2',"},
+        {regex(R"(^(\s*SELECT\s+)TOP\s*\(?\s*(\?\d+|\d+)\s*\)?\s+([\s\S]*)$)", regex::icase), "$1$3 LIMIT $2"},
+        {regex(R"(\s+OFFSET\s+(\?\d+|\d+)\s+ROWS\s+FETCH\s+NEXT\s+(\?\d+|\d+)\s+ROWS\s+ONLY)", regex::icase), " LIMIT $2 OFFSET $1"},
+        {regex(R"(\s+OUTPUT\s+INSERTED\.(\w+)\s+(VALUES[\s\S]*)$)", regex::icase), " $2 RETURNING $1"},
+    };
+    string out;
+    int n = 0;
+    for (char c : sql) {
+        if (c == '?') out += "?" + to_string(++n);
+        else out += c;
     }
+    for (auto& rule : rules) out = regex_replace(out, rule.first, rule.second);
+    return out;
+}
 
-    string query = "INSERT INTO dbo.Members (Name, Email, MembershipType, Role, Password) VALUES ('" +
-                   name + "', '" + email + "', '" + type + "', '" + role + "', '" + pass + "')";
+// SQLite file database. Each pooled connection opens its own handle; WAL mode
+// lets readers run alongside the one writer.
+class SqliteConnection : public StorageConnection {
+public:
+    SqliteConnection(const string& path, const string& dbName) : path(path), dbName(dbName) {}
+    ~SqliteConnection() override { disconnect(); }
+
+    bool connect() override {
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+            showSqliteError(db);
+            sqlite3_close(db);
+            db = nullptr;
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+        sqlite3_exec(db, "PRAGMA synchronous=NORMAL", nullptr, nullptr, nullptr);
+        sqlite3_create_function(db, "GETDATE", 0, SQLITE_UTF8, nullptr, sqliteGetDate, nullptr, nullptr);
+        sqlite3_create_function(db, "DATEADD", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, sqliteDateAdd, nullptr, nullptr);
+        sqlite3_create_function(db, "DATEDIFF", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, sqliteDateDiff, nullptr, nullptr);
+        sqlite3_create_function(db, "BINARY_CHECKSUM", -1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, sqliteBinaryChecksum, nullptr, nullptr);
+        sqlite3_create_function(db, "CHECKSUM_AGG", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, nullptr, sqliteChecksumAggStep, sqliteChecksumAggFinal);
+        sqlite3_create_function(db, "DB_NAME", 0, SQLITE_UTF8, &dbName, sqliteDbName, nullptr, nullptr);
+        broken = false;
+        lastUsed = chrono::steady_clock::now();
+        return true;
+    }
 
-    if (runQuery(query)) {
-        cout << "Member added successfully!\n";
-    } else {
-        cout << "Failed to add member.\n";
+    void disconnect() override {
+        for (auto& entry : statements) sqlite3_finalize(entry.second);
+        statements.clear();
+        if (db) sqlite3_close(db);
+        db = nullptr;
     }
-}
- 
- 
-void updateMember() {
-    string memberID;
-    cout << "Enter MemberID: ";
-    cin >> memberID;
 
-    if (!all_of(memberID.begin(), memberID.end(), ::isdigit)) {
-        cout << "MemberID must be numeric!" << endl;
-        return;
+    bool isAlive() override { return db != nullptr; }
+
+    bool execute(const string& sql, const vector<SqlParam>& params, long long* rowsAffected) override {
+        StatementMetrics metrics(sql);
+        sqlite3_stmt* stmt = prepare(sql, params);
+        if (!stmt) return false;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {}
+        bool ok = finish(stmt, rc);
+        metrics.finish(ok);
+        if (ok && rowsAffected) *rowsAffected = sqlite3_changes(db);
+        return ok;
     }
 
-    auto res = getResults("SELECT MemberID FROM dbo.Members WHERE MemberID = '" + memberID + "'");
-    if (res.empty()) {
-        cout << "Member not found!" << endl;
-        return;
+    bool fetch(const string& sql, const vector<SqlParam>& params, ResultSet& rs) override {
+        return fetchRows(sql, params, rs, nullptr);
+    }
+    bool fetchBlocks(const string& sql, const vector<SqlParam>& params, const RowBlockSink& sink) override {
+        ResultSet block;
+        return fetchRows(sql, params, block, &sink);
     }
 
-    string name, email, type;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');  // Clear input buffer
+    void begin() override { exec(beginStatement); }
+    bool commit() override {
+        if (sqlite3_get_autocommit(db)) return true;
+        if (exec(commitStatement)) return true;
+        rollback();
+        return false;
+    }
+    void rollback() override {
+        if (!sqlite3_get_autocommit(db)) exec(rollbackStatement);
+    }
 
-    cout << "Enter new Name (leave blank to skip): ";
-    getline(cin, name);
-    cout << "Enter new Email (leave blank to skip): ";
-    getline(cin, email);
-    cout << "Enter new Type (Regular/Premium, leave blank to skip): ";
-    getline(cin, type);
+    // The running sqlite3_step returns SQLITE_INTERRUPT.
+    void cancel() override {
+        if (db) sqlite3_interrupt(db);
+    }
 
-    // Helper to escape single quotes
-    auto escape = [](string &s) {
-        for (size_t i = 0; i < s.length(); ++i) {
-            if (s[i] == '\'') s.insert(i++, "'");
-        }
-    };
+    bool insertBookBatch(const vector<BookImportRow>& rows, size_t begin, size_t count, vector<char>& rowOk) override;
 
-    string query = "UPDATE dbo.Members SET ";
-    bool hasUpdate = false;
+    size_t cachedStatements() const override { return statements.size(); }
 
-    if (!name.empty()) {
-        escape(name);
-        query += "Name = '" + name + "'";
-        hasUpdate = true;
+private:
+    bool exec(const string& sql) {
+        StatementMetrics metrics(sql);
+        bool ok = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+        metrics.finish(ok);
+        if (!ok) showSqliteError(db);
+        return ok;
     }
 
-    if (!email.empty()) {
-        escape(email);
-        auto emailRes = getResults("SELECT Email FROM dbo.Members WHERE Email = '" + email + "' AND MemberID != '" + memberID + "'");
-        if (!emailRes.empty()) {
-            cout << "Email already exists!" << endl;
-            return;
+    // Steps a query into rs; with a sink, rs holds one block at a time.
+    bool fetchRows(const string& sql, const vector<SqlParam>& params, ResultSet& rs, const RowBlockSink* sink) {
+        StatementMetrics metrics(sql);
+        sqlite3_stmt* stmt = prepare(sql, params);
+        if (!stmt) return false;
+
+        int numCols = sqlite3_column_count(stmt);
+        rs.columns.resize(numCols);
+        // Table columns are typed from their declaration; expressions from their first non-NULL value.
+        // An expression typed Int stays open to widening: DECIMAL has NUMERIC affinity, so a
+        // SUM() of money comes back INTEGER for a whole amount and REAL for the rest.
+        enum : char { Untyped, Typed, WidenableInt };
+        vector<char> typed(numCols, Untyped);
+        for (int i = 0; i < numCols; ++i) {
+            ResultColumn& col = rs.columns[i];
+            col.name = sqlite3_column_name(stmt, i);
+            const char* decl = sqlite3_column_decltype(stmt, i);
+            if (!decl) continue;
+            typed[i] = Typed;
+            string type = decl;
+            transform(type.begin(), type.end(), type.begin(), ::toupper);
+            if (type.find("INT") != string::npos) {
+                col.type = ColumnType::Int;
+            } else if (type.find("DEC") != string::npos || type.find("NUM") != string::npos) {
+                col.type = ColumnType::Double;
+                size_t comma = type.find(',');
+                col.scale = comma == string::npos ? 0 : atoi(type.c_str() + comma + 1);
+            } else if (type.find("REAL") != string::npos || type.find("FLOA") != string::npos || type.find("DOUB") != string::npos) {
+                col.type = ColumnType::Double;
+            }
         }
-        if (hasUpdate) query += ", ";
-        query += "Email = '" + email + "'";
-        hasUpdate = true;
-    }
 
-    if (!type.empty()) {
-        // Normalize type (case-insensitive)
-        transform(type.begin(), type.end(), type.begin(), ::tolower);
-        if (type != "regular" && type != "premium") {
-            cout << "Invalid Type! Use 'Regular' or 'Premium'." << endl;
+        size_t rows = 0;  // in rs, i.e. in the current block when streaming
+        size_t totalRows = 0, textBytes = 0;
+        bool stopped = false;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            ResultCell* row = rs.appendRows(1);
+            for (int i = 0; i < numCols; ++i) {
+                ResultColumn& col = rs.columns[i];
+                int valueType = sqlite3_column_type(stmt, i);
+                if (valueType == SQLITE_NULL) continue;
+                // Earlier rows were all NULL, so their cells need no conversion.
+                if (typed[i] == Untyped) {
+                    typed[i] = valueType == SQLITE_INTEGER ? WidenableInt : Typed;
+                    col.type = valueType == SQLITE_INTEGER ? ColumnType::Int : valueType == SQLITE_FLOAT ? ColumnType::Double : ColumnType::Text;
+                } else if (typed[i] == WidenableInt && valueType == SQLITE_FLOAT) {
+                    // Blocks already streamed held whole numbers only; convert the ones still here.
+                    typed[i] = Typed;
+                    col.type = ColumnType::Double;
+                    for (size_t r = 0; r < rows; ++r) {
+                        ResultCell& earlier = rs.cells[r * numCols + i];
+                        if (!earlier.null) earlier.doubleValue = (double)earlier.intValue;
+                    }
+                }
+                ResultCell& cell = row[i];
+                cell.null = 0;
+                switch (col.type) {
+                    case ColumnType::Int: cell.intValue = sqlite3_column_int64(stmt, i); break;
+                    case ColumnType::Double: cell.doubleValue = sqlite3_column_double(stmt, i); break;
+                    case ColumnType::Date: rs.setDate(cell, DateTimeValue()); break;
+                    case ColumnType::Text: {
+                        const char* text = (const char*)sqlite3_column_text(stmt, i);
+                        size_t len = (size_t)sqlite3_column_bytes(stmt, i);
+                        rs.setText(cell, text, len);
+                        textBytes += len;
+                        break;
+                    }
+                }
+            }
+            rows++;
+            totalRows++;
+            if (sink && rows == resultBlockRows) {
+                stopped = !(*sink)(rs);
+                rs.clearRows();
+                rows = 0;
+                if (stopped) break;
+            }
+        }
+        if (sink && !stopped && rc == SQLITE_DONE && rows > 0) {
+            stopped = !(*sink)(rs);
+            rs.clearRows();
+        }
+        if (stopped) {
+            metrics.finish(true, totalRows, textBytes);
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+            return false;
+        }
+        bool ok = finish(stmt, rc);
+        metrics.finish(ok, totalRows, textBytes);
+        return ok;
+    }
+
+    // The cached, translated statement for sqlTemplate with params bound, or nullptr.
+    sqlite3_stmt* prepare(const string& sqlTemplate, const vector<SqlParam>& params) {
+        sqlite3_stmt* stmt = nullptr;
+        auto it = statements.find(sqlTemplate);
+        if (it != statements.end()) {
+            statementHits++;
+            stmt = it->second;
+        } else {
+            statementMisses++;
+            string translated = translateToSqlite(sqlTemplate);
+            if (sqlite3_prepare_v2(db, translated.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                showSqliteError(db);
+                sqlite3_finalize(stmt);
+                return nullptr;
+            }
+            statements.emplace(sqlTemplate, stmt);
+        }
+        for (size_t i = 0; i < params.size(); ++i) {
+            const SqlParam& p = params[i];
+            int index = (int)i + 1;
+            if (p.kind == SqlParam::Text) sqlite3_bind_text(stmt, index, p.text.data(), (int)p.text.size(), SQLITE_STATIC);
+            else if (p.kind == SqlParam::Int) sqlite3_bind_int64(stmt, index, p.intValue);
+            else sqlite3_bind_double(stmt, index, p.doubleValue);
+        }
+        return stmt;
+    }
+
+    // Resets a cached statement for its next use; rc is the last sqlite3_step result.
+    bool finish(sqlite3_stmt* stmt, int rc) {
+        bool ok = rc == SQLITE_DONE;
+        if (!ok) showSqliteError(db);
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return ok;
+    }
+
+    string path;
+    string dbName;
+    sqlite3* db = nullptr;
+    unordered_map<string, sqlite3_stmt*> statements;
+};
+
+class SqliteBackend : public StorageBackend {
+public:
+    explicit SqliteBackend(const string& path) : path(path) {
+        size_t slash = path.find_last_of("/\\");
+        dbName = path.substr(slash == string::npos ? 0 : slash + 1);
+        dbName = dbName.substr(0, dbName.find('.'));
+    }
+
+    string name() const override { return "SQLite (" + path + ")"; }
+
+    // Creates the schema on first use. A brand-new database gets one Admin login
+    // (Admin/admin) so the menus are reachable; change it once logged in.
+    bool open() override {
+        sqlite3* db = nullptr;
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+            showSqliteError(db);
+            sqlite3_close(db);
+            return false;
+        }
+        bool ok = sqlite3_exec(db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr) == SQLITE_OK &&
+                  sqlite3_exec(db, sqliteSchema, nullptr, nullptr, nullptr) == SQLITE_OK &&
+                  sqlite3_exec(db, "INSERT INTO Members (Name, Email, MembershipType, Role, Password) "
+                                   "SELECT 'Admin', 'admin@library.local', 'Regular', 'Admin', 'admin' "
+                                   "WHERE NOT EXISTS (SELECT 1 FROM Members)", nullptr, nullptr, nullptr) == SQLITE_OK;
+        if (!ok) showSqliteError(db);
+        else if (sqlite3_changes(db) > 0) cout << "Created " << path << " with default login Admin/admin." << endl;
+        sqlite3_close(db);
+        return ok;
+    }
+    void close() override {}
+    unique_ptr<StorageConnection> newConnection() override { return make_unique<SqliteConnection>(path, dbName); }
+
+private:
+    string path;
+    string dbName;
+};
+#endif
+
+const size_t connectionPoolSize = 4;
+const int connectAttempts = 3;
+const chrono::seconds idleHealthCheckAfter(30);
+
+class ConnectionPool {
+public:
+    bool open(StorageBackend* storage, size_t maxConnections) {
+        backend = storage;
+        if (!backend->open()) return false;
+        maxSize = maxConnections;
+        // Open the first connection eagerly so a bad server or login fails at startup;
+        // the rest are opened on demand.
+        StorageConnection* first = acquire();
+        if (!first) {
+            close();
+            return false;
+        }
+        release(first);
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(mtx);
+        for (auto& conn : connections) conn->disconnect();
+        connections.clear();
+        idle.clear();
+        if (backend) backend->close();
+    }
+
+    // Blocks until a connection is free. Returns nullptr if none can be (re)connected.
+    StorageConnection* acquire() {
+        StorageConnection* conn = nullptr;
+        {
+            unique_lock<mutex> lock(mtx);
+            released.wait(lock, [&] { return !idle.empty() || connections.size() < maxSize; });
+            if (!idle.empty()) {
+                conn = idle.back();
+                idle.pop_back();
+            } else {
+                connections.push_back(backend->newConnection());
+                conn = connections.back().get();
+                conn->broken = true;  // not connected yet
+            }
+        }
+        if (!ensureHealthy(*conn)) {
+            release(conn);
+            return nullptr;
+        }
+        return conn;
+    }
+
+    void release(StorageConnection* conn) {
+        conn->lastUsed = chrono::steady_clock::now();
+        {
+            lock_guard<mutex> lock(mtx);
+            idle.push_back(conn);
+        }
+        released.notify_one();
+    }
+
+    void collectStats(size_t& open, size_t& idleCount, size_t& cached, size_t& hits, size_t& misses) {
+        lock_guard<mutex> lock(mtx);
+        open = connections.size();
+        idleCount = idle.size();
+        cached = hits = misses = 0;
+        for (auto& conn : connections) {
+            hits += conn->statementHits;
+            misses += conn->statementMisses;
+        }
+        // Statement maps of leased connections belong to their holders; only count idle ones.
+        for (auto* conn : idle) cached += conn->cachedStatements();
+    }
+
+private:
+    // Connections that failed or sat idle for a while are probed and reconnected
+    // if the backend reports them gone.
+    bool ensureHealthy(StorageConnection& conn) {
+        if (!conn.broken && chrono::steady_clock::now() - conn.lastUsed > idleHealthCheckAfter) {
+            conn.broken = !conn.isAlive();
+        }
+        if (!conn.broken) return true;
+
+        conn.disconnect();
+        for (int attempt = 1; attempt <= connectAttempts; ++attempt) {
+            if (conn.connect()) return true;
+            if (attempt < connectAttempts) this_thread::sleep_for(chrono::milliseconds(500 * attempt));
+        }
+        return false;
+    }
+
+    StorageBackend* backend = nullptr;
+    size_t maxSize = 0;
+    mutex mtx;
+    condition_variable released;
+    vector<unique_ptr<StorageConnection>> connections;
+    vector<StorageConnection*> idle;
+};
+ConnectionPool connectionPool;
+
+// The connection leased by the current thread, if any. Nested leases on the same
+// thread share it, so a function that starts a transaction and then calls
+// runQuery()/fetchResultSet() keeps every statement on the one connection.
+thread_local StorageConnection* boundConnection = nullptr;
+
+// Cancellation and progress for work done on behalf of a background job.
+// Connections leased while a job is current on the thread are registered with
+// it, so cancel() can interrupt a statement already running on the server.
+class JobControl {
+public:
+    void cancel() {
+        lock_guard<mutex> lock(mtx);
+        cancelRequested = true;
+        for (StorageConnection* conn : attached) conn->cancel();
+    }
+    bool cancelled() const { return cancelRequested; }
+
+    void attach(StorageConnection* conn) {
+        lock_guard<mutex> lock(mtx);
+        attached.push_back(conn);
+        if (cancelRequested) conn->cancel();
+    }
+    void detach(StorageConnection* conn) {
+        lock_guard<mutex> lock(mtx);
+        attached.erase(find(attached.begin(), attached.end(), conn));
+    }
+
+    atomic<size_t> progress{0};  // rows handled so far
+
+private:
+    mutex mtx;
+    atomic<bool> cancelRequested{false};
+    vector<StorageConnection*> attached;
+};
+
+// The job the current thread is working for, if any.
+thread_local JobControl* currentJob = nullptr;
+
+// For long loops: whether the current job was cancelled, and its rows done.
+bool jobCancelled() { return currentJob && currentJob->cancelled(); }
+void addJobProgress(size_t rows) {
+    if (currentJob) currentJob->progress += rows;
+}
+
+class ConnectionLease {
+public:
+    ConnectionLease() {
+        if (boundConnection) {
+            conn = boundConnection;
+        } else {
+            conn = connectionPool.acquire();
+            owner = conn != nullptr;
+            boundConnection = conn;
+            job = owner ? currentJob : nullptr;
+            if (job) job->attach(conn);
+        }
+    }
+    ~ConnectionLease() {
+        if (owner) {
+            if (job) job->detach(conn);
+            boundConnection = nullptr;
+            connectionPool.release(conn);
+        }
+    }
+    ConnectionLease(const ConnectionLease&) = delete;
+    ConnectionLease& operator=(const ConnectionLease&) = delete;
+
+    explicit operator bool() const { return conn != nullptr; }
+    StorageConnection* operator->() const { return conn; }
+    StorageConnection& operator*() const { return *conn; }
+    bool owns() const { return owner; }
+
+private:
+    StorageConnection* conn = nullptr;
+    bool owner = false;
+    JobControl* job = nullptr;
+};
+
+// Whether withConnection() may run a body again after the link dropped under
+// it. A write may have committed before the reply was lost, so only bodies that
+// read, or that start their output over, are Idempotent.
+enum class ConnectionRetry { Never, Idempotent };
+
+// Runs body on a leased connection. An Idempotent top-level call whose
+// connection dropped is retried once on a reconnected one; nested calls are
+// not, because the caller's transaction went down with the link.
+template <typename Body>
+bool withConnection(Body body, ConnectionRetry retry = ConnectionRetry::Never) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (jobCancelled()) return false;
+        ConnectionLease lease;
+        if (!lease) {
+            statusOut() << "No database connection available." << endl;
+            return false;
+        }
+        if (body(*lease)) return true;
+        if (!lease.owns() || !lease->broken) return false;
+        if (retry != ConnectionRetry::Idempotent) {
+            statusOut() << "Connection lost; not retried, as the change may already have been made." << endl;
+            return false;
+        }
+        statusOut() << "Connection lost, reconnecting..." << endl;
+    }
+    return false;
+}
+
+unique_ptr<StorageBackend> storageBackend;
+
+// Picks the backend named on the command line ("odbc" or "sqlite"); empty means
+// the build's default. Returns false for a backend this build does not include.
+bool selectBackend(const string& name) {
+#if LIBRARY_WITH_ODBC
+    if (name.empty() || name == "odbc") {
+        storageBackend = make_unique<OdbcBackend>();
+        return true;
+    }
+#endif
+#if LIBRARY_WITH_SQLITE
+    if (name.empty() || name == "sqlite") {
+        storageBackend = make_unique<SqliteBackend>(sqliteDatabasePath);
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool connectDB() {
+    if (!storageBackend && !selectBackend("")) return false;
+    if (!connectionPool.open(storageBackend.get(), connectionPoolSize)) return false;
+    cout << "Connected to database: " << storageBackend->name() << endl;
+    return true;
+}
+void disconnectDB() {
+    connectionPool.close();
+}
+bool runQuery(const string& query, const vector<SqlParam>& params = {}, bool useTransaction = false, long long* rowsAffected = nullptr) {
+    return withConnection([&](StorageConnection& conn) {
+        if (useTransaction) conn.begin();
+        if (!conn.execute(query, params, rowsAffected)) {
+            if (useTransaction) conn.rollback();
+            return false;
+        }
+        return !useTransaction || conn.commit();
+    });
+}
+// A SELECT (or WITH ... SELECT) that is safe to run again; INSERT ... OUTPUT is not.
+bool isReadStatement(const string& query) {
+    size_t start = query.find_first_not_of(" \t\r\n(");
+    if (start == string::npos) return false;
+    string verb = query.substr(start, 6);
+    transform(verb.begin(), verb.end(), verb.begin(), ::toupper);
+    return verb == "SELECT" || verb.compare(0, 4, "WITH") == 0;
+}
+ResultSet fetchResultSet(const string& query, const vector<SqlParam>& params = {}) {
+    ResultSet rs;
+    withConnection([&](StorageConnection& conn) {
+        rs = ResultSet();
+        return conn.fetch(query, params, rs);
+    }, isReadStatement(query) ? ConnectionRetry::Idempotent : ConnectionRetry::Never);
+    return rs;
+}
+
+// What a pooled task inherits from the thread that submitted it: the job it
+// works for, where its messages go and the operation its statements count to.
+struct TaskContext {
+    JobControl* job;
+    ostream* out;
+    OperationMetrics* op;
+
+    static TaskContext capture() { return {currentJob, jobOutput, OperationMetrics::current}; }
+    void install() const {
+        currentJob = job;
+        jobOutput = out;
+        OperationMetrics::current = op;
+    }
+};
+
+// Worker threads for queries issued off the UI thread, one per pooled
+// connection. A task keeps the submitting thread's context, so a query a job
+// farms out is cancelled with it.
+class QueryPool {
+public:
+    ~QueryPool() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    template <typename Fn>
+    auto submit(Fn fn) -> future<decltype(fn())> {
+        using Result = decltype(fn());
+        auto task = make_shared<packaged_task<Result()>>([fn = move(fn), context = TaskContext::capture()]() mutable {
+            struct Restore {
+                TaskContext outer;
+                ~Restore() { outer.install(); }
+            } restore{TaskContext::capture()};
+            context.install();
+            return fn();
+        });
+        future<Result> result = task->get_future();
+        {
+            lock_guard<mutex> lock(mtx);
+            if (workers.empty()) {
+                for (size_t i = 0; i < connectionPoolSize; ++i) workers.emplace_back([this] { run(); });
+            }
+            tasks.push_back([task] { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+private:
+    void run() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(mtx);
+                wake.wait(lock, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    mutex mtx;
+    condition_variable wake;
+    deque<function<void()>> tasks;
+    vector<thread> workers;
+    bool stopping = false;
+};
+QueryPool queryPool;
+
+future<ResultSet> fetchResultSetAsync(const string& query, const vector<SqlParam>& params = {}) {
+    return queryPool.submit([query, params] { return fetchResultSet(query, params); });
+}
+future<bool> runQueryAsync(const string& query, const vector<SqlParam>& params = {}, bool useTransaction = false) {
+    return queryPool.submit([query, params, useTransaction] { return runQuery(query, params, useTransaction); });
+}
+
+// An ostream target one thread appends to while the UI thread reads it.
+class JobLogBuf : public streambuf {
+public:
+    string text() {
+        lock_guard<mutex> lock(mtx);
+        return buffer;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (c != EOF) {
+            lock_guard<mutex> lock(mtx);
+            buffer += (char)c;
+        }
+        return c;
+    }
+    streamsize xsputn(const char* s, streamsize n) override {
+        lock_guard<mutex> lock(mtx);
+        buffer.append(s, (size_t)n);
+        return n;
+    }
+
+private:
+    mutex mtx;
+    string buffer;
+};
+
+enum class JobState { Running, Done, Failed, Cancelled };
+
+struct BackgroundJob {
+    int id = 0;
+    string name;
+    JobControl control;
+    atomic<JobState> state{JobState::Running};
+    chrono::steady_clock::time_point started;
+    atomic<double> seconds{0};  // set when it finishes
+    JobLogBuf logBuf;
+    ostream log{&logBuf};
+    bool announced = false;     // UI thread only
+    thread worker;
+
+    double elapsed() const {
+        return state == JobState::Running ? chrono::duration<double>(chrono::steady_clock::now() - started).count() : seconds.load();
+    }
+};
+
+// Long reports, exports and imports run here while the desk keeps working.
+// A job's messages go to its own log rather than the screen, and it can be
+// cancelled from the Background Jobs menu.
+class BackgroundJobs {
+public:
+    // Starts body on its own thread; body returns false if the job failed.
+    int start(const string& name, function<bool()> body) {
+        auto job = make_shared<BackgroundJob>();
+        job->name = name;
+        job->started = chrono::steady_clock::now();
+        BackgroundJob* raw = job.get();
+        {
+            lock_guard<mutex> lock(mtx);
+            job->id = ++lastId;
+            jobs.push_back(job);
+        }
+        job->worker = thread([raw, body = move(body)] {
+            currentJob = &raw->control;
+            jobOutput = &raw->log;
+            bool ok = body();
+            jobOutput = nullptr;
+            currentJob = nullptr;
+            raw->seconds = chrono::duration<double>(chrono::steady_clock::now() - raw->started).count();
+            raw->state = raw->control.cancelled() ? JobState::Cancelled : ok ? JobState::Done : JobState::Failed;
+        });
+        cout << "Started background job #" << job->id << ": " << name << ". Follow it under Background Jobs." << endl;
+        return job->id;
+    }
+
+    // One line per running job, and one for each job that finished since the last call.
+    void printStatus() {
+        for (auto& job : snapshot()) {
+            JobState state = job->state;
+            if (state == JobState::Running) {
+                cout << "[#" << job->id << " " << job->name << ": " << job->control.progress << " rows, " << fixed << setprecision(1)
+                     << job->elapsed() << " s]" << endl;
+            } else if (!job->announced) {
+                job->announced = true;
+                cout << "[#" << job->id << " " << job->name << " " << stateName(state) << " after " << fixed << setprecision(1)
+                     << job->elapsed() << " s]" << endl;
+            }
+        }
+        cout.unsetf(ios::floatfield);
+    }
+
+    void printList() {
+        auto all = snapshot();
+        if (all.empty()) {
+            cout << "No background jobs." << endl;
+            return;
+        }
+        cout << left << setw(5) << "ID" << setw(28) << "Job" << setw(11) << "State" << right << setw(12) << "Rows" << setw(10) << "Seconds"
+             << setw(10) << "Rows/s" << endl;
+        cout << string(76, '-') << endl;
+        for (auto& job : all) {
+            double secs = job->elapsed();
+            size_t rows = job->control.progress;
+            cout << left << setw(5) << job->id << setw(28) << job->name.substr(0, 27) << setw(11) << stateName(job->state) << right
+                 << setw(12) << rows << fixed << setprecision(1) << setw(10) << secs << setprecision(0) << setw(10)
+                 << (secs > 0 ? rows / secs : 0.0) << endl;
+            if (job->state != JobState::Running) job->announced = true;
+        }
+        cout.unsetf(ios::floatfield);
+    }
+
+    bool cancel(int id) {
+        auto job = find(id);
+        if (!job || job->state != JobState::Running) return false;
+        job->control.cancel();
+        return true;
+    }
+
+    bool printLog(int id) {
+        auto job = find(id);
+        if (!job) return false;
+        string text = job->logBuf.text();
+        cout << "--- Job #" << id << " " << job->name << " ---\n" << (text.empty() ? "(no output yet)\n" : text);
+        return true;
+    }
+
+    // Lets running jobs finish before the connections close.
+    void waitAll() {
+        for (auto& job : snapshot()) {
+            if (!job->worker.joinable()) continue;
+            if (job->state == JobState::Running) cout << "Waiting for background job #" << job->id << " (" << job->name << ")..." << endl;
+            job->worker.join();
+        }
+        printStatus();
+    }
+
+private:
+    static const char* stateName(JobState state) {
+        switch (state) {
+            case JobState::Running: return "running";
+            case JobState::Done: return "done";
+            case JobState::Failed: return "failed";
+            case JobState::Cancelled: return "cancelled";
+        }
+        return "";
+    }
+
+    vector<shared_ptr<BackgroundJob>> snapshot() {
+        lock_guard<mutex> lock(mtx);
+        return jobs;
+    }
+    shared_ptr<BackgroundJob> find(int id) {
+        lock_guard<mutex> lock(mtx);
+        for (auto& job : jobs) {
+            if (job->id == id) return job;
+        }
+        return nullptr;
+    }
+
+    mutex mtx;
+    vector<shared_ptr<BackgroundJob>> jobs;
+    int lastId = 0;
+};
+BackgroundJobs backgroundJobs;
+
+// Buffered CSV output: cells are escaped straight into a large buffer that is
+// handed to fwrite in one piece, so a report costs a few syscalls, not one per row.
+class CsvFileWriter {
+public:
+    static constexpr size_t bufferBytes = 1 << 20;
+
+    ~CsvFileWriter() { close(); }
+
+    bool open(const string& path) {
+        close();
+        file = fopen(path.c_str(), "wb");
+        buffer.clear();
+        buffer.reserve(bufferBytes);
+        written = 0;
+        failed = file == nullptr;
+        return file != nullptr;
+    }
+    // Quotes the field only when it contains a comma, quote or line break.
+    void field(string_view value, bool first) {
+        if (!first) buffer += ',';
+        if (value.find_first_of(",\"\r\n") == string_view::npos) {
+            buffer.append(value.data(), value.size());
+        } else {
+            buffer += '"';
+            for (char c : value) {
+                if (c == '"') buffer += '"';
+                buffer += c;
+            }
+            buffer += '"';
+        }
+    }
+    void endRow() {
+        buffer += '\n';
+        if (buffer.size() >= bufferBytes) flush();
+    }
+    void line(string_view text) {
+        buffer.append(text.data(), text.size());
+        endRow();
+    }
+    bool close() {
+        if (!file) return !failed;
+        flush();
+        if (fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+    size_t bytes() const { return written + buffer.size(); }
+
+private:
+    void flush() {
+        if (file && !buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) failed = true;
+        written += buffer.size();
+        buffer.clear();
+    }
+
+    FILE* file = nullptr;
+    string buffer;
+    size_t written = 0;
+    bool failed = false;
+};
+
+struct ReportJob {
+    const char* filename;
+    const char* header;
+    const char* sql;
+};
+
+struct ReportRun {
+    bool ok = false;
+    size_t rows = 0;
+    size_t bytes = 0;
+    double firstRowMs = 0;  // query latency: time until the first block arrived
+    double totalMs = 0;
+};
+
+// Streams one report from its own pooled connection to path. Rows go from the
+// fetch buffer into the writer block by block and are never collected.
+ReportRun runReport(const ReportJob& job, const string& path) {
+    ReportRun run;
+    auto start = chrono::steady_clock::now();
+    CsvFileWriter out;
+    run.ok = withConnection([&](StorageConnection& conn) {
+        // A retry after a dropped connection starts the file over.
+        if (!out.open(path)) return false;
+        run.rows = 0;
+        out.line(job.header);
+        char buf[64];
+        return conn.fetchBlocks(job.sql, {}, [&](const ResultSet& block) {
+            if (run.rows == 0) run.firstRowMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            for (size_t r = 0; r < block.size(); ++r) {
+                for (size_t c = 0; c < block.columnCount(); ++c) out.field(block.cell(r, c, buf, sizeof(buf)), c == 0);
+                out.endRow();
+            }
+            run.rows += block.size();
+            addJobProgress(block.size());
+            return !jobCancelled();
+        });
+    }, ConnectionRetry::Idempotent);
+    run.ok = out.close() && run.ok;
+    run.bytes = out.bytes();
+    run.totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return run;
+}
+
+const ReportJob exportReports[] = {
+    {"top_issued_books.csv", "BookID,Title,IssueCount",
+     "SELECT b.BookID, b.Title, COUNT(t.TransactionID) as IssueCount FROM dbo.Books b LEFT JOIN dbo.Transactions t ON b.BookID = t.BookID GROUP BY b.BookID, b.Title ORDER BY IssueCount DESC"},
+    {"active_members.csv", "MemberID,Name,BooksIssued",
+     "SELECT m.MemberID, m.Name, COUNT(t.TransactionID) as BooksIssued FROM dbo.Members m LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID, m.Name ORDER BY BooksIssued DESC"},
+    {"fine_summary.csv", "MemberID,Name,TotalFine",
+     "SELECT m.MemberID, m.Name, SUM(t.FineAmount) as TotalFine FROM dbo.Members m LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID, m.Name ORDER BY TotalFine DESC"},
+};
+
+void exportReportsToCSV() {
+    OperationMetrics op("export_reports");
+    char cwd[256];
+    if (_getcwd(cwd, sizeof(cwd)) == nullptr) {  // Check if _getcwd succeeded
+        statusOut() << "Failed to get current working directory." << endl;
+        return;
+    }
+
+    string basePath = string(cwd) + pathSeparator;
+
+    // Each report runs on its own pooled connection, so the GROUP BY scans execute
+    // concurrently and each writer drains its cursor as rows arrive.
+    auto start = chrono::steady_clock::now();
+    vector<future<ReportRun>> jobs;
+    for (const ReportJob& job : exportReports) {
+        jobs.push_back(queryPool.submit([&job, &basePath] { return runReport(job, basePath + job.filename); }));
+    }
+
+    statusOut() << left << setw(24) << "Report" << right << setw(10) << "Rows" << setw(12) << "Bytes" << setw(12) << "Query ms" << setw(12) << "Total ms" << endl;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        ReportRun run = jobs[i].get();
+        statusOut() << left << setw(24) << exportReports[i].filename << right;
+        if (!run.ok) {
+            statusOut() << "  failed" << endl;
+            continue;
+        }
+        statusOut() << setw(10) << run.rows << setw(12) << run.bytes << fixed << setprecision(1) << setw(12) << run.firstRowMs << setw(12)
+             << run.totalMs << defaultfloat << endl;
+    }
+    double wallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    statusOut() << "Exported to " << basePath << " in " << fixed << setprecision(1) << wallMs << " ms" << defaultfloat << endl;
+}
+
+bool login() {
+    int roleChoice;
+    string username, password, role;
+    OperationMetrics op("login");
+
+    cout << "Who wants to login?\n1) Admin\n2) User\nChoice: ";
+    cin >> roleChoice;
+    while (cin.fail() || roleChoice < 1 || roleChoice > 2) {
+        cout << "Invalid choice! Enter 1 for Admin or 2 for User: ";
+        cin.clear();
+        cin.ignore(10000, '\n');  // clear bad input
+        cin >> roleChoice;
+    }
+
+    role = (roleChoice == 1) ? "Admin" : "User";
+
+    cout << "Enter Username: ";
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');  // clear leftover newline
+    getline(cin, username);
+
+    cout << "Enter Password: ";
+    cin >> password;
+
+    ResultSet res = fetchResultSet("SELECT Role FROM dbo.Members WHERE Name = ? AND Password = ? AND Role = ?", {username, password, role});
+
+    if (res.empty()) {
+        cout << "Invalid credentials for " << role << "!" << endl;
+        return false;
+    }
+
+    currentUserRole = res.cellString(0, 0);
+    cout << "Logged in as " << currentUserRole << endl;
+    return true;
+}
+
+// ---- Table schemas ----
+
+// Books, Members and Transactions are each declared once below: a typed row and
+// one TableColumn per column, in table order. Select and insert lists are built
+// from them at compile time; row binding, parameter binding, the import's CSV
+// mapping, snapshot encodings and the screen layouts all walk the same columns.
+
+struct Book {
+    int bookID = 0;
+    string title, authors, genre, publisher, isbn, edition;
+    int publishedYear = 0;
+    double price = 0.0;
+    string rackLocation, language, availability;
+};
+
+struct Member {
+    int memberID = 0;
+    string name, email, membershipType;
+};
+
+struct Transaction {
+    int transactionID = 0, bookID = 0, memberID = 0;
+    DateTimeValue issueDate, dueDate, returnDate;
+    string status;
+    double fineAmount = 0.0;
+};
+
+// One column of a view: its heading, its width including the gap after it, and
+// how much of a value to show (0 lets long values, such as large IDs, overflow
+// rather than be cut).
+struct ViewColumn {
+    const char* heading;
+    size_t width;
+    size_t clip;
+};
+
+enum ColumnFlag : unsigned {
+    GeneratedKey = 1,   // identity: never inserted or imported
+    Required = 2,       // imports reject a row that leaves it empty
+    Categorical = 4,    // few distinct values; snapshots dictionary-encode it
+    ZeroIfNull = 8,     // views show NULL as 0
+};
+
+// A column's SQL name, the Row member it binds to (the one matching type), and
+// how views show it; a column without a heading is not shown.
+template <typename Row>
+struct TableColumn {
+    size_t position;
+    const char* name;
+    ColumnType type;
+    int Row::*intField = nullptr;
+    double Row::*doubleField = nullptr;
+    DateTimeValue Row::*dateField = nullptr;
+    string Row::*textField = nullptr;
+    int scale = 0;                      // as in ResultColumn
+    ViewColumn view;
+    unsigned flags;
+
+    constexpr TableColumn(size_t position, const char* name, int Row::*field, ViewColumn view, unsigned flags = 0)
+        : position(position), name(name), type(ColumnType::Int), intField(field), view(view), flags(flags) {}
+    constexpr TableColumn(size_t position, const char* name, double Row::*field, int scale, ViewColumn view, unsigned flags = 0)
+        : position(position), name(name), type(ColumnType::Double), doubleField(field), scale(scale), view(view), flags(flags) {}
+    constexpr TableColumn(size_t position, const char* name, DateTimeValue Row::*field, ViewColumn view, unsigned flags = 0)
+        : position(position), name(name), type(ColumnType::Date), dateField(field), scale(3), view(view), flags(flags) {}
+    constexpr TableColumn(size_t position, const char* name, string Row::*field, ViewColumn view, unsigned flags = 0)
+        : position(position), name(name), type(ColumnType::Text), textField(field), view(view), flags(flags) {}
+};
+
+template <typename Row, size_t N>
+struct TableSchema {
+    const char* table;                  // e.g. "dbo.Books"
+    const char* name;                   // plural, as in "No Books found."
+    TableColumn<Row> columns[N];
+};
+
+// Each column is declared with its enumerator so a reordering cannot go unnoticed.
+template <typename Row, size_t N>
+constexpr bool columnsInOrder(const TableSchema<Row, N>& schema) {
+    for (size_t i = 0; i < N; ++i) {
+        if (schema.columns[i].position != i) return false;
+    }
+    return true;
+}
+
+enum BooksColumn { BooksBookID, BooksTitle, BooksAuthors, BooksGenre, BooksPublisher, BooksISBN, BooksEdition, BooksPublishedYear,
+                   BooksPrice, BooksRackLocation, BooksLanguage, BooksAvailability, BooksColumnCount };
+constexpr TableSchema<Book, BooksColumnCount> booksTable = {"dbo.Books", "Books", {
+    {BooksBookID, "BookID", &Book::bookID, {"ID", 5, 0}, GeneratedKey},
+    {BooksTitle, "Title", &Book::title, {"Title", 25, 24}, Required},
+    {BooksAuthors, "Authors", &Book::authors, {"Authors", 20, 19}, Required},
+    {BooksGenre, "Genre", &Book::genre, {"Genre", 12, 11}, Categorical},
+    {BooksPublisher, "Publisher", &Book::publisher, {"Publisher", 15, 14}, Categorical},
+    {BooksISBN, "ISBN", &Book::isbn, {}, Required},
+    {BooksEdition, "Edition", &Book::edition, {"Ed.", 8, 0}},
+    {BooksPublishedYear, "PublishedYear", &Book::publishedYear, {"Year", 6, 0}},
+    {BooksPrice, "Price", &Book::price, 2, {"Price", 8, 0}},
+    {BooksRackLocation, "RackLocation", &Book::rackLocation, {"Rack", 10, 8}, Categorical},
+    {BooksLanguage, "Language", &Book::language, {"Language", 12, 10}, Categorical},
+    {BooksAvailability, "Availability", &Book::availability, {"Avail", 8, 0}, Categorical},
+}};
+
+enum MembersColumn { MembersMemberID, MembersName, MembersEmail, MembersMembershipType, MembersColumnCount };
+constexpr TableSchema<Member, MembersColumnCount> membersTable = {"dbo.Members", "Members", {
+    {MembersMemberID, "MemberID", &Member::memberID, {"ID", 8, 0}, GeneratedKey},
+    {MembersName, "Name", &Member::name, {"Name", 30, 29}, Required},
+    {MembersEmail, "Email", &Member::email, {"Email", 30, 29}},
+    {MembersMembershipType, "MembershipType", &Member::membershipType, {"Type", 10, 0}, Categorical},
+}};
+
+enum TransactionsColumn { TransactionsTransactionID, TransactionsBookID, TransactionsMemberID, TransactionsIssueDate,
+                          TransactionsDueDate, TransactionsReturnDate, TransactionsStatus, TransactionsFineAmount,
+                          TransactionsColumnCount };
+constexpr TableSchema<Transaction, TransactionsColumnCount> transactionsTable = {"dbo.Transactions", "Transactions", {
+    {TransactionsTransactionID, "TransactionID", &Transaction::transactionID, {"ID", 8, 0}, GeneratedKey},
+    {TransactionsBookID, "BookID", &Transaction::bookID, {"BookID", 10, 0}},
+    {TransactionsMemberID, "MemberID", &Transaction::memberID, {"MemberID", 10, 0}},
+    {TransactionsIssueDate, "IssueDate", &Transaction::issueDate, {"IssueDate", 12, 0}},
+    {TransactionsDueDate, "DueDate", &Transaction::dueDate, {"DueDate", 12, 0}},
+    {TransactionsReturnDate, "ReturnDate", &Transaction::returnDate, {}},
+    {TransactionsStatus, "Status", &Transaction::status, {"Status", 10, 0}, Categorical},
+    {TransactionsFineAmount, "FineAmount", &Transaction::fineAmount, 2, {"Fine", 8, 0}, ZeroIfNull},
+}};
+
+static_assert(columnsInOrder(booksTable) && columnsInOrder(membersTable) && columnsInOrder(transactionsTable),
+              "schema columns must be declared in enumerator order");
+
+// Which of a table's columns a generated list names, and how.
+enum class ColumnList {
+    All,            // "BookID, Title, ..."
+    Insert,         // all but the generated key
+    Placeholders,   // "?, ?, ..." for Insert
+    View,           // the columns a view shows, ZeroIfNull ones wrapped in ISNULL
+};
+
+template <typename Row>
+constexpr bool listsColumn(const TableColumn<Row>& column, ColumnList list) {
+    switch (list) {
+        case ColumnList::All: return true;
+        case ColumnList::Insert: case ColumnList::Placeholders: return !(column.flags & GeneratedKey);
+        case ColumnList::View: return column.view.heading != nullptr;
+    }
+    return false;
+}
+
+constexpr size_t putSql(char* out, size_t at, const char* text) {
+    for (; *text; ++text, ++at) {
+        if (out) out[at] = *text;
+    }
+    return at;
+}
+
+// Writes the list to out, or with out null only measures it; returns its length.
+template <typename Row, size_t N>
+constexpr size_t writeColumnList(const TableSchema<Row, N>& schema, ColumnList list, char* out) {
+    size_t at = 0;
+    for (const TableColumn<Row>& column : schema.columns) {
+        if (!listsColumn(column, list)) continue;
+        if (at > 0) at = putSql(out, at, ", ");
+        if (list == ColumnList::Placeholders) {
+            at = putSql(out, at, "?");
+        } else if (list == ColumnList::View && (column.flags & ZeroIfNull)) {
+            at = putSql(out, putSql(out, putSql(out, putSql(out, at, "ISNULL("), column.name), ", 0) AS "), column.name);
+        } else {
+            at = putSql(out, at, column.name);
+        }
+    }
+    return at;
+}
+
+template <size_t Length, typename Schema>
+constexpr array<char, Length + 1> buildColumnList(const Schema& schema, ColumnList list) {
+    array<char, Length + 1> text{};
+    writeColumnList(schema, list, &text[0]);
+    return text;
+}
+
+template <typename Row, size_t N>
+constexpr size_t listedColumns(const TableSchema<Row, N>& schema, ColumnList list) {
+    size_t count = 0;
+    for (const TableColumn<Row>& column : schema.columns) count += listsColumn(column, list);
+    return count;
+}
+
+template <const auto& Schema, ColumnList List>
+struct ColumnListText {
+    static constexpr size_t length = writeColumnList(Schema, List, nullptr);
+    static constexpr array<char, length + 1> text = buildColumnList<length>(Schema, List);
+};
+
+// e.g. columnList<booksTable, ColumnList::Insert> is "Title, Authors, ..., Availability".
+template <const auto& Schema, ColumnList List>
+constexpr const char* columnList = ColumnListText<Schema, List>::text.data();
+
+// INSERT of the ColumnList::Insert columns, with an optional OUTPUT clause.
+template <const auto& Schema>
+string insertSql(const char* output = "") {
+    return string("INSERT INTO ") + Schema.table + " (" + columnList<Schema, ColumnList::Insert> + ") " + output + "VALUES (" +
+           columnList<Schema, ColumnList::Placeholders> + ")";
+}
+
+// "YYYY-MM-DD[ HH:MM:SS[.fff]]", as SQLite stores dates.
+DateTimeValue parseDateTime(string_view text) {
+    char buf[32];
+    size_t n = min(text.size(), sizeof(buf) - 1);
+    memcpy(buf, text.data(), n);
+    buf[n] = '\0';
+    DateTimeValue d;
+    int y = 0;
+    unsigned mo = 0, day = 0, h = 0, mi = 0, s = 0, ms = 0;
+    if (sscanf(buf, "%d-%u-%u", &y, &mo, &day) != 3) return d;
+    sscanf(buf, "%*d-%*u-%*u %u:%u:%u.%3u", &h, &mi, &s, &ms);
+    d.year = (short)y;
+    d.month = (unsigned short)mo;
+    d.day = (unsigned short)day;
+    d.hour = (unsigned short)h;
+    d.minute = (unsigned short)mi;
+    d.second = (unsigned short)s;
+    d.fraction = ms * 1000000;
+    return d;
+}
+
+string formatDateTime(const DateTimeValue& d) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%04d-%02u-%02u %02u:%02u:%02u.%03u", d.year, d.month, d.day, d.hour, d.minute, d.second,
+                     d.fraction / 1000000);
+    return string(buf, n);
+}
+
+// Cells read as the schema's type whatever type the backend reported (SQLite
+// keeps dates as text, and a DECIMAL holding a whole number comes back as an
+// integer). NULL reads as zero or empty.
+long long cellInt(const ResultSet& rs, size_t r, size_t c) {
+    if (rs.isNull(r, c)) return 0;
+    switch (rs.columns[c].type) {
+        case ColumnType::Int: return rs.intAt(r, c);
+        case ColumnType::Double: return llround(rs.doubleAt(r, c));
+        case ColumnType::Text: {
+            long long v = 0;
+            string_view s = rs.text(r, c);
+            from_chars(s.data(), s.data() + s.size(), v);
+            return v;
+        }
+        default: return 0;
+    }
+}
+
+double cellDouble(const ResultSet& rs, size_t r, size_t c) {
+    if (rs.isNull(r, c)) return 0.0;
+    switch (rs.columns[c].type) {
+        case ColumnType::Int: return (double)rs.intAt(r, c);
+        case ColumnType::Double: return rs.doubleAt(r, c);
+        case ColumnType::Text: {
+            double v = 0.0;
+            string_view s = rs.text(r, c);
+            from_chars(s.data(), s.data() + s.size(), v);
+            return v;
+        }
+        default: return 0.0;
+    }
+}
+
+DateTimeValue cellDate(const ResultSet& rs, size_t r, size_t c) {
+    if (rs.isNull(r, c)) return DateTimeValue();
+    if (rs.columns[c].type == ColumnType::Date) return rs.dateAt(r, c);
+    return parseDateTime(rs.text(r, c));
+}
+
+void cellText(const ResultSet& rs, size_t r, size_t c, string& out) {
+    if (rs.isNull(r, c)) out.clear();
+    else if (rs.columns[c].type == ColumnType::Text) out.assign(rs.text(r, c));
+    else out = rs.cellString(r, c);
+}
+
+// Binds row r of rs, selected with the table's ColumnList::All, to a typed row
+// (a Row, or a type that extends one, such as CachedBook).
+template <typename Row, size_t N, typename Target>
+void readRow(const TableSchema<Row, N>& schema, const ResultSet& rs, size_t r, Target& row) {
+    for (size_t i = 0; i < N; ++i) {
+        const TableColumn<Row>& column = schema.columns[i];
+        switch (column.type) {
+            case ColumnType::Int: row.*column.intField = (int)cellInt(rs, r, i); break;
+            case ColumnType::Double: row.*column.doubleField = cellDouble(rs, r, i); break;
+            case ColumnType::Date: row.*column.dateField = cellDate(rs, r, i); break;
+            case ColumnType::Text: cellText(rs, r, i, row.*column.textField); break;
+        }
+    }
+}
+
+// The row's values for the table's ColumnList::Insert placeholders.
+template <typename Row, size_t N, typename Target>
+vector<SqlParam> insertParams(const TableSchema<Row, N>& schema, const Target& row) {
+    vector<SqlParam> params;
+    for (const TableColumn<Row>& column : schema.columns) {
+        if (!listsColumn(column, ColumnList::Insert)) continue;
+        switch (column.type) {
+            case ColumnType::Int: params.emplace_back(row.*column.intField); break;
+            case ColumnType::Double: params.emplace_back(row.*column.doubleField); break;
+            case ColumnType::Date: params.emplace_back(formatDateTime(row.*column.dateField)); break;
+            case ColumnType::Text: params.emplace_back(row.*column.textField); break;
+        }
+    }
+    return params;
+}
+
+// Typed rows shown through the table's view, e.g. search results from a cache.
+template <typename Row, size_t N>
+void addViewColumns(const TableSchema<Row, N>& schema, ResultSet& rs) {
+    for (const TableColumn<Row>& column : schema.columns) {
+        if (column.view.heading) rs.addColumn(column.name, column.type, column.scale);
+    }
+}
+
+template <typename Row, size_t N, typename Target>
+void addViewRow(const TableSchema<Row, N>& schema, ResultSet& rs, const Target& row) {
+    ResultCell* cell = rs.appendRows(1);
+    for (const TableColumn<Row>& column : schema.columns) {
+        if (!column.view.heading) continue;
+        switch (column.type) {
+            case ColumnType::Int:
+                cell->intValue = row.*column.intField;
+                cell->null = 0;
+                break;
+            case ColumnType::Double:
+                cell->doubleValue = row.*column.doubleField;
+                cell->null = 0;
+                break;
+            case ColumnType::Date: rs.setDate(*cell, row.*column.dateField); break;
+            case ColumnType::Text: rs.setText(*cell, (row.*column.textField).data(), (row.*column.textField).size()); break;
+        }
+        ++cell;
+    }
+}
+
+// ---- Terminal rendering ----
+
+// Decodes the code point at p and advances p past it; malformed bytes decode as
+// U+FFFD one at a time.
+uint32_t nextCodePoint(const char*& p, const char* end) {
+    unsigned char c = *p++;
+    if (c < 0x80) return c;
+    size_t need = c >= 0xF0 && c <= 0xF4 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 && c < 0xE0 ? 1 : 0;
+    if (need == 0 || (size_t)(end - p) < need) return replacementChar;
+    uint32_t cp = c & (0x3F >> need);
+    for (size_t k = 0; k < need; ++k) {
+        if (((unsigned char)p[k] & 0xC0) != 0x80) return replacementChar;
+        cp = (cp << 6) | ((unsigned char)p[k] & 0x3F);
+    }
+    p += need;
+    return cp;
+}
+
+// Terminal columns taken by a code point: 0 for combining marks and joiners
+// (Devanagari vowel signs and virama among them), 2 for East Asian wide and emoji.
+int codePointWidth(uint32_t cp) {
+    static const uint32_t zeroWidth[][2] = {
+        {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C},
+        {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x200B, 0x200F}, {0xFE00, 0xFE0F},
+        {0xFE20, 0xFE2F},
+    };
+    static const uint32_t doubleWidth[][2] = {
+        {0x1100, 0x115F}, {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+        {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE30, 0xFE4F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F300, 0x1F64F},
+        {0x1F900, 0x1F9FF}, {0x20000, 0x3FFFD},
+    };
+    if (cp < 0x300) return cp >= 0x20 ? 1 : 0;
+    for (auto& r : zeroWidth) {
+        if (cp >= r[0] && cp <= r[1]) return 0;
+    }
+    for (auto& r : doubleWidth) {
+        if (cp >= r[0] && cp <= r[1]) return 2;
+    }
+    return 1;
+}
+
+// The longest prefix of text that fits in maxWidth terminal columns (all of it if
+// maxWidth is 0), with its width. Marks that follow the last character stay with it.
+string_view fitToWidth(string_view text, size_t maxWidth, size_t& width) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    width = 0;
+    while (p < end) {
+        const char* at = p;
+        int w = codePointWidth(nextCodePoint(p, end));
+        if (maxWidth && width + w > maxWidth) {
+            p = at;
+            break;
+        }
+        width += w;
+    }
+    return string_view(text.data(), p - text.data());
+}
+
+// How a kind of result is laid out on screen, declared once per view.
+struct ViewLayout {
+    const char* name;                   // plural, as in "No Books found."
+    vector<ViewColumn> columns;
+};
+
+// A table's view: the columns its schema gives a heading, in table order.
+template <typename Row, size_t N>
+ViewLayout viewLayout(const TableSchema<Row, N>& schema) {
+    ViewLayout view = {schema.name, {}};
+    for (const TableColumn<Row>& column : schema.columns) {
+        if (column.view.heading) view.columns.push_back(column.view);
+    }
+    return view;
+}
+
+const ViewLayout booksView = viewLayout(booksTable);
+const ViewLayout membersView = viewLayout(membersTable);
+const ViewLayout transactionsView = viewLayout(transactionsTable);
+const ViewLayout topBooksView = {"TopBooks", {{"BookID", 8, 0}, {"Title", 30, 29}, {"IssueCount", 12, 0}}};
+const ViewLayout activeMembersView = {"ActiveMembers", {{"MemberID", 10, 0}, {"Name", 30, 29}, {"BooksIssued", 15, 0}}};
+const ViewLayout finesView = {"Fines", {{"MemberID", 10, 0}, {"Name", 30, 29}, {"TotalFine", 15, 0}}};
+
+// Draws pager screens. A frame is formatted into a reused buffer and written with
+// one system call. On a terminal the previous frame is kept: lines that have not
+// changed are skipped and the rest are redrawn in place with ANSI cursor control,
+// so a page turn neither starts a `clear` process nor repaints the whole screen.
+// Piped output gets the plain text.
+class TerminalRenderer {
+public:
+    TerminalRenderer() {
+#ifdef _WIN32
+        console = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        ansi = GetConsoleMode(console, &mode) && SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else
+        ansi = isatty(STDOUT_FILENO) != 0;
+#endif
+        back.reserve(64 * 1024);
+        front.reserve(64 * 1024);
+        out.reserve(64 * 1024);
+    }
+
+    void begin() {
+        back.clear();
+        backLines.clear();
+    }
+    void line(string_view text) {
+        backLines.push_back(back.size());
+        back.append(text.data(), text.size());
+    }
+
+    void header(const ViewLayout& view) {
+        backLines.push_back(back.size());
+        size_t rule = 0;
+        for (const ViewColumn& c : view.columns) {
+            appendPadded(c.heading, c.width, 0);
+            rule += c.width;
+        }
+        trimLine();
+        line(string(rule, '-'));
+    }
+
+    void row(const ViewLayout& view, const ResultSet& data, size_t r) {
+        if (data.columnCount() < view.columns.size()) {
+            line("Warning: Row " + to_string(r) + " has incomplete data.");
+            return;
+        }
+        backLines.push_back(back.size());
+        char buf[64];
+        for (size_t c = 0; c < view.columns.size(); ++c) {
+            appendPadded(data.cell(r, c, buf, sizeof(buf)), view.columns[c].width, view.columns[c].clip);
+        }
+        trimLine();
+    }
+
+    // Shows the frame; the last line is a prompt and the cursor is left after it.
+    void present() {
+        cout.flush();
+        fflush(stdout);
+        out.clear();
+        size_t lines = backLines.size();
+        bool fits = ansi && lines + 1 < terminalRows();
+        if (!ansi) {
+            for (size_t i = 0; i < lines; ++i) {
+                out += '\n';
+                out.append(lineAt(back, backLines, i));
+            }
+        } else if (!drawn || !fits) {
+            // First frame, or one tall enough to scroll: no line can be trusted.
+            out = "\x1b[H\x1b[2J";
+            for (size_t i = 0; i < lines; ++i) {
+                if (i) out += '\n';
+                out.append(lineAt(back, backLines, i));
+            }
+        } else {
+            // The prompt line is always redrawn, since it holds the last answer typed.
+            for (size_t i = 0; i < lines; ++i) {
+                string_view text = lineAt(back, backLines, i);
+                if (i + 1 < lines && i < frontLines.size() && text == lineAt(front, frontLines, i)) continue;
+                out += "\x1b[" + to_string(i + 1) + ";1H";
+                out.append(text.data(), text.size());
+                out += "\x1b[K";
+            }
+            out += "\x1b[J";
+        }
+        writeOut();
+        drawn = fits;
+        swap(front, back);
+        swap(frontLines, backLines);
+    }
+
+    // After other output (a prompt, an error) the screen no longer matches the last frame.
+    void invalidate() { drawn = false; }
+
+private:
+    void appendPadded(string_view value, size_t width, size_t clip) {
+        size_t shown = 0;
+        value = fitToWidth(value, clip, shown);
+        back.append(value.data(), value.size());
+        if (shown < width) back.append(width - shown, ' ');
+    }
+    void trimLine() {
+        while (back.size() > backLines.back() && back.back() == ' ') back.pop_back();
+    }
+
+    static string_view lineAt(const string& buf, const vector<size_t>& starts, size_t i) {
+        size_t end = i + 1 < starts.size() ? starts[i + 1] : buf.size();
+        return string_view(buf.data() + starts[i], end - starts[i]);
+    }
+
+    size_t terminalRows() const {
+#ifdef _WIN32
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        if (GetConsoleScreenBufferInfo(console, &info)) return info.srWindow.Bottom - info.srWindow.Top + 1;
+#else
+        winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0) return size.ws_row;
+#endif
+        return 24;
+    }
+
+    void writeOut() {
+        const char* p = out.data();
+        size_t left = out.size();
+        while (left > 0) {
+#ifdef _WIN32
+            DWORD n = 0;
+            if (!WriteFile(console, p, (DWORD)left, &n, nullptr) || n == 0) return;
+#else
+            ssize_t n = ::write(STDOUT_FILENO, p, left);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+#endif
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+
+    string back, front, out;
+    vector<size_t> backLines, frontLines;  // where each line starts
+    bool ansi = false;
+    bool drawn = false;                    // the screen shows front, line for line
+#ifdef _WIN32
+    HANDLE console;
+#endif
+};
+
+// Draws rows [start, end) of data under view, then the pager prompt.
+void drawPage(TerminalRenderer& screen, const ViewLayout& view, const ResultSet& data, size_t start, size_t end, const string& position) {
+    screen.begin();
+    screen.header(view);
+    for (size_t r = start; r < end; ++r) screen.row(view, data, r);
+    screen.line("");
+    screen.line(position + " | [N]ext, [P]revious, [S]ize, [Q]uit: ");
+    screen.present();
+}
+
+// Rows per screen in paged views; set with --page-size or [S] in the pager.
+int viewPageSize = 5;
+
+bool promptPageSize() {
+    int size;
+    cout << "Rows per page: ";
+    if (cin >> size && size > 0 && size <= 1000) {
+        viewPageSize = size;
+        return true;
+    }
+    cin.clear();
+    cin.ignore(10000, '\n');
+    cout << "Page size must be between 1 and 1000." << endl;
+    return false;
+}
+
+// Pages through a result that is already in memory (e.g. a search answered from an index).
+void showPaginated(const ResultSet& data, const ViewLayout& view) {
+    if (data.empty()) {
+        cout << "No " << view.name << " found." << endl;
+        return;
+    }
+
+    TerminalRenderer screen;
+    int page = 0;
+    char choice;
+
+    do {
+        int pageSize = viewPageSize;
+        int start = page * pageSize;
+        int end = min(start + pageSize, static_cast<int>(data.size()));
+        int totalPages = (data.size() + pageSize - 1) / pageSize;
+        drawPage(screen, view, data, start, end, "Page " + to_string(page + 1) + " of " + to_string(totalPages));
+
+        cin >> choice;
+        choice = toupper(choice);
+        cin.ignore(10000, '\n');  // clear input buffer after reading choice
+
+        if (choice == 'N' && end < static_cast<int>(data.size()))
+            ++page;
+        else if (choice == 'P' && page > 0)
+            --page;
+        else if (choice == 'S') {
+            screen.invalidate();
+            if (promptPageSize()) page = start / viewPageSize;
+        }
+
+    } while (choice != 'Q');
+
+    cout << "Exiting view. Press Enter to continue...";
+    cin.ignore();
+    cin.get();
+}
+
+// A query the pager can fetch one page at a time. With keyColumn set, pages are
+// keyset seeks on that integer column (key > last key of the previous page), so
+// page 1000 costs the same as page 1. Aggregates with no usable key fall back to
+// OFFSET/FETCH over orderBy, which must give a total order.
+struct PageQuery {
+    string columns;               // select list
+    string from;                  // table or join
+    string where;                 // optional filter, may use ? params
+    vector<SqlParam> params;      // for where
+    string groupBy;               // optional
+    string keyColumn;             // e.g. "BookID"; empty for OFFSET/FETCH
+    size_t keyIndex = 0;          // position of keyColumn in the select list
+    bool descending = false;      // key order
+    string orderBy;               // used only without keyColumn
+};
+
+const size_t pagerCachedPages = 8;
+
+// Fetches pages of a PageQuery on demand, prefetches the next page in the
+// background while the current one is on screen, and keeps the last few pages
+// visited so [P]revious does not go back to the server.
+class LazyPager {
+public:
+    LazyPager(PageQuery query, size_t pageSize) : query(move(query)), pageSize(pageSize) {}
+
+    ~LazyPager() {
+        if (pending.valid()) pending.wait();
+    }
+
+    // Page n, or nullptr past the end. Pages must be reached in order from 0
+    // (as N/P do), since a keyset seek needs the previous page's last key.
+    shared_ptr<const ResultSet> page(size_t n) {
+        if (n > 0 && !reachable(n)) return nullptr;
+        for (auto it = recent.begin(); it != recent.end(); ++it) {
+            if (it->first == n) {
+                recent.splice(recent.begin(), recent, it);
+                return recent.front().second;
+            }
+        }
+
+        shared_ptr<const ResultSet> result;
+        if (pending.valid() && pendingPage == n) {
+            result = pending.get();
+        } else {
+            if (pending.valid()) pending.wait();
+            result = fetch(n);
+        }
+        remember(n, result);
+        recent.emplace_front(n, result);
+        if (recent.size() > pagerCachedPages) recent.pop_back();
+        return result->empty() && n > 0 ? nullptr : result;
+    }
+
+    // Starts fetching page n + 1 while page n is being read.
+    void prefetchAfter(size_t n) {
+        if (pending.valid() || !reachable(n + 1)) return;
+        for (auto& entry : recent) {
+            if (entry.first == n + 1) return;
+        }
+        pendingPage = n + 1;
+        pending = queryPool.submit([this, next = n + 1] { return fetch(next); });
+    }
+
+    // True once we know page n is the final one.
+    bool isLast(size_t n) const { return lastPage >= 0 && (long long)n >= lastPage; }
+
+    long long knownLastPage() const { return lastPage; }
+
+private:
+    bool reachable(size_t n) const {
+        if (isLast(n - 1)) return false;
+        return query.keyColumn.empty() || n - 1 < endKeys.size();
+    }
+
+    shared_ptr<const ResultSet> fetch(size_t n) const {
+        string sql;
+        vector<SqlParam> params;
+        if (!query.keyColumn.empty()) {
+            sql = "SELECT TOP (?) " + query.columns + " FROM " + query.from;
+            params.push_back((int)pageSize);
+            string cond = query.where;
+            params.insert(params.end(), query.params.begin(), query.params.end());
+            if (n > 0) {
+                if (!cond.empty()) cond = "(" + cond + ") AND ";
+                cond += query.keyColumn + (query.descending ? " < ?" : " > ?");
+                params.push_back(keyAfter(n - 1));
+            }
+            if (!cond.empty()) sql += " WHERE " + cond;
+            if (!query.groupBy.empty()) sql += " GROUP BY " + query.groupBy;
+            sql += " ORDER BY " + query.keyColumn + (query.descending ? " DESC" : "");
+        } else {
+            sql = "SELECT " + query.columns + " FROM " + query.from;
+            if (!query.where.empty()) sql += " WHERE " + query.where;
+            if (!query.groupBy.empty()) sql += " GROUP BY " + query.groupBy;
+            sql += " ORDER BY " + query.orderBy + " OFFSET ? ROWS FETCH NEXT ? ROWS ONLY";
+            params = query.params;
+            params.push_back((int)(n * pageSize));
+            params.push_back((int)pageSize);
+        }
+        return make_shared<ResultSet>(fetchResultSet(sql, params));
+    }
+
+    int keyAfter(size_t n) const {
+        lock_guard<mutex> lock(keysMutex);
+        return endKeys[n];
+    }
+
+    void remember(size_t n, const shared_ptr<const ResultSet>& rs) {
+        if (rs->size() < pageSize) lastPage = rs->empty() && n > 0 ? (long long)n - 1 : (long long)n;
+        if (query.keyColumn.empty() || rs->empty()) return;
+        size_t last = rs->size() - 1;
+        int key = rs->columns[query.keyIndex].type == ColumnType::Int ? (int)rs->intAt(last, query.keyIndex)
+                                                                      : atoi(rs->cellString(last, query.keyIndex).c_str());
+        lock_guard<mutex> lock(keysMutex);
+        if (endKeys.size() == n) endKeys.push_back(key);
+    }
+
+    PageQuery query;
+    size_t pageSize;
+    list<pair<size_t, shared_ptr<const ResultSet>>> recent;  // most recent first
+    future<shared_ptr<const ResultSet>> pending;
+    size_t pendingPage = 0;
+    mutable mutex keysMutex;
+    vector<int> endKeys;       // last key of each page seen, for seeking to the next
+    long long lastPage = -1;   // -1 until the end has been seen
+};
+
+// Pages through a query without loading it all: rows are fetched a page at a time.
+void showPaged(const PageQuery& query, const ViewLayout& view) {
+    unique_ptr<LazyPager> pager(new LazyPager(query, viewPageSize));
+    auto first = pager->page(0);
+    if (!first || first->empty()) {
+        cout << "No " << view.name << " found." << endl;
+        return;
+    }
+
+    TerminalRenderer screen;
+    size_t page = 0;
+    char choice;
+
+    do {
+        auto rows = pager->page(page);
+        pager->prefetchAfter(page);
+
+        string position = "Page " + to_string(page + 1);
+        if (pager->knownLastPage() >= 0) position += " of " + to_string(pager->knownLastPage() + 1);
+        drawPage(screen, view, *rows, 0, rows->size(), position);
+
+        cin >> choice;
+        choice = toupper(choice);
+        cin.ignore(10000, '\n');  // clear input buffer after reading choice
+
+        if (choice == 'N' && !pager->isLast(page) && pager->page(page + 1))
+            ++page;
+        else if (choice == 'P' && page > 0)
+            --page;
+        else if (choice == 'S') {
+            screen.invalidate();
+            if (promptPageSize()) {
+                // Page boundaries move with the size, so start over from the top.
+                pager.reset(new LazyPager(query, viewPageSize));
+                page = 0;
+            }
+        }
+
+    } while (choice != 'Q');
+
+    cout << "Exiting view. Press Enter to continue...";
+    cin.ignore();
+    cin.get();
+}
+
+const chrono::minutes configTtl(5);
+
+// Process-wide Config, loaded at startup and re-read after configTtl or on an
+// admin reload. Each load publishes a new immutable Config through an atomic
+// pointer, so readers never take a lock. Superseded versions are kept rather than
+// freed (the values change about once a year), so a reference never dangles.
+class ConfigService {
+public:
+    ConfigService() {
+        versions.push_back(make_unique<Config>());
+        published.store(versions.back().get());
+    }
+
+    const Config& current() {
+        if (chrono::steady_clock::now().time_since_epoch().count() >= expiresAt.load(memory_order_relaxed)) refresh(false);
+        return *published.load(memory_order_acquire);
+    }
+
+    // Re-reads dbo.Config now. On failure the previous values stay published.
+    bool reload() { return refresh(true); }
+
+    void printStats() {
+        lock_guard<mutex> lock(loadMutex);
+        const Config& c = *published.load(memory_order_acquire);
+        cout << "Config:            fine " << c.fineRate << "/day, max " << c.maxBooksPerMember << " books, "
+             << c.reservationDurationDays << " day loans" << endl;
+        cout << "Config loads:      " << loads << " (" << failures << " failed, " << changes << " changed values), last "
+             << lastLoadMs << " ms, avg " << (loads ? totalLoadMs / loads : 0.0) << " ms" << endl;
+    }
+
+private:
+    bool refresh(bool force) {
+        unique_lock<mutex> lock(loadMutex, defer_lock);
+        if (force) {
+            lock.lock();
+        } else if (!lock.try_lock()) {
+            return true;  // another thread is loading; keep serving the current values
+        }
+        auto start = chrono::steady_clock::now();
+        if (!force && start.time_since_epoch().count() < expiresAt.load(memory_order_relaxed)) return true;
+
+        ResultSet rs;
+        bool ok = withConnection([&](StorageConnection& conn) {
+            rs = ResultSet();
+            return conn.fetch("SELECT FineRate, MaxBooksPerMember, ReservationDurationDays FROM dbo.Config WHERE ConfigID = 1", {}, rs);
+        }, ConnectionRetry::Idempotent);
+        auto end = chrono::steady_clock::now();
+        lastLoadMs = chrono::duration<double, milli>(end - start).count();
+        totalLoadMs += lastLoadMs;
+        loads++;
+        expiresAt.store((end + configTtl).time_since_epoch().count(), memory_order_relaxed);
+        if (!ok) {
+            failures++;
+            return false;
+        }
+
+        // No row means the defaults, as before.
+        Config next;
+        if (!rs.empty()) {
+            next.fineRate = numberAt(rs, 0, next.fineRate);
+            next.maxBooksPerMember = (int)numberAt(rs, 1, next.maxBooksPerMember);
+            next.reservationDurationDays = (int)numberAt(rs, 2, next.reservationDurationDays);
+        }
+        const Config& prev = *published.load(memory_order_relaxed);
+        if (next.fineRate != prev.fineRate || next.maxBooksPerMember != prev.maxBooksPerMember ||
+            next.reservationDurationDays != prev.reservationDurationDays) {
+            if (loads > 1) changes++;
+            versions.push_back(make_unique<Config>(next));
+            published.store(versions.back().get(), memory_order_release);
+        }
+        return true;
+    }
+
+    static double numberAt(const ResultSet& rs, size_t col, double fallback) {
+        if (rs.isNull(0, col)) return fallback;
+        switch (rs.columns[col].type) {
+            case ColumnType::Int: return (double)rs.intAt(0, col);
+            case ColumnType::Double: return rs.doubleAt(0, col);
+            default: return atof(rs.cellString(0, col).c_str());
+        }
+    }
+
+    atomic<const Config*> published{nullptr};
+    atomic<long long> expiresAt{0};  // steady_clock ticks
+    mutex loadMutex;                 // guards everything below
+    vector<unique_ptr<Config>> versions;
+    size_t loads = 0, failures = 0, changes = 0;
+    double lastLoadMs = 0, totalLoadMs = 0;
+};
+ConfigService configService;
+
+void reloadConfig() {
+    bool ok = configService.reload();
+    cout << (ok ? "Config reloaded." : "Config reload failed; keeping the previous values.") << endl;
+    cout << fixed << setprecision(2);
+    configService.printStats();
+    cout.unsetf(ios::floatfield);
+}
+
+// ISBN comparisons on the server are case-insensitive and ignore trailing spaces.
+string normalizeIsbn(string_view isbn) {
+    while (!isbn.empty() && isbn.back() == ' ') isbn.remove_suffix(1);
+    string key(isbn);
+    transform(key.begin(), key.end(), key.begin(), ::toupper);
+    return key;
+}
+
+// Parses a validated all-digit ID string; false if it does not fit in an int.
+bool parseId(const string& text, int& id) {
+    auto result = from_chars(text.data(), text.data() + text.size(), id);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+bool parseCount(const string& text, size_t& count) {
+    auto result = from_chars(text.data(), text.data() + text.size(), count);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+// Inverted index from lower-cased trigrams to document IDs, used to answer
+// substring searches (the old LIKE '%x%') without scanning every row. Each
+// document is a few text fields, e.g. a book's title and authors; field 0 ranks
+// highest. Not thread-safe: the owner guards it with its own lock.
+class TrigramIndex {
+public:
+    void set(int docId, vector<string> fields) {
+        remove(docId);
+        for (auto& field : fields) field = lowerAscii(field);
+        for (uint32_t gram : trigramsOf(fields)) {
+            auto& list = postings[gram];
+            list.insert(lower_bound(list.begin(), list.end(), docId), docId);
+        }
+        docs[docId] = move(fields);
+    }
+
+    void remove(int docId) {
+        auto it = docs.find(docId);
+        if (it == docs.end()) return;
+        for (uint32_t gram : trigramsOf(it->second)) {
+            auto& list = postings[gram];
+            auto pos = lower_bound(list.begin(), list.end(), docId);
+            if (pos != list.end() && *pos == docId) list.erase(pos);
+            if (list.empty()) postings.erase(gram);
+        }
+        docs.erase(it);
+    }
+
+    void clear() {
+        docs.clear();
+        postings.clear();
+    }
+
+    // IDs of documents with the query as a substring of any field (ASCII
+    // case-insensitive), best matches first: earlier fields, matches at the
+    // start of the field or of a word, then shorter fields.
+    vector<int> search(const string& query) const {
+        string needle = lowerAscii(query);
+        vector<int> candidates;
+        if (needle.size() < 3) {
+            for (auto& entry : docs) candidates.push_back(entry.first);
+        } else {
+            vector<const vector<int>*> lists;
+            for (size_t i = 0; i + 3 <= needle.size(); ++i) {
+                auto it = postings.find(pack(needle, i));
+                if (it == postings.end()) return {};
+                lists.push_back(&it->second);
+            }
+            sort(lists.begin(), lists.end(), [](auto* a, auto* b) { return a->size() < b->size(); });
+            candidates = *lists[0];
+            vector<int> next;
+            for (size_t l = 1; l < lists.size() && !candidates.empty(); ++l) {
+                next.clear();
+                set_intersection(candidates.begin(), candidates.end(), lists[l]->begin(), lists[l]->end(), back_inserter(next));
+                candidates.swap(next);
+            }
+        }
+
+        // Trigrams only prove the pieces are present; confirm the whole substring and score it.
+        vector<pair<long, int>> scored;
+        for (int docId : candidates) {
+            const auto& fields = docs.at(docId);
+            long best = -1;
+            for (size_t f = 0; f < fields.size(); ++f) {
+                size_t pos = fields[f].find(needle);
+                if (pos == string::npos) continue;
+                long score = (long)(fields.size() - f) * 1000000;
+                if (pos == 0) score += 500000;
+                else if (!isalnum((unsigned char)fields[f][pos - 1])) score += 250000;
+                score -= (long)min<size_t>(fields[f].size(), 200000);
+                best = max(best, score);
+            }
+            if (best >= 0) scored.emplace_back(best, docId);
+        }
+        sort(scored.begin(), scored.end(), [](auto& a, auto& b) { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+        vector<int> result;
+        result.reserve(scored.size());
+        for (auto& s : scored) result.push_back(s.second);
+        return result;
+    }
+
+    size_t size() const { return docs.size(); }
+
+private:
+    static string lowerAscii(string s) {
+        for (char& c : s) {
+            if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+        }
+        return s;
+    }
+    static uint32_t pack(const string& s, size_t i) {
+        return (uint32_t)(unsigned char)s[i] << 16 | (uint32_t)(unsigned char)s[i + 1] << 8 | (unsigned char)s[i + 2];
+    }
+    static vector<uint32_t> trigramsOf(const vector<string>& fields) {
+        vector<uint32_t> grams;
+        for (auto& field : fields) {
+            for (size_t i = 0; i + 3 <= field.size(); ++i) grams.push_back(pack(field, i));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    unordered_map<int, vector<string>> docs;
+    unordered_map<uint32_t, vector<int>> postings;
+};
+
+// A catalogue row and the BINARY_CHECKSUM of it that the change poll compares.
+struct CachedBook : Book {
+    int checksum = 0;
+};
+
+const string bookChecksumSql = string("BINARY_CHECKSUM(") + columnList<booksTable, ColumnList::All> + ")";
+const string bookCacheColumns = string(columnList<booksTable, ColumnList::All>) + ", " + bookChecksumSql;
+const string bookCacheSelect = "SELECT " + bookCacheColumns + " FROM " + booksTable.table;
+const string bookInsertSql = insertSql<booksTable>();
+const string memberSelect = string("SELECT ") + columnList<membersTable, ColumnList::All> + " FROM " + membersTable.table;
+
+// The change-detection query a cache polls: the row count and an aggregate of
+// every row's checksum. A snapshot records the answers at export time so it can
+// be checked against the live database.
+template <const auto& Schema>
+string summarySql() {
+    return string("SELECT COUNT(*), ISNULL(CHECKSUM_AGG(BINARY_CHECKSUM(") + columnList<Schema, ColumnList::All> + ")), 0) FROM " +
+           Schema.table;
+}
+const string bookSummarySql = summarySql<booksTable>();
+const string memberSummarySql = summarySql<membersTable>();
+const string transactionSummarySql = summarySql<transactionsTable>();
+
+// True when the library is served read-only from a snapshot with no database.
+bool offlineMode = false;
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    ~MappedFile() { close(); }
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping) return false;
+        bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        length = bytes ? (size_t)size.QuadPart : 0;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        bytes = (const uint8_t*)p;
+        length = (size_t)st.st_size;
+#endif
+        return bytes != nullptr;
+    }
+
+    void close() {
+        if (!bytes) return;
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+#else
+        munmap((void*)bytes, length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+};
+
+// Snapshot file layout (little-endian, every section 8-byte aligned):
+//   SnapshotFileHeader, then Books, Members and Transactions, each a
+//   SnapshotTableHeader followed by its columns. A column is a
+//   SnapshotColumnHeader, a null bitmap when flagged nullable, and its data:
+//     DeltaInt   zigzag varint differences from the previous row (IDs, dates as
+//                epoch milliseconds, money in hundredths)
+//     PlainText  uint32 offsets[rows + 1], then the bytes
+//     DictText   uint32 count, uint32 offsets[count + 1], the bytes, padded
+//                to a multiple of 4, then one uint16 (or uint32 if wide) code per row
+// Strings are read in place from the mapping; only the integers are decoded.
+const char snapshotMagic[8] = {'L', 'I', 'B', 'S', 'N', 'A', 'P', 0};
+const uint32_t snapshotVersion = 1;
+
+enum class SnapshotEncoding : uint32_t { DeltaInt = 1, PlainText = 2, DictText = 3 };
+const uint32_t snapshotNullable = 1, snapshotDate = 2, snapshotHundredths = 4, snapshotWideCodes = 8;
+
+struct SnapshotFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tableCount;
+    int64_t createdUnix;
+    char backend[32];
+};
+struct SnapshotTableHeader {
+    uint32_t columnCount;
+    uint32_t reserved;
+    uint64_t rows;
+    int64_t liveCount;     // the summary query's answer when exported
+    int64_t liveChecksum;
+    uint64_t bytes;        // columns, not counting this header
+};
+struct SnapshotColumnHeader {
+    uint32_t encoding;
+    uint32_t flags;
+    int32_t scale;         // display scale of the source column, as in ResultColumn
+    uint32_t reserved;
+    uint64_t bytes;        // bitmap and data, including padding
+};
+static_assert(sizeof(SnapshotFileHeader) == 56 && sizeof(SnapshotTableHeader) == 40 && sizeof(SnapshotColumnHeader) == 24,
+              "snapshot headers are written as-is");
+
+// Snapshot dates are milliseconds since 1970-01-01.
+DateTimeValue snapshotDateTime(int64_t millis) {
+    long long days = millis >= 0 ? millis / 86400000 : -((-millis + 86399999) / 86400000);
+    long long ms = millis - days * 86400000;
+    int y;
+    unsigned m, d;
+    civilFromDays(days, y, m, d);
+    DateTimeValue v;
+    v.year = (short)y;
+    v.month = (unsigned short)m;
+    v.day = (unsigned short)d;
+    v.hour = (unsigned short)(ms / 3600000);
+    v.minute = (unsigned short)(ms / 60000 % 60);
+    v.second = (unsigned short)(ms / 1000 % 60);
+    v.fraction = (unsigned)(ms % 1000) * 1000000;
+    return v;
+}
+
+// One column of a loaded snapshot.
+struct SnapshotColumn {
+    uint32_t flags = 0;
+    int32_t scale = 0;
+    vector<int64_t> ints;
+    vector<string_view> texts;  // into the mapping
+    vector<uint8_t> nulls;      // empty when the column has none
+
+    bool isNull(size_t row) const { return !nulls.empty() && nulls[row]; }
+
+    // The value as ResultSet::cellString() renders the live column.
+    string render(size_t row) const {
+        if (isNull(row)) return "NULL";
+        if (!texts.empty()) return string(texts[row]);
+        int64_t v = ints[row];
+        char buf[40];
+        if (flags & snapshotDate) {
+            return formatDateTime(snapshotDateTime(v));
+        } else if (flags & snapshotHundredths) {
+            if (scale > 0) snprintf(buf, sizeof(buf), "%.*f", scale, v / 100.0);
+            else snprintf(buf, sizeof(buf), "%.15g", v / 100.0);
+        } else {
+            snprintf(buf, sizeof(buf), "%lld", (long long)v);
+        }
+        return buf;
+    }
+};
+
+struct SnapshotTable {
+    size_t rows = 0;
+    long long liveCount = 0, liveChecksum = 0;
+    vector<SnapshotColumn> columns;
+};
+
+// Snapshot tables hold their schema's columns in order; books are followed by
+// the row checksum the catalogue compares.
+const size_t snapshotBookChecksum = BooksColumnCount;
+
+// Row r of a snapshot table as a typed row, the way readRow() binds a live one.
+template <typename Row, size_t N, typename Target>
+void readSnapshotRow(const TableSchema<Row, N>& schema, const SnapshotTable& table, size_t r, Target& row) {
+    for (size_t i = 0; i < N; ++i) {
+        const TableColumn<Row>& column = schema.columns[i];
+        const SnapshotColumn& c = table.columns[i];
+        bool null = c.isNull(r);
+        switch (column.type) {
+            case ColumnType::Int: row.*column.intField = null ? 0 : (int)c.ints[r]; break;
+            case ColumnType::Double: row.*column.doubleField = null ? 0.0 : c.ints[r] / 100.0; break;
+            case ColumnType::Date: row.*column.dateField = null ? DateTimeValue() : snapshotDateTime(c.ints[r]); break;
+            case ColumnType::Text:
+                if (null) (row.*column.textField).clear();
+                else (row.*column.textField).assign(c.texts[r]);
+                break;
+        }
+    }
+}
+
+// A snapshot table laid out as its view shows it.
+template <typename Row, size_t N>
+ResultSet snapshotView(const TableSchema<Row, N>& schema, const SnapshotTable& table) {
+    ResultSet rs;
+    addViewColumns(schema, rs);
+    Row row;
+    for (size_t r = 0; r < table.rows; ++r) {
+        readSnapshotRow(schema, table, r, row);
+        addViewRow(schema, rs, row);
+    }
+    return rs;
+}
+
+// A snapshot file mapped into memory and decoded.
+class Snapshot {
+public:
+    SnapshotTable books, members, transactions;
+    time_t created = 0;
+    string backend;
+
+    bool open(const string& path, string& error) {
+        if (!file.open(path)) {
+            error = "cannot map " + path;
+            return false;
+        }
+        const uint8_t* p = file.data();
+        const uint8_t* end = p + file.size();
+        SnapshotFileHeader header;
+        if (!take(p, end, header) || memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+            error = path + " is not a library snapshot";
+            return false;
+        }
+        if (header.version != snapshotVersion || header.tableCount != 3) {
+            error = "snapshot version " + to_string(header.version) + " is not supported (expected " + to_string(snapshotVersion) + ")";
+            return false;
+        }
+        created = (time_t)header.createdUnix;
+        backend.assign(header.backend, strnlen(header.backend, sizeof(header.backend)));
+        for (SnapshotTable* table : {&books, &members, &transactions}) {
+            if (!readTable(p, end, *table)) {
+                error = path + " is truncated or corrupt";
+                return false;
+            }
+        }
+        if (books.columns.size() != BooksColumnCount + 1 || members.columns.size() != MembersColumnCount ||
+            transactions.columns.size() != TransactionsColumnCount) {
+            error = path + " has an unexpected column layout";
+            return false;
+        }
+        return true;
+    }
+
+    // Reads back one column as SnapshotColumnBuilder::encode() wrote it.
+    static bool decodeColumn(const string& bytes, size_t rows, SnapshotColumn& column) {
+        const uint8_t* p = (const uint8_t*)bytes.data();
+        const uint8_t* end = p + bytes.size();
+        SnapshotColumnHeader ch;
+        if (!take(p, end, ch) || ch.bytes != (uint64_t)(end - p)) return false;
+        return readColumn(p, end, ch, rows, column);
+    }
+
+private:
+    template <typename T>
+    static bool take(const uint8_t*& p, const uint8_t* end, T& out) {
+        if ((size_t)(end - p) < sizeof(T)) return false;
+        memcpy(&out, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    static bool readTable(const uint8_t*& p, const uint8_t* end, SnapshotTable& table) {
+        SnapshotTableHeader header;
+        if (!take(p, end, header) || header.bytes > (uint64_t)(end - p)) return false;
+        table.rows = (size_t)header.rows;
+        table.liveCount = header.liveCount;
+        table.liveChecksum = header.liveChecksum;
+        table.columns.resize(header.columnCount);
+        const uint8_t* tableEnd = p + header.bytes;
+        for (SnapshotColumn& column : table.columns) {
+            SnapshotColumnHeader ch;
+            if (!take(p, tableEnd, ch) || ch.bytes > (uint64_t)(tableEnd - p)) return false;
+            const uint8_t* next = p + ch.bytes;
+            if (!readColumn(p, next, ch, table.rows, column)) return false;
+            p = next;
+        }
+        p = tableEnd;
+        return true;
+    }
+
+    static bool readColumn(const uint8_t* p, const uint8_t* end, const SnapshotColumnHeader& ch, size_t rows, SnapshotColumn& column) {
+        column.flags = ch.flags;
+        column.scale = ch.scale;
+        if (ch.flags & snapshotNullable) {
+            size_t bitmapBytes = (rows + 7) / 8;
+            if ((size_t)(end - p) < bitmapBytes) return false;
+            column.nulls.resize(rows);
+            for (size_t r = 0; r < rows; ++r) column.nulls[r] = (p[r / 8] >> (r % 8)) & 1;
+            p += bitmapBytes;
+        }
+        switch ((SnapshotEncoding)ch.encoding) {
+            case SnapshotEncoding::DeltaInt: {
+                column.ints.resize(rows);
+                int64_t value = 0;
+                for (size_t r = 0; r < rows; ++r) {
+                    uint64_t zigzag = 0;
+                    for (int shift = 0;; shift += 7) {
+                        if (p == end || shift > 63) return false;
+                        uint8_t byte = *p++;
+                        zigzag |= (uint64_t)(byte & 0x7F) << shift;
+                        if (!(byte & 0x80)) break;
+                    }
+                    value += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+                    column.ints[r] = value;
+                }
+                return true;
+            }
+            case SnapshotEncoding::PlainText: {
+                const uint8_t* offsets = p;
+                if ((size_t)(end - p) < (rows + 1) * 4) return false;
+                const char* text = (const char*)(p + (rows + 1) * 4);
+                size_t textBytes = (size_t)(end - (const uint8_t*)text);
+                column.texts.resize(rows);
+                uint32_t from, to;
+                memcpy(&from, offsets, 4);
+                for (size_t r = 0; r < rows; ++r) {
+                    memcpy(&to, offsets + (r + 1) * 4, 4);
+                    if (to < from || to > textBytes) return false;
+                    column.texts[r] = string_view(text + from, to - from);
+                    from = to;
+                }
+                return true;
+            }
+            case SnapshotEncoding::DictText: {
+                uint32_t count;
+                if (!take(p, end, count) || (size_t)(end - p) / 4 < (size_t)count + 1) return false;
+                const uint8_t* offsets = p;
+                const char* text = (const char*)(p + ((size_t)count + 1) * 4);
+                uint32_t textBytes;
+                memcpy(&textBytes, offsets + (size_t)count * 4, 4);
+                if ((size_t)(end - (const uint8_t*)text) < textBytes) return false;
+                vector<string_view> dict(count);
+                for (uint32_t i = 0; i < count; ++i) {
+                    uint32_t from, to;
+                    memcpy(&from, offsets + (size_t)i * 4, 4);
+                    memcpy(&to, offsets + ((size_t)i + 1) * 4, 4);
+                    if (to < from || to > textBytes) return false;
+                    dict[i] = string_view(text + from, to - from);
+                }
+                const uint8_t* codes = (const uint8_t*)text + ((textBytes + 3) & ~3u);
+                size_t width = (ch.flags & snapshotWideCodes) ? 4 : 2;
+                if (codes > end || (size_t)(end - codes) < rows * width) return false;
+                column.texts.resize(rows);
+                for (size_t r = 0; r < rows; ++r) {
+                    uint32_t code = 0;
+                    memcpy(&code, codes + r * width, width);
+                    if (code >= count) return false;
+                    column.texts[r] = dict[code];
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    MappedFile file;
+};
+
+// Collects one column while a table streams in, then encodes it.
+struct SnapshotColumnBuilder {
+    SnapshotEncoding encoding;
+    uint32_t flags = 0;  // snapshotDate / snapshotHundredths; nullable is worked out here
+    int32_t scale = 0;
+    vector<int64_t> ints;
+    vector<string> texts;
+    vector<uint8_t> nulls;
+    bool anyNull = false;
+
+    SnapshotColumnBuilder(SnapshotEncoding encoding, uint32_t flags) : encoding(encoding), flags(flags) {}
+
+    void add(const ResultSet& block, size_t row, size_t col) {
+        bool null = block.isNull(row, col);
+        nulls.push_back(null);
+        anyNull |= null;
+        if (encoding != SnapshotEncoding::DeltaInt) {
+            texts.push_back(null ? string() : string(block.text(row, col)));
+            return;
+        }
+        if (ints.empty()) scale = block.columns[col].scale;
+        int64_t value = ints.empty() ? 0 : ints.back();  // nulls repeat the previous value: a zero delta
+        if (!null) {
+            if (flags & snapshotDate) value = timestampMillis(cellDate(block, row, col));
+            else if (flags & snapshotHundredths) value = llround(cellDouble(block, row, col) * 100);
+            else value = cellInt(block, row, col);
+        }
+        ints.push_back(value);
+    }
+
+    void encode(string& out) const {
+        size_t rows = nulls.size();
+        SnapshotColumnHeader header = {(uint32_t)encoding, flags | (anyNull ? snapshotNullable : 0), scale, 0, 0};
+        size_t headerAt = out.size();
+        out.append((const char*)&header, sizeof(header));
+        size_t dataAt = out.size();
+        if (anyNull) {
+            string bitmap((rows + 7) / 8, '\0');
+            for (size_t r = 0; r < rows; ++r) {
+                if (nulls[r]) bitmap[r / 8] |= (char)(1 << (r % 8));
+            }
+            out += bitmap;
+        }
+        if (encoding == SnapshotEncoding::DeltaInt) {
+            int64_t previous = 0;
+            for (int64_t v : ints) {
+                int64_t delta = v - previous;
+                uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+                while (zigzag >= 0x80) {
+                    out += (char)(zigzag | 0x80);
+                    zigzag >>= 7;
+                }
+                out += (char)zigzag;
+                previous = v;
+            }
+        } else if (encoding == SnapshotEncoding::PlainText) {
+            appendStrings(out, texts);
+        } else {
+            unordered_map<string_view, uint32_t> codes;
+            vector<string> dict;
+            vector<uint32_t> rowCodes(rows);
+            for (size_t r = 0; r < rows; ++r) {
+                auto it = codes.find(texts[r]);
+                if (it == codes.end()) {
+                    dict.push_back(texts[r]);
+                    it = codes.emplace(texts[r], (uint32_t)(dict.size() - 1)).first;
+                }
+                rowCodes[r] = it->second;
+            }
+            uint32_t count = (uint32_t)dict.size();
+            out.append((const char*)&count, 4);
+            size_t textAt = out.size() + ((size_t)count + 1) * 4;
+            appendStrings(out, dict);
+            out.append((4 - (out.size() - textAt) % 4) % 4, '\0');  // readColumn() rounds the text up from its start
+            bool wide = count > 0xFFFF;
+            if (wide) header.flags |= snapshotWideCodes;
+            for (uint32_t code : rowCodes) out.append((const char*)&code, wide ? 4 : 2);
+        }
+        out.append((8 - out.size() % 8) % 8, '\0');
+        header.bytes = out.size() - dataAt;
+        memcpy(&out[headerAt], &header, sizeof(header));
+    }
+
+    static int64_t timestampMillis(const DateTimeValue& d) {
+        return daysFromCivil(d.year, d.month, d.day) * 86400000 + (((int64_t)d.hour * 60 + d.minute) * 60 + d.second) * 1000 +
+               d.fraction / 1000000;
+    }
+
+private:
+    static void appendStrings(string& out, const vector<string>& strings) {
+        uint32_t offset = 0;
+        out.append((const char*)&offset, 4);
+        for (const string& s : strings) {
+            offset += (uint32_t)s.size();
+            out.append((const char*)&offset, 4);
+        }
+        for (const string& s : strings) out += s;
+    }
+};
+
+struct SnapshotTableSpec {
+    string select;  // ordered by the primary key
+    string summarySql;
+    vector<pair<SnapshotEncoding, uint32_t>> columns;
+};
+
+// A table exported in schema order: numbers and dates as delta-coded integers
+// (money in hundredths), categorical text dictionary-coded, other text plain.
+template <typename Row, size_t N>
+SnapshotTableSpec snapshotSpec(const TableSchema<Row, N>& schema, const string& selectList, const string& summarySql) {
+    SnapshotTableSpec spec;
+    spec.select = "SELECT " + selectList + " FROM " + schema.table + " ORDER BY " + schema.columns[0].name;
+    spec.summarySql = summarySql;
+    for (const TableColumn<Row>& column : schema.columns) {
+        switch (column.type) {
+            case ColumnType::Int: spec.columns.push_back({SnapshotEncoding::DeltaInt, 0}); break;
+            case ColumnType::Double: spec.columns.push_back({SnapshotEncoding::DeltaInt, snapshotHundredths}); break;
+            case ColumnType::Date: spec.columns.push_back({SnapshotEncoding::DeltaInt, snapshotDate}); break;
+            case ColumnType::Text:
+                spec.columns.push_back({column.flags & Categorical ? SnapshotEncoding::DictText : SnapshotEncoding::PlainText, 0});
+                break;
+        }
+    }
+    return spec;
+}
+
+// Streams one table into an encoded SnapshotTableHeader + columns section.
+// The summary is read first: a change that lands during the export then shows
+// up as a mismatch against the live database, never as a false match.
+bool encodeSnapshotTable(StorageConnection& conn, const SnapshotTableSpec& spec, string& out, size_t& rows) {
+    ResultSet summary;
+    if (!conn.fetch(spec.summarySql, {}, summary) || summary.empty()) return false;
+    vector<SnapshotColumnBuilder> builders;
+    for (auto& column : spec.columns) builders.emplace_back(column.first, column.second);
+    bool ok = conn.fetchBlocks(spec.select, {}, [&](const ResultSet& block) {
+        if (block.columnCount() != builders.size()) return false;
+        for (size_t r = 0; r < block.size(); ++r) {
+            for (size_t c = 0; c < builders.size(); ++c) builders[c].add(block, r, c);
+        }
+        addJobProgress(block.size());
+        return !jobCancelled();
+    });
+    if (!ok) return false;
+
+    rows = builders[0].nulls.size();
+    SnapshotTableHeader header = {(uint32_t)builders.size(), 0, rows, atoll(summary.cellString(0, 0).c_str()),
+                                  atoll(summary.cellString(0, 1).c_str()), 0};
+    size_t headerAt = out.size();
+    out.append((const char*)&header, sizeof(header));
+    for (auto& builder : builders) builder.encode(out);
+    header.bytes = out.size() - headerAt - sizeof(header);
+    memcpy(&out[headerAt], &header, sizeof(header));
+    return true;
+}
+
+// Self-check for --check-snapshot: encodes columns of every kind the way an
+// export does and reads them back through the loader, with and without NULLs,
+// at row counts that leave the null bitmap at every alignment.
+bool runSnapshotChecks() {
+    const char* genres[] = {"Fiction", "Poetry", "History", "Science"};
+    const pair<SnapshotEncoding, uint32_t> encodings[] = {
+        {SnapshotEncoding::DeltaInt, 0}, {SnapshotEncoding::DeltaInt, snapshotHundredths}, {SnapshotEncoding::PlainText, 0},
+        {SnapshotEncoding::DictText, 0}};
+    size_t checked = 0, mismatched = 0;
+    for (size_t rows = 1; rows <= 40; ++rows) {
+        for (bool withNulls : {false, true}) {
+            ResultSet block;
+            block.addColumn("BookID", ColumnType::Int);
+            block.addColumn("Price", ColumnType::Double, 2);
+            block.addTextColumn("Title");
+            block.addTextColumn("Genre");
+            for (size_t r = 0; r < rows; ++r) {
+                ResultCell* row = block.appendRows(1);
+                bool null = withNulls && r % 3 == 1;
+                if (!null) {
+                    row[0].intValue = 1000 - (long long)r * 7;
+                    row[0].null = 0;
+                    row[1].doubleValue = 2.5 + r * 1.25;
+                    row[1].null = 0;
+                    string title = "Title " + to_string(r);
+                    block.setText(row[2], title.data(), title.size());
+                    block.setText(row[3], genres[r % 4], strlen(genres[r % 4]));
+                }
+            }
+            for (size_t c = 0; c < block.columnCount(); ++c) {
+                SnapshotColumnBuilder builder(encodings[c].first, encodings[c].second);
+                for (size_t r = 0; r < rows; ++r) builder.add(block, r, c);
+                string bytes;
+                builder.encode(bytes);
+                SnapshotColumn column;
+                bool same = Snapshot::decodeColumn(bytes, rows, column);
+                for (size_t r = 0; same && r < rows; ++r) same = column.render(r) == block.cellString(r, c);
+                checked++;
+                if (!same) {
+                    mismatched++;
+                    cout << "  MISMATCH: " << block.columns[c].name << ", " << rows << " rows" << (withNulls ? " with NULLs" : "") << endl;
+                }
+            }
+        }
+    }
+    cout << "Snapshot columns: " << checked << " round trips, " << mismatched << " mismatched" << endl;
+    return mismatched == 0;
+}
+
+// Writes Books, Members and Transactions to path (via a temporary file, so a
+// reader never maps a half-written snapshot).
+bool exportSnapshot(const string& path) {
+    OperationMetrics op("export_snapshot");
+    SnapshotTableSpec tables[] = {
+        snapshotSpec(booksTable, bookCacheColumns, bookSummarySql),
+        snapshotSpec(membersTable, columnList<membersTable, ColumnList::All>, memberSummarySql),
+        snapshotSpec(transactionsTable, columnList<transactionsTable, ColumnList::All>, transactionSummarySql),
+    };
+    tables[0].columns.push_back({SnapshotEncoding::DeltaInt, 0});  // the row checksum
+
+    auto start = chrono::steady_clock::now();
+    string out;
+    SnapshotFileHeader header = {};
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.tableCount = 3;
+    header.createdUnix = (int64_t)time(nullptr);
+    strncpy(header.backend, storageBackend ? storageBackend->name().c_str() : "", sizeof(header.backend) - 1);
+    out.append((const char*)&header, sizeof(header));
+
+    size_t rows[3] = {0, 0, 0};
+    bool ok = withConnection([&](StorageConnection& conn) {
+        out.resize(sizeof(header));
+        for (size_t t = 0; t < 3; ++t) {
+            if (!encodeSnapshotTable(conn, tables[t], out, rows[t])) return false;
+        }
+        return true;
+    }, ConnectionRetry::Idempotent);
+    if (!ok) {
+        statusOut() << "Failed to read the tables for the snapshot." << endl;
+        return false;
+    }
+
+    string tempPath = path + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    bool written = file && fwrite(out.data(), 1, out.size(), file) == out.size();
+    if (file && fclose(file) != 0) written = false;
+    remove(path.c_str());
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        statusOut() << "Failed to write " << path << endl;
+        return false;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    statusOut() << "Snapshot written to " << path << ": " << rows[0] << " books, " << rows[1] << " members, " << rows[2] << " transactions, "
+         << out.size() << " bytes in " << fixed << setprecision(1) << ms << " ms" << endl;
+    statusOut().unsetf(ios::floatfield);
+    return true;
+}
+
+// Compares each table's recorded summary with the live database's.
+void printSnapshotFreshness(const Snapshot& snapshot) {
+    const pair<const char*, pair<const SnapshotTable*, const string*>> tables[] = {
+        {booksTable.name, {&snapshot.books, &bookSummarySql}},
+        {membersTable.name, {&snapshot.members, &memberSummarySql}},
+        {transactionsTable.name, {&snapshot.transactions, &transactionSummarySql}},
+    };
+    for (auto& table : tables) {
+        ResultSet live = fetchResultSet(*table.second.second);
+        bool current = !live.empty() && atoll(live.cellString(0, 0).c_str()) == table.second.first->liveCount &&
+                       atoll(live.cellString(0, 1).c_str()) == table.second.first->liveChecksum;
+        cout << "  " << left << setw(14) << table.first << (current ? "current" : "changed since the snapshot; refreshing") << endl;
+    }
+    cout << right;
+}
+
+const chrono::seconds catalogPollInterval(15);
+const size_t catalogMaxRowRefetch = 64;
+
+// In-process copy of dbo.Books keyed by BookID, with an ISBN index. Lookups read
+// through to the database on a miss. Our own writes update it directly; changes
+// made by other desks are picked up by a poll at most every catalogPollInterval:
+// one aggregate query, and only when that differs, a per-row checksum diff that
+// refetches just the changed rows (dbo.Books has no rowversion column to seek on).
+class CatalogCache {
+public:
+    // The cached row for bookID, loading it from the database if it is not cached.
+    bool find(int bookID, CachedBook& out) {
+        ensureFresh();
+        {
+            shared_lock<shared_mutex> lock(mtx);
+            auto it = books.find(bookID);
+            if (it != books.end()) {
+                out = it->second;
+                hits++;
+                return true;
+            }
+        }
+        misses++;
+        return reloadBook(bookID, out);
+    }
+
+    // Refetches one row, e.g. before refusing an operation on a cached answer.
+    bool reloadBook(int bookID, CachedBook& out) {
+        if (offlineMode) return false;
+        auto rs = fetchResultSet(bookCacheSelect + " WHERE BookID = ?", {bookID});
+        unique_lock<shared_mutex> lock(mtx);
+        if (rs.empty()) {
+            eraseLocked(bookID);
+            return false;
+        }
+        out = rowToBook(rs, 0);
+        upsertLocked(out);
+        return true;
+    }
+
+    // True if another book (not excludeBookID) already has this ISBN.
+    bool isbnInUse(const string& isbn, int excludeBookID = 0) {
+        ensureFresh();
+        shared_lock<shared_mutex> lock(mtx);
+        auto it = byIsbn.find(normalizeIsbn(isbn));
+        return it != byIsbn.end() && it->second != excludeBookID;
+    }
+
+    unordered_set<string> isbnKeys() {
+        ensureFresh();
+        shared_lock<shared_mutex> lock(mtx);
+        unordered_set<string> keys;
+        keys.reserve(byIsbn.size());
+        for (auto& entry : byIsbn) keys.insert(entry.first);
+        return keys;
+    }
+
+    void upsert(const CachedBook& book) {
+        unique_lock<shared_mutex> lock(mtx);
+        upsertLocked(book);
+    }
+
+    void erase(int bookID) {
+        unique_lock<shared_mutex> lock(mtx);
+        eraseLocked(bookID);
+    }
+
+    // Books whose title or authors contain text, best matches first.
+    vector<CachedBook> search(const string& text) {
+        ensureFresh();
+        shared_lock<shared_mutex> lock(mtx);
+        vector<CachedBook> result;
+        for (int id : titleIndex.search(text)) result.push_back(books.at(id));
+        return result;
+    }
+
+    // Loads the catalogue now rather than on first use.
+    void warm() { ensureFresh(); }
+
+    // Fills the cache from a snapshot. The next poll compares the snapshot's
+    // recorded summary with the live table and refetches only rows whose
+    // checksum differs, so a recent snapshot makes startup a single query.
+    void seed(const SnapshotTable& table) {
+        lock_guard<mutex> pollLock(pollMutex);
+        unique_lock<shared_mutex> lock(mtx);
+        books.clear();
+        byIsbn.clear();
+        titleIndex.clear();
+        books.reserve(table.rows);
+        for (size_t r = 0; r < table.rows; ++r) {
+            CachedBook b;
+            readSnapshotRow(booksTable, table, r, b);
+            b.checksum = (int)table.columns[snapshotBookChecksum].ints[r];
+            upsertLocked(b);
+        }
+        loaded = true;
+        lastPoll = chrono::steady_clock::time_point();
+        lastCount = table.liveCount;
+        lastChecksum = table.liveChecksum;
+    }
+
+    void setAvailability(int bookID, const string& availability) {
+        unique_lock<shared_mutex> lock(mtx);
+        auto it = books.find(bookID);
+        if (it != books.end()) it->second.availability = availability;
+    }
+
+    // Forces the next access to poll, e.g. after a bulk import.
+    void markStale() {
+        lock_guard<mutex> lock(pollMutex);
+        lastPoll = chrono::steady_clock::time_point();
+    }
+
+    size_t size() {
+        shared_lock<shared_mutex> lock(mtx);
+        return books.size();
+    }
+    size_t hitCount() const { return hits; }
+    size_t missCount() const { return misses; }
+
+private:
+    static CachedBook rowToBook(const ResultSet& rs, size_t r) {
+        CachedBook b;
+        readRow(booksTable, rs, r, b);
+        b.checksum = (int)cellInt(rs, r, snapshotBookChecksum);
+        return b;
+    }
+
+    void upsertLocked(const CachedBook& book) {
+        auto it = books.find(book.bookID);
+        if (it != books.end()) {
+            // ISBNs are not unique in the table; leave another book's entry alone.
+            auto isbnIt = byIsbn.find(normalizeIsbn(it->second.isbn));
+            if (isbnIt != byIsbn.end() && isbnIt->second == book.bookID) byIsbn.erase(isbnIt);
+        }
+        books[book.bookID] = book;
+        byIsbn[normalizeIsbn(book.isbn)] = book.bookID;
+        titleIndex.set(book.bookID, {book.title, book.authors});
+    }
+
+    void eraseLocked(int bookID) {
+        auto it = books.find(bookID);
+        if (it == books.end()) return;
+        auto isbnIt = byIsbn.find(normalizeIsbn(it->second.isbn));
+        if (isbnIt != byIsbn.end() && isbnIt->second == bookID) byIsbn.erase(isbnIt);
+        books.erase(it);
+        titleIndex.remove(bookID);
+    }
+
+    void loadAll() {
+        auto rs = fetchResultSet(bookCacheSelect);
+        unique_lock<shared_mutex> lock(mtx);
+        books.clear();
+        byIsbn.clear();
+        titleIndex.clear();
+        books.reserve(rs.size());
+        for (size_t r = 0; r < rs.size(); ++r) upsertLocked(rowToBook(rs, r));
+    }
+
+    // Runs the change poll if it is due. Only one thread polls; the others keep
+    // reading the current contents meanwhile, or wait for the first load.
+    void ensureFresh() {
+        if (offlineMode) return;
+        unique_lock<mutex> pollLock(pollMutex, defer_lock);
+        if (!loaded) pollLock.lock();
+        else if (!pollLock.try_lock()) return;
+        auto now = chrono::steady_clock::now();
+        if (loaded && now - lastPoll < catalogPollInterval) return;
+        lastPoll = now;
+
+        ResultSet summary = fetchResultSet(bookSummarySql);
+        if (summary.empty()) return;
+        long long count = atoll(summary.cellString(0, 0).c_str());
+        long long checksum = atoll(summary.cellString(0, 1).c_str());
+        if (!loaded) {
+            loadAll();
+            loaded = true;
+        } else if (count != lastCount || checksum != lastChecksum) {
+            applyChangedRows();
+        }
+        lastCount = count;
+        lastChecksum = checksum;
+    }
+
+    void applyChangedRows() {
+        auto rs = fetchResultSet("SELECT BookID, " + bookChecksumSql + " FROM dbo.Books");
+        vector<int> changed, removed;
+        {
+            shared_lock<shared_mutex> lock(mtx);
+            unordered_set<int> seen;
+            seen.reserve(rs.size());
+            for (size_t r = 0; r < rs.size(); ++r) {
+                int id = (int)cellInt(rs, r, 0);
+                seen.insert(id);
+                auto it = books.find(id);
+                if (it == books.end() || it->second.checksum != (int)cellInt(rs, r, 1)) changed.push_back(id);
+            }
+            for (auto& entry : books) {
+                if (!seen.count(entry.first)) removed.push_back(entry.first);
+            }
+        }
+        if (changed.size() > catalogMaxRowRefetch) {
+            loadAll();
+            return;
+        }
+        CachedBook book;
+        for (int id : changed) reloadBook(id, book);
+        for (int id : removed) erase(id);
+    }
+
+    shared_mutex mtx;
+    unordered_map<int, CachedBook> books;
+    unordered_map<string, int> byIsbn;
+    TrigramIndex titleIndex;
+    atomic<size_t> hits{0}, misses{0};
+
+    mutex pollMutex;
+    atomic<bool> loaded{false};
+    chrono::steady_clock::time_point lastPoll;
+    long long lastCount = -1, lastChecksum = 0;
+};
+CatalogCache catalogCache;
+
+// Members indexed by name and email for searchMembers(). Built at startup and
+// kept current by addMember/updateMember/deleteMember; edits from other desks
+// are noticed by the same COUNT/CHECKSUM_AGG poll the catalog uses, which
+// triggers a reload (the member list is small and rarely changes).
+class MemberDirectory {
+public:
+    void warm() { ensureFresh(); }
+
+    vector<Member> search(const string& text) {
+        ensureFresh();
+        shared_lock<shared_mutex> lock(mtx);
+        vector<Member> result;
+        for (int id : index.search(text)) result.push_back(members.at(id));
+        return result;
+    }
+
+    bool find(int memberID, Member& out) {
+        ensureFresh();
+        shared_lock<shared_mutex> lock(mtx);
+        auto it = members.find(memberID);
+        if (it == members.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // Fills the directory from a snapshot; the next poll reloads it if the live
+    // table no longer matches the snapshot's summary.
+    void seed(const SnapshotTable& table) {
+        lock_guard<mutex> pollLock(pollMutex);
+        unique_lock<shared_mutex> lock(mtx);
+        members.clear();
+        index.clear();
+        for (size_t r = 0; r < table.rows; ++r) {
+            Member m;
+            readSnapshotRow(membersTable, table, r, m);
+            upsertLocked(m);
+        }
+        loaded = true;
+        lastPoll = chrono::steady_clock::time_point();
+        lastCount = table.liveCount;
+        lastChecksum = table.liveChecksum;
+    }
+
+    // Re-reads one member after we changed it, or drops it if it is gone.
+    void reloadMember(int memberID) {
+        if (offlineMode) return;
+        auto rs = fetchResultSet(memberSelect + " WHERE MemberID = ?", {memberID});
+        unique_lock<shared_mutex> lock(mtx);
+        if (rs.empty()) {
+            members.erase(memberID);
+            index.remove(memberID);
+        } else {
+            upsertLocked(rowToMember(rs, 0));
+        }
+    }
+
+private:
+    static Member rowToMember(const ResultSet& rs, size_t r) {
+        Member m;
+        readRow(membersTable, rs, r, m);
+        return m;
+    }
+
+    void upsertLocked(const Member& m) {
+        members[m.memberID] = m;
+        index.set(m.memberID, {m.name, m.email});
+    }
+
+    void ensureFresh() {
+        if (offlineMode) return;
+        // Once loaded, a poll already running serves; before that, wait for the first load.
+        unique_lock<mutex> pollLock(pollMutex, defer_lock);
+        if (!loaded) pollLock.lock();
+        else if (!pollLock.try_lock()) return;
+        auto now = chrono::steady_clock::now();
+        if (loaded && now - lastPoll < catalogPollInterval) return;
+        lastPoll = now;
+
+        ResultSet summary = fetchResultSet(memberSummarySql);
+        if (summary.empty()) return;
+        long long count = atoll(summary.cellString(0, 0).c_str());
+        long long checksum = atoll(summary.cellString(0, 1).c_str());
+        if (loaded && count == lastCount && checksum == lastChecksum) return;
+
+        auto rs = fetchResultSet(memberSelect);
+        unique_lock<shared_mutex> lock(mtx);
+        members.clear();
+        index.clear();
+        for (size_t r = 0; r < rs.size(); ++r) upsertLocked(rowToMember(rs, r));
+        loaded = true;
+        lastCount = count;
+        lastChecksum = checksum;
+    }
+
+    shared_mutex mtx;
+    unordered_map<int, Member> members;
+    TrigramIndex index;
+
+    mutex pollMutex;
+    atomic<bool> loaded{false};
+    chrono::steady_clock::time_point lastPoll;
+    long long lastCount = -1, lastChecksum = 0;
+};
+MemberDirectory memberDirectory;
+
+// Ids ranked by a value, highest first and then by id, as the ORDER BY of the
+// report queries does. Updates are O(log n); reading k rows from offset o
+// walks o + k nodes, so the first page of a ranked report is O(K).
+template <typename Value>
+class RankedCounter {
+public:
+    void update(int id, Value value) {
+        auto it = values.find(id);
+        if (it != values.end()) {
+            ranking.erase({it->second, id});
+            it->second = value;
+        } else {
+            values.emplace(id, value);
+        }
+        ranking.insert({value, id});
+    }
+
+    const Value* find(int id) const {
+        auto it = values.find(id);
+        return it == values.end() ? nullptr : &it->second;
+    }
+
+    vector<pair<int, Value>> range(size_t offset, size_t count) const {
+        vector<pair<int, Value>> out;
+        auto it = ranking.begin();
+        for (size_t i = 0; i < offset && it != ranking.end(); ++i) ++it;
+        for (; it != ranking.end() && out.size() < count; ++it) out.emplace_back(it->second, it->first);
+        return out;
+    }
+
+    void clear() {
+        values.clear();
+        ranking.clear();
+    }
+    size_t size() const { return values.size(); }
+
+private:
+    struct HighestFirst {
+        bool operator()(const pair<Value, int>& a, const pair<Value, int>& b) const {
+            if (b.first < a.first) return true;
+            if (a.first < b.first) return false;
+            return a.second < b.second;
+        }
+    };
+
+    unordered_map<int, Value> values;
+    set<pair<Value, int>, HighestFirst> ranking;
+};
+
+// SUM(FineAmount) for one member; with no fine rows the sum is NULL, which
+// ranks below every amount.
+struct FineTotal {
+    double amount = 0.0;
+    long long rows = 0;
+
+    bool operator<(const FineTotal& other) const {
+        if ((rows > 0) != (other.rows > 0)) return other.rows > 0;
+        return amount < other.amount;
+    }
+    bool operator!=(const FineTotal& other) const { return rows != other.rows || llround(amount * 100) != llround(other.amount * 100); }
+};
+
+enum class RankedReport { TopBooks, ActiveMembers, Fines };
+
+const chrono::minutes reportReconcileInterval(10);
+
+// Issue counts per book and member and fine totals per member, kept in memory
+// so the ranked reports are read from top-K structures instead of a GROUP BY
+// over all of Transactions. issueBook/returnBook/reserveBook apply their own
+// changes as they commit. Everything else (other desks, new or deleted books
+// and members) is caught by a cheap totals poll every catalogPollInterval; a
+// mismatch, or reportReconcileInterval passing, rebuilds from the base tables.
+class ReportAggregates {
+public:
+    void recordLoan(int bookID, int memberID) {
+        unique_lock<shared_mutex> lock(mtx);
+        if (!loaded) return;
+        if (const long long* n = bookIssues.find(bookID)) bookIssues.update(bookID, *n + 1);
+        if (const long long* n = memberIssues.find(memberID)) memberIssues.update(memberID, *n + 1);
+        expected.transactions++;
+    }
+
+    void recordReturn(int memberID, double fine) {
+        unique_lock<shared_mutex> lock(mtx);
+        if (!loaded) return;
+        if (const FineTotal* total = memberFines.find(memberID)) memberFines.update(memberID, {total->amount + fine, total->rows + 1});
+        expected.fineCents += llround(fine * 100);
+    }
+
+    // One page of a report as (id, name, value) rows, and the report's row count.
+    ResultSet page(RankedReport report, size_t offset, size_t count, size_t& total) {
+        OperationMetrics op("report_page");
+        ensureFresh();
+        vector<pair<int, string>> rows;
+        {
+            shared_lock<shared_mutex> lock(mtx);
+            char buf[32];
+            if (report == RankedReport::TopBooks) {
+                total = bookIssues.size();
+                for (auto& entry : bookIssues.range(offset, count)) rows.emplace_back(entry.first, to_string(entry.second));
+            } else if (report == RankedReport::ActiveMembers) {
+                total = memberIssues.size();
+                for (auto& entry : memberIssues.range(offset, count)) rows.emplace_back(entry.first, to_string(entry.second));
+            } else {
+                total = memberFines.size();
+                for (auto& entry : memberFines.range(offset, count)) {
+                    if (entry.second.rows == 0) rows.emplace_back(entry.first, "NULL");
+                    else rows.emplace_back(entry.first, string(buf, snprintf(buf, sizeof(buf), "%.2f", entry.second.amount)));
+                }
+            }
+        }
+
+        // Names come from the catalogue and member caches, so renames show up
+        // without touching the counts.
+        ResultSet rs;
+        rs.addTextColumn(report == RankedReport::TopBooks ? "BookID" : "MemberID");
+        rs.addTextColumn(report == RankedReport::TopBooks ? "Title" : "Name");
+        rs.addTextColumn("Value");
+        CachedBook book;
+        Member member;
+        for (auto& row : rows) {
+            string id = to_string(row.first);
+            if (report == RankedReport::TopBooks) rs.addTextRow({id, catalogCache.find(row.first, book) ? book.title : "", row.second});
+            else rs.addTextRow({id, memberDirectory.find(row.first, member) ? member.name : "", row.second});
+        }
+        return rs;
+    }
+
+    // Rebuilds from the base tables and returns how many rows had drifted.
+    size_t reconcile() {
+        if (offlineMode) return 0;
+        lock_guard<mutex> pollLock(pollMutex);
+        return reconcileLocked();
+    }
+
+    // Builds the aggregates from a snapshot's tables. Online, the next poll
+    // checks the totals against the live tables and rebuilds on a mismatch.
+    void seed(const Snapshot& snapshot) {
+        lock_guard<mutex> pollLock(pollMutex);
+        unordered_map<int, long long> bookCounts, memberCounts;
+        unordered_map<int, FineTotal> fines;
+        for (size_t r = 0; r < snapshot.books.rows; ++r) bookCounts[(int)snapshot.books.columns[BooksBookID].ints[r]] = 0;
+        for (size_t r = 0; r < snapshot.members.rows; ++r) {
+            int id = (int)snapshot.members.columns[MembersMemberID].ints[r];
+            memberCounts[id] = 0;
+            fines[id] = FineTotal();
+        }
+        Totals totals;
+        totals.books = (long long)snapshot.books.rows;
+        totals.members = (long long)snapshot.members.rows;
+        totals.transactions = (long long)snapshot.transactions.rows;
+        auto& t = snapshot.transactions.columns;
+        for (size_t r = 0; r < snapshot.transactions.rows; ++r) {
+            auto book = bookCounts.find((int)t[TransactionsBookID].ints[r]);
+            if (book != bookCounts.end()) book->second++;
+            int memberID = (int)t[TransactionsMemberID].ints[r];
+            auto member = memberCounts.find(memberID);
+            if (member != memberCounts.end()) member->second++;
+            if (t[TransactionsFineAmount].isNull(r)) continue;
+            totals.fineCents += t[TransactionsFineAmount].ints[r];
+            auto fine = fines.find(memberID);
+            if (fine != fines.end()) {
+                fine->second.amount += t[TransactionsFineAmount].ints[r] / 100.0;
+                fine->second.rows++;
+            }
+        }
+
+        unique_lock<shared_mutex> lock(mtx);
+        bookIssues.clear();
+        memberIssues.clear();
+        memberFines.clear();
+        for (auto& entry : bookCounts) bookIssues.update(entry.first, entry.second);
+        for (auto& entry : memberCounts) memberIssues.update(entry.first, entry.second);
+        for (auto& entry : fines) memberFines.update(entry.first, entry.second);
+        expected = totals;
+        loaded = true;
+        lastReconcile = chrono::steady_clock::now();
+        lastPoll = chrono::steady_clock::time_point();
+        lastDrift = 0;
+    }
+
+    void printStats() {
+        shared_lock<shared_mutex> lock(mtx);
+        if (!loaded) {
+            cout << "Report aggregates: not loaded" << endl;
+            return;
+        }
+        auto age = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - lastReconcile).count();
+        cout << "Report aggregates: " << bookIssues.size() << " books, " << memberIssues.size() << " members, "
+             << reconciles << " rebuilds, last " << age << " s ago (" << lastDrift << " rows drifted)" << endl;
+    }
+
+private:
+    struct Totals {
+        long long books = 0, members = 0, transactions = 0, fineCents = 0;
+        bool operator!=(const Totals& o) const {
+            return books != o.books || members != o.members || transactions != o.transactions || fineCents != o.fineCents;
+        }
+    };
+
+    static long long intCell(const ResultSet& rs, size_t row, size_t col) {
+        return rs.isNull(row, col) ? 0 : atoll(rs.cellString(row, col).c_str());
+    }
+
+    static bool pollTotals(Totals& out) {
+        ResultSet rs = fetchResultSet("SELECT (SELECT COUNT(*) FROM dbo.Books), (SELECT COUNT(*) FROM dbo.Members), "
+                                      "(SELECT COUNT(*) FROM dbo.Transactions), (SELECT ISNULL(SUM(FineAmount), 0) FROM dbo.Transactions)");
+        if (rs.empty()) return false;
+        out.books = intCell(rs, 0, 0);
+        out.members = intCell(rs, 0, 1);
+        out.transactions = intCell(rs, 0, 2);
+        out.fineCents = llround(atof(rs.cellString(0, 3).c_str()) * 100);
+        return true;
+    }
+
+    // Only one thread polls; the others read the current aggregates meanwhile.
+    void ensureFresh() {
+        if (offlineMode) return;
+        unique_lock<mutex> pollLock(pollMutex, try_to_lock);
+        if (!pollLock.owns_lock()) return;
+        auto now = chrono::steady_clock::now();
+        if (loaded && now - lastPoll < catalogPollInterval) return;
+        lastPoll = now;
+        if (loaded && now - lastReconcile < reportReconcileInterval) {
+            Totals current;
+            if (!pollTotals(current)) return;
+            shared_lock<shared_mutex> lock(mtx);
+            if (!(current != expected)) return;
+        }
+        reconcileLocked();
+    }
+
+    // Totals are taken before the group scans, so a loan committed in between
+    // shows up as a mismatch on the next poll and triggers another rebuild.
+    size_t reconcileLocked() {
+        Totals totals;
+        if (!pollTotals(totals)) return 0;
+        ResultSet books = fetchResultSet("SELECT b.BookID, COUNT(t.TransactionID) FROM dbo.Books b "
+                                         "LEFT JOIN dbo.Transactions t ON b.BookID = t.BookID GROUP BY b.BookID");
+        ResultSet members = fetchResultSet("SELECT m.MemberID, COUNT(t.TransactionID), SUM(t.FineAmount), COUNT(t.FineAmount) FROM dbo.Members m "
+                                           "LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID");
+        if (books.columnCount() < 2 || members.columnCount() < 4) return 0;
+
+        unique_lock<shared_mutex> lock(mtx);
+        size_t drift = 0;
+        RankedCounter<long long> newBookIssues, newMemberIssues;
+        RankedCounter<FineTotal> newMemberFines;
+        for (size_t r = 0; r < books.size(); ++r) {
+            int id = (int)intCell(books, r, 0);
+            long long issues = intCell(books, r, 1);
+            const long long* old = bookIssues.find(id);
+            if (loaded && (!old || *old != issues)) drift++;
+            newBookIssues.update(id, issues);
+        }
+        for (size_t r = 0; r < members.size(); ++r) {
+            int id = (int)intCell(members, r, 0);
+            long long issues = intCell(members, r, 1);
+            FineTotal fine{members.isNull(r, 2) ? 0.0 : atof(members.cellString(r, 2).c_str()), intCell(members, r, 3)};
+            const long long* oldIssues = memberIssues.find(id);
+            const FineTotal* oldFine = memberFines.find(id);
+            if (loaded && (!oldIssues || *oldIssues != issues || !oldFine || *oldFine != fine)) drift++;
+            newMemberIssues.update(id, issues);
+            newMemberFines.update(id, fine);
+        }
+        if (loaded) drift += (size_t)max<long long>(0, (long long)bookIssues.size() - (long long)newBookIssues.size()) +
+                             (size_t)max<long long>(0, (long long)memberIssues.size() - (long long)newMemberIssues.size());
+        bookIssues = move(newBookIssues);
+        memberIssues = move(newMemberIssues);
+        memberFines = move(newMemberFines);
+        expected = totals;
+        loaded = true;
+        lastReconcile = lastPoll = chrono::steady_clock::now();
+        lastDrift = drift;
+        reconciles++;
+        return drift;
+    }
+
+    shared_mutex mtx;
+    RankedCounter<long long> bookIssues, memberIssues;
+    RankedCounter<FineTotal> memberFines;
+    Totals expected;  // base-table totals the aggregates should match
+    bool loaded = false;
+    size_t reconciles = 0, lastDrift = 0;
+
+    mutex pollMutex;
+    chrono::steady_clock::time_point lastPoll, lastReconcile;
+};
+ReportAggregates reportAggregates;
+
+// The snapshot opened with --snapshot or --offline, kept mapped for the session.
+unique_ptr<Snapshot> librarySnapshot;
+
+// Maps a snapshot and fills the caches and report aggregates from it.
+bool loadSnapshot(const string& path) {
+    auto start = chrono::steady_clock::now();
+    auto snapshot = make_unique<Snapshot>();
+    string error;
+    if (!snapshot->open(path, error)) {
+        cout << "Snapshot not loaded: " << error << endl;
+        return false;
+    }
+    double mapMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    catalogCache.seed(snapshot->books);
+    memberDirectory.seed(snapshot->members);
+    reportAggregates.seed(*snapshot);
+    double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &snapshot->created);
+#else
+    localtime_r(&snapshot->created, &local);
+#endif
+    cout << "Snapshot " << path << " taken " << put_time(&local, "%Y-%m-%d %H:%M") << " from " << snapshot->backend << ": "
+         << snapshot->books.rows << " books, " << snapshot->members.rows << " members, " << snapshot->transactions.rows
+         << " transactions" << fixed << setprecision(1) << " (mapped in " << mapMs << " ms, caches filled in " << totalMs << " ms)" << endl;
+    cout.unsetf(ios::floatfield);
+    librarySnapshot = move(snapshot);
+    return true;
+}
+
+void addBook() {
+    CachedBook book;
+
+    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // clear input buffer
+    cout << "Enter Title: "; getline(cin, book.title);
+    cout << "Enter Authors: "; getline(cin, book.authors);
+    cout << "Enter Genre: "; getline(cin, book.genre);
+    cout << "Enter Publisher: "; getline(cin, book.publisher);
+    cout << "Enter ISBN: "; getline(cin, book.isbn);
+    cout << "Enter Edition: "; getline(cin, book.edition);
+    cout << "Enter Published Year: "; cin >> book.publishedYear;
+    cout << "Enter Price: "; cin >> book.price;
+    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    cout << "Enter Rack Location: "; getline(cin, book.rackLocation);
+    cout << "Enter Language: "; getline(cin, book.language);
+    cout << "Is Available (Yes/No): "; getline(cin, book.availability);
+
+    if (book.title.empty() || book.authors.empty() || book.isbn.empty()) {
+        cout << "Title, Authors, and ISBN are required!" << endl;
+        return;
+    }
+
+    // Normalize availability to lowercase for comparison
+    string availabilityLower = book.availability;
+    transform(availabilityLower.begin(), availabilityLower.end(), availabilityLower.begin(), ::tolower);
+    if (availabilityLower != "yes" && availabilityLower != "no") {
+        cout << "Availability must be 'Yes' or 'No'." << endl;
+        return;
+    }
+
+    if (catalogCache.isbnInUse(book.isbn)) {
+        cout << "ISBN already exists!" << endl;
+        return;
+    }
+
+    string query = insertSql<booksTable>("OUTPUT INSERTED.BookID ");
+    ResultSet inserted = fetchResultSet(query, insertParams(booksTable, book));
+    if (!inserted.empty() && parseId(inserted.cellString(0, 0), book.bookID)) {
+        // Re-read the row so the cache holds the server's values and checksum.
+        catalogCache.reloadBook(book.bookID, book);
+        cout << "Book added!" << endl;
+    } else {
+        cout << "Failed to add book." << endl;
+    }
+}
+
+void updateBook() {
+    string bookID;
+    cout << "Enter BookID: ";
+    cin >> bookID;
+
+    if (!all_of(bookID.begin(), bookID.end(), ::isdigit)) {
+        cout << "BookID must be numeric!" << endl;
+        return;
+    }
+
+    CachedBook book;
+    int id;
+    if (!parseId(bookID, id) || !catalogCache.find(id, book)) {
+        cout << "Book not found!" << endl;
+        return;
+    }
+
+    string title, authors, isbn;
+    cout << "Enter new Title (blank to skip): ";
+    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    getline(cin, title);
+    cout << "Enter new Authors (blank to skip): ";
+    getline(cin, authors);
+    cout << "Enter new ISBN (blank to skip): ";
+    getline(cin, isbn);
+
+    string query = "UPDATE dbo.Books SET ";
+    vector<SqlParam> params;
+    bool hasUpdate = false;
+
+    if (!title.empty()) {
+        query += "Title = ?";
+        params.push_back(title);
+        hasUpdate = true;
+    }
+    if (!authors.empty()) {
+        query += (hasUpdate ? ", " : "") + string("Authors = ?");
+        params.push_back(authors);
+        hasUpdate = true;
+    }
+    if (!isbn.empty()) {
+        if (catalogCache.isbnInUse(isbn, id)) {
+            cout << "ISBN already exists!" << endl;
+            return;
+        }
+        query += (hasUpdate ? ", " : "") + string("ISBN = ?");
+        params.push_back(isbn);
+        hasUpdate = true;
+    }
+
+    if (!hasUpdate) {
+        cout << "No changes provided!" << endl;
+        return;
+    }
+
+    query += " WHERE BookID = ?";
+    params.push_back(bookID);
+
+    if (runQuery(query, params)) {
+        catalogCache.reloadBook(id, book);
+        cout << "Book updated!" << endl;
+    } else {
+        cout << "Failed to update book." << endl;
+    }
+}
+
+void deleteBook() {
+    string bookID;
+    cout << "Enter BookID: ";
+    cin >> bookID;
+
+    if (!all_of(bookID.begin(), bookID.end(), ::isdigit)) {
+        cout << "BookID must be numeric!" << endl;
+        return;
+    }
+
+    CachedBook book;
+    int id;
+    if (!parseId(bookID, id) || !catalogCache.find(id, book)) {
+        cout << "Book not found!" << endl;
+        return;
+    }
+
+    if (runQuery("DELETE FROM dbo.Books WHERE BookID = ?", {bookID})) {
+        catalogCache.erase(id);
+        cout << "Book deleted!" << endl;
+    } else {
+        cout << "Failed to delete book." << endl;
+    }
+}
+
+void viewBooks() {
+    if (offlineMode) {
+        cout << "Offline snapshot, read-only." << endl;
+        showPaginated(snapshotView(booksTable, librarySnapshot->books), booksView);
+        return;
+    }
+    ResultSet res = fetchResultSet("SELECT DB_NAME() AS DatabaseName");
+    if (!res.empty()) {
+        cout << "Connected to database: " << res.cellString(0, 0) << endl;
+    } else {
+        cout << "Failed to retrieve database name." << endl;
+    }
+
+    PageQuery books;
+    books.columns = columnList<booksTable, ColumnList::View>;
+    books.from = booksTable.table;
+    books.keyColumn = booksTable.columns[BooksBookID].name;
+    showPaged(books, booksView);
+}
+
+// Answered from the catalogue's trigram index instead of a LIKE '%x%' table scan.
+ResultSet bookSearchResults(const string& text) {
+    OperationMetrics op("search");
+    auto matches = catalogCache.search(text);
+    ResultSet res;
+    addViewColumns(booksTable, res);
+    for (const auto& b : matches) addViewRow(booksTable, res, b);
+    return res;
+}
+
+void searchBooks() {
+    string value;
+    cout << "Enter Title or Author to search: ";
+    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    getline(cin, value);
+
+    auto start = chrono::steady_clock::now();
+    ResultSet res = bookSearchResults(value);
+    auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    cout << res.size() << " match(es) in " << micros << " us" << endl;
+    showPaginated(res, booksView);
+}
+
+vector<string> parseCSVLine(const string &line) {
+    vector<string> result;
+    string field;
+    bool inQuotes = false;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '"') {
+            if (inQuotes && i + 1 < line.size() && line[i + 1] == '"') {
+                field += '"';
+                i++;
+            } else {
+                inQuotes = !inQuotes;
+            }
+        } else if (c == ',' && !inQuotes) {
+            result.push_back(field);
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+    result.push_back(field);
+    return result;
+}
+
+ 
+const size_t defaultImportBatchSize = 1000;
+const size_t importChunkBytes = 1 << 20;
+const size_t importQueueDepth = 8;
+
+// A books.csv record holds the ColumnList::Insert columns, in schema order.
+struct BookImportRow : Book {
+    int lineNum = 0;
+};
+const size_t bookCsvFields = listedColumns(booksTable, ColumnList::Insert);
+
+// Fixed-capacity FIFO between pipeline stages. push() blocks while full and pop()
+// blocks while empty; after close() pushes fail and pop() drains what is left.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    bool push(T item) {
+        unique_lock<mutex> lock(mtx);
+        notFull.wait(lock, [&] { return items.size() < capacity || closed; });
+        if (closed) return false;
+        items.push_back(move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(mtx);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    deque<T> items;
+    bool closed = false;
+    mutex mtx;
+    condition_variable notFull, notEmpty;
+};
+
+// Records tokenized out of one chunk. Fields are views of the raw bytes, still
+// quoted; record r owns fields[firstField[r] .. firstField[r + 1]).
+struct CsvRecords {
+    vector<string_view> fields;
+    vector<uint32_t> firstField{0};
+    vector<string_view> text;
+    vector<int> lineNums;
+
+    size_t size() const { return lineNums.size(); }
+    void clear() {
+        fields.clear();
+        firstField.assign(1, 0);
+        text.clear();
+        lineNums.clear();
+    }
+};
+
+// Bitmasks for one 64-byte block of CSV: bit i is set when byte i is a quote,
+// comma or newline. The tokenizer only ever looks at these three characters, so
+// it can classify 16-32 bytes per instruction and then walk the set bits.
+struct CsvBlockMasks {
+    uint64_t quote;
+    uint64_t comma;
+    uint64_t newline;
+};
+
+CsvBlockMasks scanCsvBlockScalar(const char* p) {
+    CsvBlockMasks m = {0, 0, 0};
+    for (int i = 0; i < 64; ++i) {
+        m.quote |= (uint64_t)(p[i] == '"') << i;
+        m.comma |= (uint64_t)(p[i] == ',') << i;
+        m.newline |= (uint64_t)(p[i] == '\n') << i;
+    }
+    return m;
+}
+
+#if CSV_SIMD_X86
+CsvBlockMasks scanCsvBlockSse2(const char* p) {
+    const __m128i quote = _mm_set1_epi8('"'), comma = _mm_set1_epi8(','), newline = _mm_set1_epi8('\n');
+    CsvBlockMasks m = {0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        m.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (16 * i);
+        m.comma |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << (16 * i);
+        m.newline |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (16 * i);
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+CsvBlockMasks scanCsvBlockAvx2(const char* p) {
+    const __m256i quote = _mm256_set1_epi8('"'), comma = _mm256_set1_epi8(','), newline = _mm256_set1_epi8('\n');
+    CsvBlockMasks m = {0, 0, 0};
+    for (int i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * i));
+        m.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << (32 * i);
+        m.comma |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma)) << (32 * i);
+        m.newline |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)) << (32 * i);
+    }
+    return m;
+}
+#endif
+
+enum class CsvScanner { Scalar, Sse2, Avx2 };
+
+CsvScanner detectCsvScanner() {
+#if CSV_SIMD_X86
+    if (__builtin_cpu_supports("avx2")) return CsvScanner::Avx2;
+    return CsvScanner::Sse2;
+#else
+    return CsvScanner::Scalar;
+#endif
+}
+const CsvScanner csvScanner = detectCsvScanner();
+
+const char* csvScannerName(CsvScanner scanner) {
+    switch (scanner) {
+        case CsvScanner::Avx2: return "AVX2";
+        case CsvScanner::Sse2: return "SSE2";
+        default: return "scalar";
+    }
+}
+
+// Bit i of the result is the XOR of bits 0..i: with quote positions as input,
+// that marks every byte after an odd number of quotes, i.e. inside quotes.
+inline uint64_t prefixXor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Splits complete records out of data without copying. A newline inside quotes
+// belongs to the field, so a record may span several physical lines; lineNum
+// counts physical lines and each record is tagged with the line it starts on.
+// Unless atEof, a trailing record with no terminating newline is left unconsumed.
+// Returns the number of bytes consumed.
+//
+// Quote state is a running parity, which matches parseCSVLine(): an escaped ""
+// toggles twice, so separators are classified the same way. The escapes themselves
+// are resolved later, per field, by unquoteCsvField().
+template <CsvBlockMasks (*ScanBlock)(const char*)>
+size_t tokenizeCsvBlocks(string_view data, bool atEof, int& lineNum, CsvRecords& out) {
+    size_t recordStart = 0, fieldStart = 0;
+    int line = lineNum;
+    int recordLine = lineNum + 1;
+    size_t fieldsAtRecordStart = out.fields.size();
+    uint64_t inQuotesCarry = 0;
+
+    alignas(64) char tail[64];
+    for (size_t base = 0; base < data.size(); base += 64) {
+        const char* block = data.data() + base;
+        if (data.size() - base < 64) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, data.size() - base);
+            block = tail;
+        }
+        CsvBlockMasks m = ScanBlock(block);
+        uint64_t inQuotes = prefixXor(m.quote) ^ inQuotesCarry;
+        inQuotesCarry = (uint64_t)((int64_t)inQuotes >> 63);
+        uint64_t separators = (m.comma | m.newline) & ~inQuotes;
+
+        while (separators) {
+            int bit = __builtin_ctzll(separators);
+            size_t pos = base + bit;
+            out.fields.push_back(data.substr(fieldStart, pos - fieldStart));
+            fieldStart = pos + 1;
+            if ((m.newline >> bit) & 1) {
+                int linesHere = line + __builtin_popcountll(m.newline & ((2ull << bit) - 1));
+                out.firstField.push_back((uint32_t)out.fields.size());
+                out.text.push_back(data.substr(recordStart, pos - recordStart));
+                out.lineNums.push_back(recordLine);
+                recordStart = pos + 1;
+                recordLine = linesHere + 1;
+                fieldsAtRecordStart = out.fields.size();
+                lineNum = linesHere;
+            }
+            separators &= separators - 1;
+        }
+        line += __builtin_popcountll(m.newline);
+    }
+
+    if (recordStart < data.size()) {
+        if (!atEof) {
+            out.fields.resize(fieldsAtRecordStart);
+            return recordStart;
+        }
+        out.fields.push_back(data.substr(fieldStart));
+        out.firstField.push_back((uint32_t)out.fields.size());
+        out.text.push_back(data.substr(recordStart));
+        out.lineNums.push_back(recordLine);
+        lineNum = line + 1;
+    }
+    return data.size();
+}
+
+size_t tokenizeCsv(string_view data, bool atEof, int& lineNum, CsvRecords& out, CsvScanner scanner = csvScanner) {
+    switch (scanner) {
+#if CSV_SIMD_X86
+        case CsvScanner::Avx2: return tokenizeCsvBlocks<scanCsvBlockAvx2>(data, atEof, lineNum, out);
+        case CsvScanner::Sse2: return tokenizeCsvBlocks<scanCsvBlockSse2>(data, atEof, lineNum, out);
+#endif
+        default: return tokenizeCsvBlocks<scanCsvBlockScalar>(data, atEof, lineNum, out);
+    }
+}
+
+// Applies parseCSVLine()'s quote rules to one raw field. Fields without quotes,
+// the common case, are returned as-is; the rest are unescaped into scratch.
+string_view unquoteCsvField(string_view raw, string& scratch) {
+    if (raw.find('"') == string_view::npos) return raw;
+    scratch.clear();
+    bool inQuotes = false;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        char c = raw[i];
+        if (c == '"') {
+            if (inQuotes && i + 1 < raw.size() && raw[i + 1] == '"') {
+                scratch += '"';
+                i++;
+            } else {
+                inQuotes = !inQuotes;
+            }
+        } else {
+            scratch += c;
+        }
+    }
+    return scratch;
+}
+
+string_view trimImportField(string_view s) {
+    const char* whitespace = " \t\n\r\"";
+    size_t start = s.find_first_not_of(whitespace);
+    if (start == string_view::npos) return string_view();
+    size_t end = s.find_last_not_of(whitespace);
+    return s.substr(start, end - start + 1);
+}
+
+#if LIBRARY_WITH_ODBC
+// Column-wise parameter array for one nvarchar column of a batched INSERT.
+struct TextParamArray {
+    vector<SQLWCHAR> data;
+    vector<SQLLEN> lengths;
+    SQLULEN width = 1;
+
+    void fill(const vector<BookImportRow>& rows, size_t begin, size_t count, string Book::*field) {
+        // A UTF-8 value never needs more UTF-16 units than it has bytes.
+        width = 1;
+        for (size_t i = 0; i < count; ++i) width = max<SQLULEN>(width, (rows[begin + i].*field).size() + 1);
+        data.resize(count * width);
+        lengths.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const string& value = rows[begin + i].*field;
+            size_t units = utf8ToUtf16(value.data(), value.size(), (char16_t*)&data[i * width]);
+            data[i * width + units] = 0;
+            lengths[i] = units * sizeof(SQLWCHAR);
+        }
+    }
+
+    SQLRETURN bind(SQLHSTMT stmt, SQLUSMALLINT index) {
+        SQLULEN columnSize = max<SQLULEN>(width - 1, 4000);
+        SQLSMALLINT sqlType = width - 1 > 4000 ? SQL_WLONGVARCHAR : SQL_WVARCHAR;
+        return SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_WCHAR, sqlType, columnSize, 0,
+                                data.data(), width * sizeof(SQLWCHAR), lengths.data());
+    }
+};
+
+constexpr bool booksHaveDates() {
+    for (const TableColumn<Book>& column : booksTable.columns) {
+        if (column.type == ColumnType::Date) return true;
+    }
+    return false;
+}
+static_assert(!booksHaveDates(), "OdbcBookBatch has no date parameter arrays");
+
+// Array-bound INSERT used by imports. Array binding changes statement attributes,
+// so it uses a private handle rather than one from the statement cache. The
+// arrays are indexed by schema position; each column uses the one of its type.
+struct OdbcBookBatch {
+    SQLHSTMT stmt = SQL_NULL_HANDLE;
+    TextParamArray textParams[BooksColumnCount];
+    vector<SQLBIGINT> ints[BooksColumnCount];
+    vector<double> doubles[BooksColumnCount];
+    vector<SQLLEN> numericIndicators;
+    vector<SQLUSMALLINT> statuses;
+};
+
+OdbcConnection::~OdbcConnection() { disconnect(); }
+
+void OdbcConnection::disconnect() {
+    runningStatement = SQL_NULL_HANDLE;
+    if (bookBatch && bookBatch->stmt != SQL_NULL_HANDLE) SQLFreeHandle(SQL_HANDLE_STMT, bookBatch->stmt);
+    bookBatch.reset();
+    for (auto& entry : statements) {
+        SQLFreeHandle(SQL_HANDLE_STMT, entry.second);
+    }
+    statements.clear();
+    if (dbc != SQL_NULL_HANDLE) {
+        SQLDisconnect(dbc);
+        SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+        dbc = SQL_NULL_HANDLE;
+    }
+}
+
+// Sends the rows as one SQLExecute with SQL_ATTR_PARAMSET_SIZE and commits once.
+// Rows the server rejects are reported from the parameter status array; the rest
+// of the batch is kept.
+bool OdbcConnection::insertBookBatch(const vector<BookImportRow>& rows, size_t begin, size_t count, vector<char>& rowOk) {
+    if (!bookBatch) {
+        bookBatch = make_unique<OdbcBookBatch>();
+        if (SQL_SUCCESS != SQLAllocHandle(SQL_HANDLE_STMT, dbc, &bookBatch->stmt)) {
+            bookBatch->stmt = SQL_NULL_HANDLE;
+        } else {
+            SQLRETURN ret = SQLPrepareW(bookBatch->stmt, wideText(toUtf16(bookInsertSql)), SQL_NTS);
+            if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+                showError(bookBatch->stmt, SQL_HANDLE_STMT);
+                SQLFreeHandle(SQL_HANDLE_STMT, bookBatch->stmt);
+                bookBatch->stmt = SQL_NULL_HANDLE;
+            }
+        }
+    }
+    OdbcBookBatch& b = *bookBatch;
+    SQLHSTMT stmt = b.stmt;
+    if (stmt == SQL_NULL_HANDLE) return false;
+
+    SQLFreeStmt(stmt, SQL_RESET_PARAMS);
+    b.numericIndicators.assign(count, 0);
+    SQLUSMALLINT param = 0;
+    for (size_t c = 0; c < BooksColumnCount; ++c) {
+        const TableColumn<Book>& column = booksTable.columns[c];
+        if (!listsColumn(column, ColumnList::Insert)) continue;
+        ++param;
+        switch (column.type) {
+            case ColumnType::Int:
+                b.ints[c].resize(count);
+                for (size_t i = 0; i < count; ++i) b.ints[c][i] = rows[begin + i].*column.intField;
+                SQLBindParameter(stmt, param, SQL_PARAM_INPUT, SQL_C_SBIGINT, SQL_INTEGER, 0, 0, b.ints[c].data(), 0, b.numericIndicators.data());
+                break;
+            case ColumnType::Double:
+                b.doubles[c].resize(count);
+                for (size_t i = 0; i < count; ++i) b.doubles[c][i] = rows[begin + i].*column.doubleField;
+                SQLBindParameter(stmt, param, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 15, 0, b.doubles[c].data(), 0,
+                                 b.numericIndicators.data());
+                break;
+            case ColumnType::Text:
+                b.textParams[c].fill(rows, begin, count, column.textField);
+                b.textParams[c].bind(stmt, param);
+                break;
+            case ColumnType::Date:
+                break;
+        }
+    }
+
+    b.statuses.assign(count, SQL_PARAM_UNUSED);
+    SQLULEN processed = 0;
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)count, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_STATUS_PTR, b.statuses.data(), 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, &processed, 0);
+
+    this->begin();
+    runningStatement = stmt;
+    StatementMetrics metrics(bookInsertSql);
+    SQLRETURN ret = SQLExecute(stmt);
+    metrics.finish(ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO, processed);
+    if (ret != SQL_SUCCESS) showError(stmt, SQL_HANDLE_STMT);
+    bool linkLost = ret == SQL_ERROR && isConnectionError(stmt, SQL_HANDLE_STMT);
+    while (SQLMoreResults(stmt) == SQL_SUCCESS) {}
+    SQLFreeStmt(stmt, SQL_CLOSE);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, NULL, 0);
+
+    if (linkLost) {
+        broken = true;
+        return false;
+    }
+
+    rowOk.assign(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        SQLUSMALLINT status = b.statuses[i];
+        bool ok = status == SQL_PARAM_SUCCESS || status == SQL_PARAM_SUCCESS_WITH_INFO;
+        // Drivers that cannot report per-row status leave it unused on success.
+        if (status == SQL_PARAM_UNUSED && ret != SQL_ERROR && i < processed) ok = true;
+        rowOk[i] = ok;
+    }
+    return commit();
+}
+#endif
+
+#if LIBRARY_WITH_SQLITE
+// One transaction per batch; inside it each row is a step of the same prepared
+// INSERT, which is as close as SQLite gets to array binding.
+bool SqliteConnection::insertBookBatch(const vector<BookImportRow>& rows, size_t begin, size_t count, vector<char>& rowOk) {
+    sqlite3_stmt* stmt = prepare(bookInsertSql, {});
+    if (!stmt) return false;
+    this->begin();
+    StatementMetrics metrics(bookInsertSql);
+    rowOk.assign(count, 0);
+    bool reported = false;
+    for (size_t i = 0; i < count; ++i) {
+        const BookImportRow& row = rows[begin + i];
+        int param = 0;
+        for (const TableColumn<Book>& column : booksTable.columns) {
+            if (!listsColumn(column, ColumnList::Insert)) continue;
+            ++param;
+            switch (column.type) {
+                case ColumnType::Int: sqlite3_bind_int(stmt, param, row.*column.intField); break;
+                case ColumnType::Double: sqlite3_bind_double(stmt, param, row.*column.doubleField); break;
+                case ColumnType::Date: {
+                    string text = formatDateTime(row.*column.dateField);
+                    sqlite3_bind_text(stmt, param, text.data(), (int)text.size(), SQLITE_TRANSIENT);
+                    break;
+                }
+                case ColumnType::Text: {
+                    const string& text = row.*column.textField;
+                    sqlite3_bind_text(stmt, param, text.data(), (int)text.size(), SQLITE_STATIC);
+                    break;
+                }
+            }
+        }
+        rowOk[i] = sqlite3_step(stmt) == SQLITE_DONE;
+        if (!rowOk[i] && !reported) {
+            showSqliteError(db);
+            reported = true;
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_clear_bindings(stmt);
+    metrics.finish(!reported, count);
+    return commit();
+}
+#endif
+
+// Writes an import in batches on one leased connection; each write() is one
+// round trip (where the backend supports it) and one commit.
+class BookBatchWriter {
+public:
+    BookBatchWriter() {
+        if (!lease) statusOut() << "No database connection available." << endl;
+    }
+
+    bool usable() const { return lease && !lease->broken; }
+
+    // Inserts rows[begin, begin + count) as one batch. Returns the rows committed.
+    size_t write(const vector<BookImportRow>& rows, size_t begin, size_t count) {
+        if (!usable() || count == 0) return 0;
+        batchNum++;
+
+        if (!lease->insertBookBatch(rows, begin, count, rowOk)) {
+            if (lease->broken) statusOut() << "Connection lost during batch " << batchNum << "; import stopped." << endl;
+            else statusOut() << "Batch " << batchNum << " could not be committed." << endl;
+            return 0;
+        }
+
+        size_t batchInserted = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (rowOk[i]) {
+                batchInserted++;
+            } else {
+                statusOut() << "Failed to add at line " << rows[begin + i].lineNum << ": " << rows[begin + i].title << endl;
+            }
+        }
+        statusOut() << "Batch " << batchNum << ": added " << batchInserted << " of " << count << " books." << endl;
+        return batchInserted;
+    }
+
+private:
+    ConnectionLease lease;
+    size_t batchNum = 0;
+    vector<char> rowOk;
+};
+
+// One chunk of the input file on its way through the import pipeline. The
+// tokenized records point into block, which travels with them.
+struct ImportChunk {
+    size_t seq = 0;
+    shared_ptr<const string> block;
+    CsvRecords records;
+};
+
+struct ParsedChunk {
+    size_t seq = 0;
+    vector<BookImportRow> rows;
+    string messages;
+};
+
+// Reads a CSV stream in importChunkBytes pieces and queues the whole records
+// tokenized out of each; a record cut off at the end of a piece is carried
+// into the next. lineNum is the number of lines already consumed (e.g. a header).
+void readCsvChunks(istream& file, BoundedQueue<ImportChunk>& out, int lineNum = 0) {
+    string carry;
+    size_t seq = 0;
+    vector<char> buf(importChunkBytes);
+    while (true) {
+        file.read(buf.data(), buf.size());
+        size_t got = (size_t)file.gcount();
+        bool atEof = got < buf.size();
+        auto block = make_shared<string>();
+        block->reserve(carry.size() + got);
+        block->append(carry).append(buf.data(), got);
+
+        ImportChunk chunk;
+        chunk.seq = seq++;
+        size_t consumed = tokenizeCsv(*block, atEof, lineNum, chunk.records);
+        carry.assign(*block, consumed, string::npos);
+        chunk.block = block;
+        if (chunk.records.size() > 0 && !out.push(move(chunk))) break;
+        if (atEof) break;
+    }
+    out.close();
+}
+
+// Validates and normalises one chunk of records into typed rows. Problems are
+// collected into messages so the writer can print them in file order.
+ParsedChunk parseImportChunk(const ImportChunk& chunk) {
+    ParsedChunk parsed;
+    parsed.seq = chunk.seq;
+    parsed.rows.reserve(chunk.records.size());
+    const CsvRecords& recs = chunk.records;
+    string scratch;
+
+    for (size_t r = 0; r < recs.size(); ++r) {
+        int lineNum = recs.lineNums[r];
+        string_view text = recs.text[r];
+        if (all_of(text.begin(), text.end(), ::isspace)) {
+            parsed.messages += "Skipping empty line " + to_string(lineNum) + "\n";
+            continue;
+        }
+        size_t first = recs.firstField[r];
+        size_t count = recs.firstField[r + 1] - first;
+        if (count < bookCsvFields) {
+            parsed.messages += "Invalid format at line " + to_string(lineNum) + ": " + string(text) + "\n";
+            continue;
+        }
+
+        BookImportRow row;
+        row.lineNum = lineNum;
+        string problem;
+        size_t f = first;
+        for (const TableColumn<Book>& column : booksTable.columns) {
+            if (!listsColumn(column, ColumnList::Insert)) continue;
+            string_view value = trimImportField(unquoteCsvField(recs.fields[f++], scratch));
+            const char* end = value.data() + value.size();
+            bool ok = true;
+            switch (column.type) {
+                case ColumnType::Int: {
+                    auto parsed = from_chars(value.data(), end, row.*column.intField);
+                    ok = parsed.ec == errc() && parsed.ptr == end;
+                    break;
+                }
+                case ColumnType::Double: {
+                    auto parsed = from_chars(value.data(), end, row.*column.doubleField);
+                    ok = parsed.ec == errc() && parsed.ptr == end;
+                    break;
+                }
+                case ColumnType::Date: row.*column.dateField = parseDateTime(value); break;
+                case ColumnType::Text:
+                    if (value.empty() && (column.flags & Required)) {
+                        problem = "Invalid format at line " + to_string(lineNum) + ": missing required fields\n";
+                    }
+                    (row.*column.textField).assign(value);
+                    break;
+            }
+            if (!ok) problem = "Invalid " + string(column.name) + " at line " + to_string(lineNum) + ": " + string(value) + "\n";
+            if (!problem.empty()) break;
+        }
+        if (!problem.empty()) {
+            parsed.messages += problem;
+            continue;
+        }
+        parsed.rows.push_back(move(row));
+    }
+    return parsed;
+}
+
+// Streams a books CSV into dbo.Books through four stages: a reader that loads
+// fixed-size chunks and tokenizes whole records out of them, a pool of workers
+// that validate rows, a bounded queue, and this thread as the single batched
+// writer. Existing ISBNs come from the catalog cache, refreshed on another
+// thread while the file is being parsed. Returns the number of books added.
+size_t importBooksPipelined(istream& file, size_t batchSize) {
+    OperationMetrics op("import");
+    auto isbnPrefetch = queryPool.submit([] { return catalogCache.isbnKeys(); });
+
+    BoundedQueue<ImportChunk> chunkQueue(importQueueDepth);
+    BoundedQueue<ParsedChunk> rowQueue(importQueueDepth);
+
+    thread reader([&] { readCsvChunks(file, chunkQueue); });
+
+    size_t workerCount = max(1u, thread::hardware_concurrency() > 2 ? thread::hardware_concurrency() - 2 : 1u);
+    atomic<size_t> workersLeft(workerCount);
+    vector<thread> workers;
+    for (size_t w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&] {
+            ImportChunk chunk;
+            while (chunkQueue.pop(chunk)) {
+                if (!rowQueue.push(parseImportChunk(chunk))) break;
+            }
+            if (--workersLeft == 0) rowQueue.close();
+        });
+    }
+
+    unordered_set<string> knownIsbns = isbnPrefetch.get();
+    BookBatchWriter writer;
+    vector<BookImportRow> pending;
+    pending.reserve(batchSize);
+    size_t booksAdded = 0;
+
+    // Workers finish chunks out of order; hold early ones back so messages,
+    // duplicate detection and inserts all follow file order.
+    map<size_t, ParsedChunk> reorder;
+    size_t nextSeq = 0;
+    ParsedChunk parsed;
+    while (rowQueue.pop(parsed)) {
+        reorder.emplace(parsed.seq, move(parsed));
+        for (auto it = reorder.find(nextSeq); it != reorder.end(); it = reorder.find(++nextSeq)) {
+            statusOut() << it->second.messages;
+            for (auto& row : it->second.rows) {
+                if (!knownIsbns.insert(normalizeIsbn(row.isbn)).second) {
+                    statusOut() << "ISBN exists at line " << row.lineNum << ": " << row.isbn << endl;
+                    continue;
+                }
+                pending.push_back(move(row));
+                if (pending.size() == batchSize) {
+                    size_t added = writer.write(pending, 0, pending.size());
+                    booksAdded += added;
+                    addJobProgress(added);
+                    pending.clear();
+                }
+            }
+            reorder.erase(it);
+        }
+        if (!writer.usable() || jobCancelled()) break;
+    }
+    if (!pending.empty() && !jobCancelled()) booksAdded += writer.write(pending, 0, pending.size());
+
+    // Unblock the other stages if the writer gave up early.
+    rowQueue.close();
+    chunkQueue.close();
+    reader.join();
+    for (auto& worker : workers) worker.join();
+    if (booksAdded > 0) catalogCache.markStale();
+    return booksAdded;
+}
+
+// Builds an in-memory books.csv with the mix the desk feeds contain: plain rows,
+// quoted titles with commas and doubled quotes, and CRLF line endings. Rows are
+// numbered from first, so files made with different starts have distinct ISBNs.
+string makeSyntheticBooksCsv(size_t rows, size_t first = 0) {
+    const char* genres[] = {"Fiction", "Science", "History", "Biography", "Poetry"};
+    const char* languages[] = {"English", "Hindi", "Marathi", "Gujarati"};
+    string csv;
+    csv.reserve(rows * 110);
+    for (size_t i = first; i < first + rows; ++i) {
+        if (i % 7 == 0) csv += "\"The \"\"Collected\"\" Works, Volume " + to_string(i) + "\"";
+        else csv += "Synthetic Title Number " + to_string(i);
+        csv += ",";
+        csv += (i % 5 == 0) ? "\"Rao, Anil; Shah, Meera\"" : "Author " + to_string(i % 997);
+        csv += string(",") + genres[i % 5] + ",Publisher " + to_string(i % 131);
+        csv += ",978" + to_string(1000000000 + i) + "," + to_string(1 + i % 4);
+        csv += "," + to_string(1950 + i % 70) + "," + to_string(100 + i % 900) + ".50";
+        csv += ",R" + to_string(i % 40) + "-S" + to_string(i % 12) + string(",") + languages[i % 4];
+        csv += (i % 3 == 0) ? ",No" : ",Yes";
+        csv += (i % 2 == 0) ? "\r\n" : "\n";
+    }
+    return csv;
+}
+
+// Microbenchmark for --bench-csv: tokenizes a synthetic file with parseCSVLine()
+// and with each block scanner, checks they agree field for field, and reports
+// throughput.
+void runCsvBenchmark(size_t rows) {
+    string csv = makeSyntheticBooksCsv(rows);
+    double megabytes = csv.size() / (1024.0 * 1024.0);
+    cout << "Synthetic books.csv: " << rows << " rows, " << fixed << setprecision(1) << megabytes << " MB" << endl;
+
+    auto best = [](auto&& body) {
+        double bestMs = 1e300;
+        for (int run = 0; run < 3; ++run) {
+            auto start = chrono::steady_clock::now();
+            body();
+            bestMs = min(bestMs, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        return bestMs;
+    };
+    auto report = [&](const string& name, double ms, size_t fields) {
+        cout << left << setw(16) << name << right << setw(10) << setprecision(1) << ms << " ms"
+             << setw(10) << setprecision(0) << megabytes / (ms / 1000.0) << " MB/s"
+             << setw(12) << fields << " fields" << endl;
+    };
+
+    vector<vector<string>> reference;
+    double ms = best([&] {
+        reference.clear();
+        istringstream in(csv);
+        string line;
+        while (getline(in, line)) reference.push_back(parseCSVLine(line));
+    });
+    size_t referenceFields = 0;
+    for (auto& row : reference) referenceFields += row.size();
+    report("parseCSVLine", ms, referenceFields);
+
+    vector<CsvScanner> scanners = {CsvScanner::Scalar};
+#if CSV_SIMD_X86
+    scanners.push_back(CsvScanner::Sse2);
+    if (__builtin_cpu_supports("avx2")) scanners.push_back(CsvScanner::Avx2);
+#endif
+    for (CsvScanner scanner : scanners) {
+        CsvRecords recs;
+        ms = best([&] {
+            recs.clear();
+            int lineNum = 0;
+            tokenizeCsv(csv, true, lineNum, recs, scanner);
+        });
+
+        bool matches = recs.size() == reference.size();
+        string scratch;
+        for (size_t r = 0; matches && r < recs.size(); ++r) {
+            size_t first = recs.firstField[r], count = recs.firstField[r + 1] - first;
+            matches = count == reference[r].size();
+            for (size_t f = 0; matches && f < count; ++f) {
+                matches = unquoteCsvField(recs.fields[first + f], scratch) == reference[r][f];
+            }
+        }
+        report(string("tokenize/") + csvScannerName(scanner), ms, recs.fields.size());
+        if (!matches) cout << "  MISMATCH against parseCSVLine output" << endl;
+    }
+    cout.unsetf(ios::floatfield);
+}
+
+// Microbenchmark for --bench-text: converts the titles and authors of a synthetic
+// catalogue (English, Hindi and Marathi, with the odd emoji to exercise surrogate
+// pairs) to UTF-16 and back, as the ODBC layer does for every parameter and text
+// cell, and compares against the old per-byte widening, which mangles non-ASCII.
+void runTextBenchmark(size_t rows) {
+    const char* english[] = {"The", "Silent", "River", "of", "Modern", "Algorithms", "Garden", "History", "Database", "Systems"};
+    const char* hindi[] = {u8"गोदान", u8"कहानी", u8"प्रेमचंद",
+                           u8"और", u8"भारत", u8"इतिहास"};
+    const char* marathi[] = {u8"श्यामची", u8"आई", u8"युगंधर",
+                             u8"मराठी", u8"कादंबरी"};
+    vector<string> cells;
+    size_t bytes = 0, nonAscii = 0;
+    mt19937 rng(42);
+    for (size_t i = 0; i < rows * 2; ++i) {
+        string text;
+        int words = 3 + (int)(rng() % 6);
+        for (int w = 0; w < words; ++w) {
+            if (w) text += ' ';
+            switch (i % 8) {
+                case 0: case 1: case 2: case 3: text += english[rng() % 10]; break;
+                case 4: case 5: text += hindi[rng() % 6]; break;
+                case 6: text += marathi[rng() % 5]; break;
+                default: text += w % 2 ? english[rng() % 10] : hindi[rng() % 6]; break;
+            }
+        }
+        if (i % 97 == 0) text += u8" \U0001F4DA";
+        nonAscii += any_of(text.begin(), text.end(), [](char c) { return (unsigned char)c >= 0x80; });
+        bytes += text.size();
+        cells.push_back(move(text));
+    }
+    double megabytes = bytes / (1024.0 * 1024.0);
+    cout << "Synthetic catalogue: " << cells.size() << " titles and authors, " << nonAscii << " non-ASCII, " << fixed
+         << setprecision(1) << megabytes << " MB" << endl;
+
+    auto best = [](auto&& body) {
+        double bestMs = 1e300;
+        for (int run = 0; run < 3; ++run) {
+            auto start = chrono::steady_clock::now();
+            body();
+            bestMs = min(bestMs, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        return bestMs;
+    };
+    auto report = [&](const string& name, double widenMs, double narrowMs, size_t intact) {
+        cout << left << setw(16) << name << right << setw(9) << setprecision(1) << widenMs << " ms" << setw(8) << setprecision(0)
+             << megabytes / (widenMs / 1000.0) << " MB/s to UTF-16" << setw(9) << setprecision(1) << narrowMs << " ms" << setw(8)
+             << setprecision(0) << megabytes / (narrowMs / 1000.0) << " MB/s back" << setw(10) << intact << " intact" << endl;
+    };
+
+    // The old stringToWstring()/wstring_to_string(): a fresh wstring and string per
+    // cell, one byte per code unit.
+    vector<wstring> legacyWide(cells.size());
+    vector<string> legacyBack(cells.size());
+    double widenMs = best([&] {
+        for (size_t i = 0; i < cells.size(); ++i) legacyWide[i] = wstring(cells[i].begin(), cells[i].end());
+    });
+    double narrowMs = best([&] {
+        for (size_t i = 0; i < cells.size(); ++i) legacyBack[i] = string(legacyWide[i].begin(), legacyWide[i].end());
+    });
+    // Byte-for-byte the round trip survives; what the server receives does not.
+    u16string expected;
+    size_t intact = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        assignUtf16(cells[i], expected);
+        intact += equal(expected.begin(), expected.end(), legacyWide[i].begin(), legacyWide[i].end());
+    }
+    report("per-byte copy", widenMs, narrowMs, intact);
+
+    // The text layer, widening into one reused buffer and narrowing into one pool,
+    // the way bindParams() and fetchRows() use it.
+    for (bool vectorized : {false, true}) {
+        u16string wide;
+        vector<uint32_t> offsets(cells.size() + 1);
+        wide.resize(bytes);
+        widenMs = best([&] {
+            size_t units = 0;
+            for (size_t i = 0; i < cells.size(); ++i) {
+                offsets[i] = (uint32_t)units;
+                units += utf8ToUtf16(cells[i].data(), cells[i].size(), &wide[units], vectorized);
+            }
+            offsets[cells.size()] = (uint32_t)units;
+        });
+        wide.resize(offsets[cells.size()]);
+        string pool(3 * wide.size(), '\0');
+        narrowMs = best([&] {
+            pool.resize(3 * wide.size());
+            size_t n = 0;
+            for (size_t i = 0; i < cells.size(); ++i) {
+                n += utf16ToUtf8(&wide[offsets[i]], offsets[i + 1] - offsets[i], &pool[n], vectorized);
+            }
+            pool.resize(n);
+        });
+        intact = 0;
+        size_t at = 0;
+        for (const string& cell : cells) {
+            intact += pool.compare(at, cell.size(), cell) == 0;
+            at += cell.size();
+        }
+        report(vectorized ? (CSV_SIMD_X86 ? "utf/sse2" : "utf/swar") : "utf/scalar", widenMs, narrowMs, intact);
+    }
+    cout.unsetf(ios::floatfield);
+}
+
+// Offline ranking of an exported transaction history: a CSV dump (e.g.
+// `sqlite3 -header -csv` or `bcp` output of dbo.Transactions, optionally joined
+// with Title and Name) or a library snapshot. The input is read once; memory
+// grows with the number of distinct books and members, not with the rows.
+
+// Running totals for one BookID or MemberID. 32 bytes, so two share a cache line.
+struct HistorySlot {
+    int32_t key = 0;    // 0 marks an empty slot; IDs are IDENTITY values >= 1
+    int32_t name = -1;  // index into the owning map's names, or -1
+    int64_t issues = 0;
+    int64_t fineRows = 0;
+    double fine = 0.0;
+};
+
+// Open-addressing map from ID to HistorySlot: one flat array, linear probing,
+// power-of-two capacity kept at most half full, so a lookup in the hot loop
+// usually touches a single cache line.
+class HistoryMap {
+public:
+    HistoryMap() : slots(1024) {}
+
+    HistorySlot& at(int32_t key) {
+        if ((used + 1) * 2 > slots.size()) grow();
+        size_t mask = slots.size() - 1;
+        for (size_t i = hashKey(key) & mask;; i = (i + 1) & mask) {
+            if (slots[i].key == key) return slots[i];
+            if (slots[i].key == 0) {
+                slots[i].key = key;
+                used++;
+                return slots[i];
+            }
+        }
+    }
+
+    // Keeps the first name seen for a key.
+    void setName(HistorySlot& slot, string_view name) {
+        if (slot.name >= 0 || name.empty()) return;
+        slot.name = (int32_t)names.size();
+        names.emplace_back(name);
+    }
+    string_view nameOf(const HistorySlot& slot) const { return slot.name >= 0 ? string_view(names[slot.name]) : string_view(); }
+
+    // Folds another shard's totals into this one.
+    void merge(const HistoryMap& other) {
+        for (const HistorySlot& theirs : other.slots) {
+            if (theirs.key == 0) continue;
+            HistorySlot& mine = at(theirs.key);
+            mine.issues += theirs.issues;
+            mine.fineRows += theirs.fineRows;
+            mine.fine += theirs.fine;
+            setName(mine, other.nameOf(theirs));
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const HistorySlot& slot : slots) {
+            if (slot.key != 0) fn(slot);
+        }
+    }
+    size_t size() const { return used; }
+
+private:
+    static size_t hashKey(int32_t key) { return (size_t)(((uint32_t)key * 0x9E3779B97F4A7C15ull) >> 32); }
+
+    void grow() {
+        vector<HistorySlot> old(slots.size() * 2);
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const HistorySlot& slot : old) {
+            if (slot.key == 0) continue;
+            size_t i = hashKey(slot.key) & mask;
+            while (slots[i].key != 0) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+
+    vector<HistorySlot> slots;
+    vector<string> names;
+    size_t used = 0;
+};
+
+// Positions of the columns we use in the dump's header; -1 if absent.
+struct HistoryColumns {
+    int bookID = -1, memberID = -1, fine = -1, title = -1, name = -1;
+};
+
+// One worker's share of the dump. Shards never share state while reading and
+// are merged once at the end.
+struct HistoryShard {
+    HistoryMap books, members;
+    size_t rows = 0, skipped = 0;
+
+    // One transaction row. fine is null when FineAmount was NULL or absent.
+    void add(int32_t bookID, int32_t memberID, const double* fine, string_view title, string_view name) {
+        HistorySlot& book = books.at(bookID);
+        book.issues++;
+        books.setName(book, title);
+        HistorySlot& member = members.at(memberID);
+        member.issues++;
+        members.setName(member, name);
+        if (fine) {
+            member.fineRows++;
+            member.fine += *fine;
+        }
+        rows++;
+    }
+};
+
+bool findHistoryColumns(const string& headerLine, HistoryColumns& cols) {
+    vector<string> header = parseCSVLine(headerLine);
+    for (size_t i = 0; i < header.size(); ++i) {
+        string name(trimImportField(header[i]));
+        if (i == 0 && name.compare(0, 3, "\xEF\xBB\xBF") == 0) name.erase(0, 3);  // UTF-8 BOM
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "bookid") cols.bookID = (int)i;
+        else if (name == "memberid") cols.memberID = (int)i;
+        else if (name == "fineamount") cols.fine = (int)i;
+        else if (name == "title") cols.title = (int)i;
+        else if (name == "name") cols.name = (int)i;
+    }
+    return cols.bookID >= 0 && cols.memberID >= 0;
+}
+
+void aggregateHistoryChunk(const ImportChunk& chunk, const HistoryColumns& cols, HistoryShard& shard) {
+    const CsvRecords& recs = chunk.records;
+    string scratch, titleScratch;
+    int needed = max(cols.bookID, cols.memberID);
+    for (size_t r = 0; r < recs.size(); ++r) {
+        size_t first = recs.firstField[r];
+        int count = (int)(recs.firstField[r + 1] - first);
+        if (count <= needed) {
+            if (!all_of(recs.text[r].begin(), recs.text[r].end(), ::isspace)) shard.skipped++;
+            continue;
+        }
+        auto field = [&](int i, string& buf) {
+            return i >= 0 && i < count ? trimImportField(unquoteCsvField(recs.fields[first + i], buf)) : string_view();
+        };
+
+        int32_t bookID = 0, memberID = 0;
+        string_view s = field(cols.bookID, scratch);
+        from_chars(s.data(), s.data() + s.size(), bookID);
+        s = field(cols.memberID, scratch);
+        from_chars(s.data(), s.data() + s.size(), memberID);
+        if (bookID <= 0 || memberID <= 0) {
+            shard.skipped++;
+            continue;
+        }
+        double fine = 0.0;
+        s = field(cols.fine, scratch);
+        bool hasFine = !s.empty() && s != "NULL" && from_chars(s.data(), s.data() + s.size(), fine).ec == errc();
+        shard.add(bookID, memberID, hasFine ? &fine : nullptr, field(cols.title, titleScratch), field(cols.name, scratch));
+    }
+}
+
+// The n best slots, best first. A heap holding the n best so far keeps this
+// O(keys log n) time and O(n) memory.
+template <typename Better>
+vector<HistorySlot> topHistorySlots(const HistoryMap& map, size_t n, Better better) {
+    priority_queue<HistorySlot, vector<HistorySlot>, Better> heap(better);  // worst of the kept n on top
+    map.forEach([&](const HistorySlot& slot) {
+        if (heap.size() < n) {
+            heap.push(slot);
+        } else if (better(slot, heap.top())) {
+            heap.pop();
+            heap.push(slot);
+        }
+    });
+    vector<HistorySlot> out;
+    out.reserve(heap.size());
+    for (; !heap.empty(); heap.pop()) out.push_back(heap.top());
+    reverse(out.begin(), out.end());
+    return out;
+}
+
+// Same names, headers and value formatting as exportReportsToCSV().
+bool writeHistoryReport(const string& path, const char* header, const vector<HistorySlot>& rows, bool fines,
+                        const function<string_view(const HistorySlot&)>& nameOf) {
+    CsvFileWriter out;
+    if (!out.open(path)) return false;
+    out.line(header);
+    char buf[32];
+    for (const HistorySlot& slot : rows) {
+        out.field(string_view(buf, to_chars(buf, buf + sizeof(buf), slot.key).ptr - buf), true);
+        out.field(nameOf(slot), false);
+        if (!fines) out.field(string_view(buf, to_chars(buf, buf + sizeof(buf), slot.issues).ptr - buf), false);
+        else if (slot.fineRows == 0) out.field("NULL", false);
+        else out.field(string_view(buf, snprintf(buf, sizeof(buf), "%.2f", slot.fine)), false);
+        out.endRow();
+    }
+    return out.close();
+}
+
+// Aggregates a CSV dump: one reader thread feeding threadCount shards.
+bool scanHistoryCsv(const string& path, vector<HistoryShard>& shards) {
+    ifstream file(path, ios::binary);
+    string headerLine;
+    if (!file.is_open() || !getline(file, headerLine)) {
+        cout << "Cannot read " << path << endl;
+        return false;
+    }
+    HistoryColumns cols;
+    if (!findHistoryColumns(headerLine, cols)) {
+        cout << "The header of " << path << " needs BookID and MemberID columns." << endl;
+        return false;
+    }
+
+    BoundedQueue<ImportChunk> chunks(importQueueDepth);
+    thread reader([&] { readCsvChunks(file, chunks, 1); });
+    vector<thread> workers;
+    for (size_t w = 0; w < shards.size(); ++w) {
+        workers.emplace_back([&, w] {
+            ImportChunk chunk;
+            while (chunks.pop(chunk)) aggregateHistoryChunk(chunk, cols, shards[w]);
+        });
+    }
+    reader.join();
+    for (auto& worker : workers) worker.join();
+    return true;
+}
+
+// Aggregates a snapshot's Transactions; each shard takes a contiguous range
+// of the already decoded columns.
+void scanHistorySnapshot(const Snapshot& snapshot, vector<HistoryShard>& shards) {
+    auto& t = snapshot.transactions.columns;
+    size_t rows = snapshot.transactions.rows, per = (rows + shards.size() - 1) / shards.size();
+    vector<thread> workers;
+    for (size_t w = 0; w < shards.size(); ++w) {
+        workers.emplace_back([&, w] {
+            for (size_t r = w * per; r < min(rows, (w + 1) * per); ++r) {
+                double fine = t[TransactionsFineAmount].ints[r] / 100.0;
+                shards[w].add((int32_t)t[TransactionsBookID].ints[r], (int32_t)t[TransactionsMemberID].ints[r], t[TransactionsFineAmount].isNull(r) ? nullptr : &fine,
+                              string_view(), string_view());
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+}
+
+// The name column of an ID in a snapshot table sorted by that ID.
+string_view snapshotName(const SnapshotTable& table, size_t nameColumn, int32_t id) {
+    auto& ids = table.columns[0].ints;
+    auto it = lower_bound(ids.begin(), ids.end(), (int64_t)id);
+    if (it == ids.end() || *it != id || table.columns[nameColumn].isNull(it - ids.begin())) return string_view();
+    return table.columns[nameColumn].texts[it - ids.begin()];
+}
+
+// Ranks a transactions dump, either a CSV export or a library snapshot, into
+// top_issued_books.csv, active_members.csv and fine_summary.csv under outDir.
+// topN = 0 keeps every row. A snapshot also holds Books and Members, so books
+// and members with no transactions are listed with 0 (and a NULL fine) as the
+// LEFT JOINs of exportReportsToCSV() list them; a CSV dump only has the
+// transactions, so they are left out.
+bool analyzeTransactionHistory(const string& path, size_t topN, size_t threadCount, const string& outDir) {
+    char magic[sizeof(snapshotMagic)] = {};
+    ifstream(path, ios::binary).read(magic, sizeof(magic));
+    Snapshot snapshot;
+    bool fromSnapshot = memcmp(magic, snapshotMagic, sizeof(magic)) == 0;
+
+    auto start = chrono::steady_clock::now();
+    threadCount = max<size_t>(1, threadCount);
+    vector<HistoryShard> shards(threadCount);
+    if (fromSnapshot) {
+        string error;
+        if (!snapshot.open(path, error)) {
+            cout << error << endl;
+            return false;
+        }
+        scanHistorySnapshot(snapshot, shards);
+    } else if (!scanHistoryCsv(path, shards)) {
+        return false;
+    }
+    for (size_t w = 1; w < shards.size(); ++w) {
+        shards[0].books.merge(shards[w].books);
+        shards[0].members.merge(shards[w].members);
+        shards[0].rows += shards[w].rows;
+        shards[0].skipped += shards[w].skipped;
+    }
+    if (fromSnapshot) {
+        for (size_t r = 0; r < snapshot.books.rows; ++r) shards[0].books.at((int32_t)snapshot.books.columns[BooksBookID].ints[r]);
+        for (size_t r = 0; r < snapshot.members.rows; ++r) shards[0].members.at((int32_t)snapshot.members.columns[MembersMemberID].ints[r]);
+    }
+    const HistoryShard& total = shards[0];
+    double scanMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    auto mostIssues = [](const HistorySlot& a, const HistorySlot& b) {
+        return a.issues != b.issues ? a.issues > b.issues : a.key < b.key;
+    };
+    auto mostFines = [](const HistorySlot& a, const HistorySlot& b) {
+        if ((a.fineRows > 0) != (b.fineRows > 0)) return a.fineRows > 0;  // NULL sums rank last
+        return a.fine != b.fine ? a.fine > b.fine : a.key < b.key;
+    };
+    auto title = [&](const HistorySlot& slot) {
+        return fromSnapshot ? snapshotName(snapshot.books, BooksTitle, slot.key) : total.books.nameOf(slot);
+    };
+    auto name = [&](const HistorySlot& slot) {
+        return fromSnapshot ? snapshotName(snapshot.members, MembersName, slot.key) : total.members.nameOf(slot);
+    };
+    string base = outDir.empty() ? string() : outDir + pathSeparator;
+    bool ok = writeHistoryReport(base + "top_issued_books.csv", "BookID,Title,IssueCount",
+                                 topHistorySlots(total.books, topN ? topN : total.books.size(), mostIssues), false, title) &&
+              writeHistoryReport(base + "active_members.csv", "MemberID,Name,BooksIssued",
+                                 topHistorySlots(total.members, topN ? topN : total.members.size(), mostIssues), false, name) &&
+              writeHistoryReport(base + "fine_summary.csv", "MemberID,Name,TotalFine",
+                                 topHistorySlots(total.members, topN ? topN : total.members.size(), mostFines), true, name);
+    double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << total.rows << " transactions (" << total.skipped << " skipped), " << total.books.size() << " books, "
+         << total.members.size() << " members" << endl;
+    cout << fixed << setprecision(1) << "Scan " << scanMs << " ms on " << threadCount << " thread(s), total " << totalMs << " ms" << endl;
+    cout.unsetf(ios::floatfield);
+    if (!fromSnapshot) cout << "Books and members with no transactions are not in a CSV dump and are left out." << endl;
+    if (!ok) cout << "Failed to write the reports to " << (outDir.empty() ? "." : outDir) << endl;
+    else cout << "Wrote top_issued_books.csv, active_members.csv and fine_summary.csv to " << (outDir.empty() ? "." : outDir) << endl;
+    return ok;
+}
+
+void bulkImportBooks() {
+    char cwd[256];
+    if (_getcwd(cwd, sizeof(cwd)) == nullptr) {
+        cout << "Error retrieving current directory: " << strerror(errno) << endl;
+        return;
+    }
+
+    string filename = "books.csv";
+    int attempts = 3;
+    ifstream file;
+
+    while (attempts > 0) {
+        file.open(filename);
+        if (!file.is_open()) {
+            cout << "Failed to open " << filename << " in " << cwd << ": " << strerror(errno) << endl;
+            attempts--;
+
+            if (attempts == 0) {
+                cout << "Trying fallback path..." << endl;
+                filename = "C:\\task_4\\books.csv";
+                file.open(filename);
+                if (!file.is_open()) {
+                    cout << "Failed to open fallback file " << filename << ": " << strerror(errno) << endl;
+                    cout << "Please enter the full path to books.csv (or 'q' to quit): ";
+                    cin >> filename;
+                    if (filename == "q" || filename == "Q") {
+                        cout << "Bulk import aborted." << endl;
+                        return;
+                    }
+                    continue;
+                }
+            } else {
+                cout << "Attempts remaining: " << attempts
+                     << ". Please ensure books.csv exists in " << cwd
+                     << " or enter the full path (or 'q' to quit): ";
+                cin >> filename;
+                if (filename == "q" || filename == "Q") {
+                    cout << "Bulk import aborted." << endl;
+                    return;
+                }
+                continue;
+            }
+        } else {
+            // File opened successfully, break the loop
+            break;
+        }
+    }
+
+    if (!file.is_open()) {
+        cout << "Unable to open books.csv after multiple attempts." << endl;
+        return;
+    }
+
+    cout << "Reading books from " << filename << endl;
+
+    size_t batchSize = defaultImportBatchSize;
+    string batchInput;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cout << "Rows per batch [" << defaultImportBatchSize << "]: ";
+    getline(cin, batchInput);
+    if (!batchInput.empty()) {
+        try {
+            batchSize = max(1, stoi(batchInput));
+        } catch (...) {
+            cout << "Invalid batch size, using " << defaultImportBatchSize << endl;
+        }
+    }
+
+    // The import runs in the background; the desk can keep working meanwhile.
+    auto input = make_shared<ifstream>(move(file));
+    backgroundJobs.start("Bulk Import " + filename, [input, batchSize] {
+        size_t booksAdded = importBooksPipelined(*input, batchSize);
+        statusOut() << (jobCancelled() ? "Bulk import cancelled. Added " : "Bulk import completed. Added ") << booksAdded << " books." << endl;
+        return true;
+    });
+}
+
+void booksMenu() {
+    int choice;
+    do {
+        cout << "\n=== Books Management ===\n";
+        cout << "1. Add Book\n";
+        cout << "2. Update Book\n";
+        cout << "3. Delete Book\n";
+        cout << "4. View Books\n";
+        cout << "5. Search Books\n";
+        cout << "6. Bulk Import Books\n";
+        cout << "7. Back to Main Menu\n";
+        cout << "Enter your choice (1-7): ";
+        cin >> choice;
+
+        while (cin.fail() || choice < 1 || choice > 7) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid choice! Please enter a number between 1 and 7: ";
+            cin >> choice;
+        }
+
+        switch (choice) {
+            case 1: addBook(); break;
+            case 2: updateBook(); break;
+            case 3: deleteBook(); break;
+            case 4: viewBooks(); break;
+            case 5: searchBooks(); break;
+            case 6: bulkImportBooks(); break;
+            case 7: cout << "Returning to main menu...\n"; break;
+        }
+    } while (choice != 7);
+}
+
+ 
+void addMember() {
+    string name, email, type, role, pass;
+
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');  // Clear leftover input
+    cout << "Enter Name: ";
+    getline(cin, name);
+    cout << "Enter Email: ";
+    getline(cin, email);
+    cout << "Enter Type (Regular/Premium): ";
+    getline(cin, type);
+    cout << "Enter Role (Admin/User): ";
+    getline(cin, role);
+    cout << "Enter Password: ";
+    getline(cin, pass);
+
+    // Normalize input
+    transform(type.begin(), type.end(), type.begin(), ::tolower);
+    transform(role.begin(), role.end(), role.begin(), ::tolower);
+
+    if (type != "regular" && type != "premium") {
+        cout << "Invalid Type! Use 'Regular' or 'Premium'.\n";
+        return;
+    }
+    if (role != "admin" && role != "user") {
+        cout << "Invalid Role! Use 'Admin' or 'User'.\n";
+        return;
+    }
+    if (name.empty() || email.empty() || pass.empty()) {
+        cout << "Name, Email, and Password are required!\n";
+        return;
+    }
+
+    ResultSet res = fetchResultSet("SELECT Email FROM dbo.Members WHERE Email = ?", {email});
+    if (!res.empty()) {
+        cout << "Email already exists!\n";
+        return;
+    }
+
+    string query = "INSERT INTO dbo.Members (Name, Email, MembershipType, Role, Password) "
+                   "OUTPUT INSERTED.MemberID VALUES (?, ?, ?, ?, ?)";
+
+    ResultSet inserted = fetchResultSet(query, {name, email, type, role, pass});
+    int newID = 0;
+    if (!inserted.empty() && parseId(inserted.cellString(0, 0), newID)) {
+        memberDirectory.reloadMember(newID);
+        cout << "Member added successfully!\n";
+    } else {
+        cout << "Failed to add member.\n";
+    }
+}
+ 
+ 
+void updateMember() {
+    string memberID;
+    cout << "Enter MemberID: ";
+    cin >> memberID;
+
+    if (!all_of(memberID.begin(), memberID.end(), ::isdigit)) {
+        cout << "MemberID must be numeric!" << endl;
+        return;
+    }
+
+    ResultSet res = fetchResultSet("SELECT MemberID FROM dbo.Members WHERE MemberID = ?", {memberID});
+    if (res.empty()) {
+        cout << "Member not found!" << endl;
+        return;
+    }
+
+    string name, email, type;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');  // Clear input buffer
+
+    cout << "Enter new Name (leave blank to skip): ";
+    getline(cin, name);
+    cout << "Enter new Email (leave blank to skip): ";
+    getline(cin, email);
+    cout << "Enter new Type (Regular/Premium, leave blank to skip): ";
+    getline(cin, type);
+
+    string query = "UPDATE dbo.Members SET ";
+    vector<SqlParam> params;
+    bool hasUpdate = false;
+
+    if (!name.empty()) {
+        query += "Name = ?";
+        params.push_back(name);
+        hasUpdate = true;
+    }
+
+    if (!email.empty()) {
+        ResultSet emailRes = fetchResultSet("SELECT Email FROM dbo.Members WHERE Email = ? AND MemberID != ?", {email, memberID});
+        if (!emailRes.empty()) {
+            cout << "Email already exists!" << endl;
+            return;
+        }
+        if (hasUpdate) query += ", ";
+        query += "Email = ?";
+        params.push_back(email);
+        hasUpdate = true;
+    }
+
+    if (!type.empty()) {
+        // Normalize type (case-insensitive)
+        transform(type.begin(), type.end(), type.begin(), ::tolower);
+        if (type != "regular" && type != "premium") {
+            cout << "Invalid Type! Use 'Regular' or 'Premium'." << endl;
             return;
         }
         type[0] = toupper(type[0]);  // Capitalize for DB consistency
 
-        if (hasUpdate) query += ", ";
-        query += "MembershipType = '" + type + "'";
-        hasUpdate = true;
+        if (hasUpdate) query += ", ";
+        query += "MembershipType = ?";
+        params.push_back(type);
+        hasUpdate = true;
+    }
+
+    if (!hasUpdate) {
+        cout << "No changes provided!" << endl;
+        return;
+    }
+
+    query += " WHERE MemberID = ?";
+    params.push_back(memberID);
+
+    if (runQuery(query, params)) {
+        memberDirectory.reloadMember(stoi(memberID));
+        cout << "Member updated successfully!" << endl;
+    } else {
+        cout << "Failed to update member." << endl;
+    }
+}
+void deleteMember() {
+    string memberID;
+    cout << "Enter MemberID: ";
+    cin >> memberID;
+
+    if (!all_of(memberID.begin(), memberID.end(), ::isdigit)) {
+        cout << "MemberID must be numeric!" << endl;
+        return;
+    }
+
+    ResultSet res = fetchResultSet("SELECT MemberID FROM dbo.Members WHERE MemberID = ?", {memberID});
+    if (res.empty()) {
+        cout << "Member not found!" << endl;
+        return;
+    }
+
+    if (runQuery("DELETE FROM dbo.Members WHERE MemberID = ?", {memberID})) {
+        memberDirectory.reloadMember(stoi(memberID));
+        cout << "Member deleted successfully!" << endl;
+    } else {
+        cout << "Failed to delete member." << endl;
+    }
+}
+
+void viewMembers() {
+    PageQuery members;
+    members.columns = columnList<membersTable, ColumnList::View>;
+    members.from = membersTable.table;
+    members.keyColumn = membersTable.columns[MembersMemberID].name;
+    showPaged(members, membersView);
+}
+
+void searchMembers() {
+    string value;
+    cout << "Enter Name or Email to search: ";
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    getline(cin, value);
+
+    auto start = chrono::steady_clock::now();
+    auto matches = memberDirectory.search(value);
+    auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+    ResultSet res;
+    addViewColumns(membersTable, res);
+    for (const auto& m : matches) addViewRow(membersTable, res, m);
+
+    if (res.empty()) {
+        cout << "No matching members found." << endl;
+        return;
+    }
+
+    cout << matches.size() << " match(es) in " << micros << " us" << endl;
+    showPaginated(res, membersView);
+}
+
+void membersMenu() {
+    int choice;
+    do {
+        cout << "\n===== Members Management =====\n";
+        cout << "1. Add Member\n";
+        cout << "2. Update Member\n";
+        cout << "3. Delete Member\n";
+        cout << "4. View Members\n";
+        cout << "5. Search Members\n";
+        cout << "6. Back to Main Menu\n";
+        cout << "Choice: ";
+        cin >> choice;
+
+        while (cin.fail() || choice < 1 || choice > 6) {
+            cout << "Invalid choice! Try again: ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cin >> choice;
+        }
+
+        switch (choice) {
+            case 1: addMember(); break;
+            case 2: updateMember(); break;
+            case 3: deleteMember(); break;
+            case 4: viewMembers(); break;
+            case 5: searchMembers(); break;
+            case 6: cout << "Returning to main menu...\n"; break;
+        }
+    } while (choice != 6);
+}
+
+ 
+// Prints how long each step of an issue or return took.
+void printCirculationTimings(const CirculationResult& result) {
+    double total = 0;
+    for (auto& step : result.steps) total += step.second;
+    cout << fixed << setprecision(2) << "  (" << total << " ms:";
+    for (size_t i = 0; i < result.steps.size(); ++i) {
+        cout << (i ? ", " : " ") << result.steps[i].first << " " << result.steps[i].second << " ms";
+    }
+    cout << ")" << endl;
+    cout.unsetf(ios::floatfield);
+}
+
+// ---- Desk journal (--journal) ----
+// Write-behind for issue, return and reserve. The desk checks an operation
+// against the caches, appends it to a local journal and answers as soon as the
+// record is on disk; a flusher thread replays the journal to the database in
+// sequence order. A slow or unreachable database then holds up the flusher,
+// not the desk.
+//
+// File layout: JournalFileHeader, then fixed-size JournalRecords, each with a
+// CRC so a record torn by a crash is recognised and dropped. Desk threads queue
+// records for one syncer thread, which writes everything queued since its last
+// sync and syncs the file once for all of them (group commit). An operation is
+// replayed under the key "<journal id>-<seq>", which goes into JournalApplied
+// in the same transaction; if the process dies between that commit and the
+// Applied marker, the second replay finds the key and writes nothing.
+const char journalMagic[8] = {'L', 'I', 'B', 'J', 'R', 'N', 'L', 0};
+const uint32_t journalVersion = 1;
+const size_t journalReplayBatch = 64;
+const int journalReplayAttempts = 5;              // before a record the database keeps failing is set aside
+const chrono::seconds journalRetryDelay(5);       // after the database could not be reached
+const uint64_t journalCompactBytes = 1 << 20;     // rewrite once everything is applied and the file is this big
+const size_t journalConflictsKept = 20;
+
+enum class JournalKind : uint32_t { Issue = 1, Return = 2, Reserve = 3, Applied = 4 };
+
+struct JournalFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t journalID;  // random, so keys from two journals never collide
+    uint64_t nextSeq;    // sequence numbers below this were used before the file was rewritten
+};
+
+struct JournalRecord {
+    uint64_t seq;            // Applied: the operation it settles
+    int64_t acceptedMillis;  // Unix epoch milliseconds
+    JournalKind kind;
+    int32_t bookID;
+    int32_t memberID;
+    int32_t transactionID;   // Return: the loan, or -seq of an issue made through the journal; Applied: the loan written
+    int32_t outcome;         // Applied: the CirculationStatus of the replay
+    uint32_t crc;            // CRC-32 of the bytes before it
+};
+static_assert(sizeof(JournalFileHeader) == 32 && sizeof(JournalRecord) == 40, "journal structs are written as-is");
+
+uint32_t crc32(const void* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// Flushes a stream and forces what it wrote onto the disk.
+bool syncFile(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+    return fdatasync(fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Renames from over to in one step, so a crash leaves one file or the other.
+bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+const char* journalKindName(JournalKind kind) {
+    switch (kind) {
+        case JournalKind::Issue: return "Issue";
+        case JournalKind::Return: return "Return";
+        case JournalKind::Reserve: return "Reserve";
+        case JournalKind::Applied: return "Applied";
+    }
+    return "?";
+}
+
+// A loan the desk journal knows to be out.
+struct OpenLoan {
+    int bookID;
+    int memberID;
+};
+
+// An operation the desk accepted that the database then refused.
+struct JournalConflict {
+    JournalRecord op;
+    CirculationStatus status;
+};
+
+class DeskJournal {
+public:
+    ~DeskJournal() { close(); }
+
+    bool enabled() const { return active; }
+
+    // Reads back an existing journal (or starts one), keeps the operations with
+    // no Applied marker, rewrites the file with just those and starts replaying.
+    bool open(const string& filePath) {
+        path = filePath;
+        bool ready = withConnection([](StorageConnection& conn) { return conn.ensureJournalTable(); }, ConnectionRetry::Idempotent);
+        if (!ready) {
+            cout << "Failed to create the JournalApplied table." << endl;
+            return false;
+        }
+        JournalFileHeader header = {};
+        size_t settled = 0;
+        bool torn = false;
+        if (FILE* in = fopen(path.c_str(), "rb")) {
+            bool valid = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, journalMagic, sizeof(journalMagic)) == 0 &&
+                         header.version == journalVersion;
+            if (!valid) {
+                fclose(in);
+                cout << path << " is not a desk journal." << endl;
+                return false;
+            }
+            map<uint64_t, JournalRecord> waiting;
+            nextSeq = header.nextSeq;
+            JournalRecord rec;
+            size_t got;
+            while ((got = fread(&rec, 1, sizeof(rec), in)) > 0) {
+                if (got < sizeof(rec) || crc32(&rec, offsetof(JournalRecord, crc)) != rec.crc) {
+                    torn = true;
+                    break;
+                }
+                if (rec.kind == JournalKind::Applied) {
+                    settled += waiting.erase(rec.seq);
+                } else {
+                    waiting[rec.seq] = rec;
+                    nextSeq = max(nextSeq, rec.seq + 1);
+                }
+            }
+            fclose(in);
+            for (auto& entry : waiting) pending.push_back(entry.second);
+        } else {
+            memcpy(header.magic, journalMagic, sizeof(journalMagic));
+            header.version = journalVersion;
+            random_device rd;
+            header.journalID = ((uint64_t)rd() << 32) | rd();
+            nextSeq = 1;
+        }
+        journalID = header.journalID;
+        if (!rewriteLocked()) {
+            cout << "Failed to write " << path << ": " << strerror(errno) << endl;
+            if (file) fclose(file);
+            file = nullptr;
+            return false;
+        }
+        durableSeq = nextSeq - 1;
+        for (auto& op : pending) trackLocked(op);
+        if (!readOpenLoans(openLoans) || !readReplayedIssues()) {
+            cout << "Failed to read the open loans." << endl;
+            return false;
+        }
+        recountLocked();
+
+        cout << "Desk journal " << path << ": " << pending.size() << " operation(s) waiting to replay";
+        if (settled) cout << ", " << settled << " settled since the last rewrite";
+        if (torn) cout << "; dropped a torn record at the end";
+        cout << "." << endl;
+        active = true;
+        syncer = thread([this] { syncLoop(); });
+        flusher = thread([this] { flushLoop(); });
+        return true;
+    }
+
+    // Stops both threads once everything accepted is on disk. Operations not yet
+    // replayed stay in the file for the next start.
+    void close() {
+        if (!active) return;
+        drain(chrono::seconds(5));
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        syncWake.notify_all();
+        flushWake.notify_all();
+        flusher.join();
+        syncer.join();
+        if (file) fclose(file);
+        file = nullptr;
+        active = false;
+        if (!pending.empty()) {
+            cout << pending.size() << " journaled operation(s) not yet in the database; they replay on the next start with --journal " << path
+                 << endl;
+        }
+    }
+
+    // Waits until every accepted operation is replayed, or for at most timeout
+    // while the database is unreachable. True if nothing is left.
+    bool drain(chrono::steady_clock::duration timeout) {
+        unique_lock<mutex> lock(mtx);
+        auto deadline = chrono::steady_clock::now() + timeout;
+        settledWake.wait_until(lock, deadline, [&] { return (pending.empty() && unsynced.empty()) || linkDown || writeFailed; });
+        return pending.empty();
+    }
+
+    CirculationResult acceptIssue(int bookID, int memberID) {
+        CirculationResult result;
+        result.bookID = bookID;
+        result.memberID = memberID;
+        result.maxBooks = configService.current().maxBooksPerMember;
+        StepTimer timer(result.steps);
+        CachedBook book;
+        Member member;
+        bool found = catalogCache.find(bookID, book) && memberDirectory.find(memberID, member);
+        timer.mark("check");
+        if (!found) {
+            result.status = CirculationStatus::NotFound;
+            return result;
+        }
+
+        unique_lock<mutex> lock(mtx);
+        if (book.availability == "No" || issuedBooks.count(bookID)) {
+            result.status = CirculationStatus::Unavailable;
+            return result;
+        }
+        if (memberLoans[memberID] >= result.maxBooks) {
+            result.status = CirculationStatus::LimitReached;
+            return result;
+        }
+        uint64_t seq = appendLocked(JournalKind::Issue, bookID, memberID, 0);
+        if (!seq) return result;
+        issuedBooks[bookID] = seq;
+        memberLoans[memberID]++;
+        if (!waitDurable(lock, seq, result, timer)) {
+            issuedBooks.erase(bookID);
+            memberLoans[memberID]--;
+            return result;
+        }
+        // The loan gets its real TransactionID on replay; until then -seq stands in for it.
+        result.transactionID = -(int)seq;
+        catalogCache.setAvailability(bookID, "No");
+        return result;
+    }
+
+    CirculationResult acceptReturn(int transactionID) {
+        CirculationResult result;
+        result.transactionID = transactionID;
+        StepTimer timer(result.steps);
+        unique_lock<mutex> lock(mtx);
+        // A stand-in ID must name an issue from this journal, still waiting or
+        // replayed into a loan, which it then stands for; a real one an open loan.
+        const JournalRecord* issue = nullptr;
+        if (transactionID < 0) {
+            uint64_t issueSeq = (uint64_t)-(int64_t)transactionID;
+            auto it = lower_bound(pending.begin(), pending.end(), issueSeq, [](const JournalRecord& r, uint64_t seq) { return r.seq < seq; });
+            if (it != pending.end() && it->seq == issueSeq) issue = &*it;
+            if (issueSeq >= nextSeq || (issue && issue->kind != JournalKind::Issue)) transactionID = 0;
+            if (!issue && transactionID) {
+                auto replayed = replayedIssues.find(issueSeq);
+                transactionID = replayed == replayedIssues.end() ? 0 : replayed->second;
+                result.transactionID = transactionID;
+            }
+        }
+        if (transactionID > 0) {
+            auto loan = openLoans.find(transactionID);
+            if (loan == openLoans.end()) {
+                transactionID = 0;
+            } else {
+                result.bookID = loan->second.bookID;
+                result.memberID = loan->second.memberID;
+            }
+        }
+        if (transactionID == 0 || returningLoans.count(transactionID)) {
+            result.status = CirculationStatus::NotFound;
+            return result;
+        }
+        if (issue) {
+            result.bookID = issue->bookID;
+            result.memberID = issue->memberID;
+        }
+        uint64_t seq = appendLocked(JournalKind::Return, result.bookID, result.memberID, transactionID);
+        if (!seq) return result;
+        returningLoans.insert(transactionID);
+        if (result.memberID) memberLoans[result.memberID]--;
+        if (!waitDurable(lock, seq, result, timer)) {
+            returningLoans.erase(transactionID);
+            if (result.memberID) memberLoans[result.memberID]++;
+            return result;
+        }
+        if (result.bookID) {
+            auto it = issuedBooks.find(result.bookID);
+            if (it != issuedBooks.end() && (int64_t)it->second == -(int64_t)transactionID) issuedBooks.erase(it);
+            catalogCache.setAvailability(result.bookID, "Yes");
+        }
+        return result;
+    }
+
+    CirculationResult acceptReserve(int bookID, int memberID) {
+        CirculationResult result;
+        result.bookID = bookID;
+        result.memberID = memberID;
+        StepTimer timer(result.steps);
+        CachedBook book;
+        Member member;
+        bool found = catalogCache.find(bookID, book) && memberDirectory.find(memberID, member);
+        timer.mark("check");
+        if (!found) {
+            result.status = CirculationStatus::NotFound;
+            return result;
+        }
+
+        unique_lock<mutex> lock(mtx);
+        if (book.availability == "Yes" && !issuedBooks.count(bookID)) {
+            result.status = CirculationStatus::OnShelf;
+            return result;
+        }
+        uint64_t seq = appendLocked(JournalKind::Reserve, bookID, memberID, 0);
+        if (seq) waitDurable(lock, seq, result, timer);
+        return result;
+    }
+
+    void printStatus() {
+        lock_guard<mutex> lock(mtx);
+        if (!active) {
+            cout << "The desk journal is off; start with --journal <file> to turn it on." << endl;
+            return;
+        }
+        cout << "\n=== Desk Journal ===\n";
+        cout << "File:               " << path << " (" << fileBytes << " bytes)\n";
+        cout << "Journal ID:         " << keyPrefix() << "\n";
+        cout << "On disk:            through #" << durableSeq << "; " << accepted << " accepted in " << syncs << " sync(s) since start\n";
+        cout << "Waiting to replay:  " << pending.size();
+        if (!pending.empty()) {
+            int64_t age = nowMillis() - pending.front().acceptedMillis;
+            cout << " (oldest " << age / 1000 << " s)";
+        }
+        cout << "\nReplayed:           " << applied << "\n";
+        cout << "Conflicts:          " << conflictTotal << "\n";
+        if (!lastError.empty()) cout << "Last error:         " << lastError << "\n";
+        for (auto& c : conflicts) {
+            cout << "  #" << c.op.seq << " " << journalKindName(c.op.kind);
+            if (c.op.kind == JournalKind::Return) cout << " of loan " << c.op.transactionID;
+            else cout << " of book " << c.op.bookID << " to member " << c.op.memberID;
+            cout << ": " << conflictReason(c.op.kind, c.status) << "\n";
+        }
+        seenConflicts = conflictTotal;
+        cout << flush;
+    }
+
+    // One line under the main menu when the database refused something the desk accepted.
+    void printNotice() {
+        lock_guard<mutex> lock(mtx);
+        if (conflictTotal > seenConflicts) {
+            cout << "[journal] " << conflictTotal - seenConflicts << " accepted operation(s) were refused on replay; see Transactions > Desk Journal."
+                 << endl;
+        }
+        if (writeFailed) cout << "[journal] " << lastError << endl;
+    }
+
+private:
+    static int64_t nowMillis() { return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count(); }
+
+    string keyPrefix() const {
+        char id[17];
+        snprintf(id, sizeof(id), "%016llx", (unsigned long long)journalID);
+        return id;
+    }
+    string keyFor(uint64_t seq) const { return keyPrefix() + "-" + to_string(seq); }
+
+    static const char* conflictReason(JournalKind kind, CirculationStatus status) {
+        switch (status) {
+            case CirculationStatus::NotFound: return kind == JournalKind::Return ? "loan not found or already returned" : "book or member not found";
+            case CirculationStatus::Unavailable: return "book was already out";
+            case CirculationStatus::LimitReached: return "member was at the loan limit";
+            case CirculationStatus::OnShelf: return "book was back on the shelf";
+            case CirculationStatus::Done: break;
+            case CirculationStatus::Failed: return "the database kept failing it";
+        }
+        return "";
+    }
+
+    // Queues a record for the syncer. Returns its sequence number, or 0 if the
+    // journal is no longer taking operations.
+    uint64_t appendLocked(JournalKind kind, int bookID, int memberID, int transactionID) {
+        if (writeFailed || stopping) return 0;
+        JournalRecord rec = {};
+        rec.seq = nextSeq++;
+        rec.acceptedMillis = nowMillis();
+        rec.kind = kind;
+        rec.bookID = bookID;
+        rec.memberID = memberID;
+        rec.transactionID = transactionID;
+        rec.crc = crc32(&rec, offsetof(JournalRecord, crc));
+        unsynced.push_back(rec);
+        syncWake.notify_one();
+        return rec.seq;
+    }
+
+    bool waitDurable(unique_lock<mutex>& lock, uint64_t seq, CirculationResult& result, StepTimer& timer) {
+        durableWake.wait(lock, [&] { return durableSeq >= seq || writeFailed; });
+        timer.mark("journal");
+        if (durableSeq < seq) return false;
+        result.status = CirculationStatus::Done;
+        result.journalSeq = seq;
+        return true;
+    }
+
+    // What the desk must refuse while op waits: a second issue of the book, a second return of the loan.
+    void trackLocked(const JournalRecord& op) {
+        if (op.kind == JournalKind::Issue) issuedBooks[op.bookID] = op.seq;
+        else if (op.kind == JournalKind::Return) returningLoans.insert(op.transactionID);
+    }
+
+    // The database's loans with Status 'Issued', which the desk checks returns
+    // and loan limits against. Read at open and again after a refusal shows the
+    // desk's view was off; a loan issued elsewhere in between is refused here.
+    static bool readOpenLoans(unordered_map<int, OpenLoan>& loans) {
+        unordered_map<int, OpenLoan> fresh;
+        bool ok = withConnection([&](StorageConnection& conn) {
+            fresh.clear();
+            return conn.fetchBlocks("SELECT TransactionID, BookID, MemberID FROM dbo.Transactions WHERE Status = 'Issued'", {},
+                                    [&](const ResultSet& block) {
+                                        for (size_t r = 0; r < block.size(); ++r) {
+                                            fresh[(int)cellInt(block, r, 0)] = {(int)cellInt(block, r, 1), (int)cellInt(block, r, 2)};
+                                        }
+                                        return true;
+                                    });
+        }, ConnectionRetry::Idempotent);
+        if (ok) loans.swap(fresh);
+        return ok;
+    }
+
+    // The issues of this journal replayed before it was opened, for their stand-in
+    // IDs: the JournalApplied keys that name a loan still open.
+    bool readReplayedIssues() {
+        string prefix = keyPrefix() + "-";
+        return withConnection([&](StorageConnection& conn) {
+            replayedIssues.clear();
+            return conn.fetchBlocks("SELECT JournalKey, TransactionID FROM dbo.JournalApplied WHERE JournalKey LIKE ?", {prefix + "%"},
+                                    [&](const ResultSet& block) {
+                                        for (size_t r = 0; r < block.size(); ++r) {
+                                            int transactionID = (int)cellInt(block, r, 1);
+                                            if (!openLoans.count(transactionID)) continue;
+                                            uint64_t seq = strtoull(string(block.text(r, 0).substr(prefix.size())).c_str(), nullptr, 10);
+                                            replayedIssues[seq] = transactionID;
+                                        }
+                                        return true;
+                                    });
+        }, ConnectionRetry::Idempotent);
+    }
+
+    // Loans out per member: the open loans, plus the issues waiting here, less
+    // the returns waiting for them. Stand-ins for loans since closed are dropped.
+    void recountLocked() {
+        for (auto it = replayedIssues.begin(); it != replayedIssues.end();) {
+            if (openLoans.count(it->second)) ++it;
+            else it = replayedIssues.erase(it);
+        }
+        memberLoans.clear();
+        for (auto& loan : openLoans) memberLoans[loan.second.memberID]++;
+        auto count = [&](const JournalRecord& op) {
+            if (op.kind == JournalKind::Issue) memberLoans[op.memberID]++;
+            else if (op.kind == JournalKind::Return && op.memberID) memberLoans[op.memberID]--;
+        };
+        for (auto& op : pending) count(op);
+        for (auto& op : unsynced) count(op);
+    }
+
+    // Writes the header and the waiting operations to a new file and swaps it in.
+    bool rewriteLocked() {
+        string tempPath = path + ".tmp";
+        JournalFileHeader header = {};
+        memcpy(header.magic, journalMagic, sizeof(journalMagic));
+        header.version = journalVersion;
+        header.journalID = journalID;
+        header.nextSeq = nextSeq;
+        vector<JournalRecord> ops(pending.begin(), pending.end());
+        FILE* out = fopen(tempPath.c_str(), "wb");
+        bool ok = out && fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(ops.data(), sizeof(JournalRecord), ops.size(), out) == ops.size() &&
+                  syncFile(out);
+        if (out && fclose(out) != 0) ok = false;
+        if (file) fclose(file);
+        if (ok) ok = replaceFile(tempPath, path);
+        else remove(tempPath.c_str());
+        if (ok) fileBytes = sizeof(header) + ops.size() * sizeof(JournalRecord);
+        file = fopen(path.c_str(), "ab");
+        return ok && file;
+    }
+
+    // Group commit: every record queued while the previous sync ran goes out in one write and one sync.
+    void syncLoop() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            syncWake.wait(lock, [&] { return stopping || !unsynced.empty(); });
+            if (unsynced.empty()) break;
+            vector<JournalRecord> batch;
+            batch.swap(unsynced);
+            lock.unlock();
+            bool ok = fwrite(batch.data(), sizeof(JournalRecord), batch.size(), file) == batch.size() && syncFile(file);
+            int error = errno;
+            lock.lock();
+            if (!ok) {
+                // The file may now end in part of a record; stop taking operations
+                // rather than append after it. A restart drops the torn tail.
+                writeFailed = true;
+                lastError = "Writing " + path + " failed (" + strerror(error) + "); the desk journal is refusing operations.";
+                durableWake.notify_all();
+                settledWake.notify_all();
+                continue;
+            }
+            syncs++;
+            fileBytes += batch.size() * sizeof(JournalRecord);
+            for (auto& rec : batch) {
+                if (rec.kind == JournalKind::Applied) continue;
+                pending.push_back(rec);
+                durableSeq = rec.seq;
+                accepted++;
+            }
+            durableWake.notify_all();
+            flushWake.notify_one();
+            if (pending.empty() && unsynced.empty()) {
+                settledWake.notify_all();
+                if (fileBytes > journalCompactBytes && !rewriteLocked()) {
+                    lastError = "Failed to compact " + path + ".";
+                    if (!file) writeFailed = true;
+                }
+            }
+        }
+    }
+
+    // Replays waiting operations in sequence order, a batch at a time on one
+    // connection, and queues an Applied marker for each.
+    void flushLoop() {
+        ostream discard(nullptr);  // connection errors show up as lastError instead of on the desk's screen
+        jobOutput = &discard;
+        unique_lock<mutex> lock(mtx);
+        while (!stopping) {
+            if (pending.empty() || writeFailed) {
+                flushWake.wait(lock);
+                continue;
+            }
+            if (chrono::steady_clock::now() < retryAt) {
+                flushWake.wait_until(lock, retryAt);
+                continue;
+            }
+            vector<JournalRecord> batch(pending.begin(), pending.begin() + min(pending.size(), journalReplayBatch));
+            lock.unlock();
+            vector<CirculationResult> results;
+            bool broken = false;
+            replay(batch, results, broken);
+            lock.lock();
+
+            linkDown = broken;
+            if (results.size() < batch.size()) {
+                // Keep the order: nothing after a record that failed is replayed before it.
+                // A record the database keeps refusing (not a lost link) is set aside in the end.
+                uint64_t seq = batch[results.size()].seq;
+                stalledAttempts = seq == stalledSeq ? stalledAttempts + 1 : 1;
+                stalledSeq = seq;
+                if (!broken && stalledAttempts >= journalReplayAttempts) {
+                    results.emplace_back();
+                } else {
+                    lastError = broken ? "Database unreachable; " + to_string(pending.size() - results.size()) + " operation(s) waiting."
+                                       : "Replay of #" + to_string(seq) + " failed; retrying.";
+                    retryAt = chrono::steady_clock::now() + journalRetryDelay;
+                    settledWake.notify_all();
+                }
+            } else {
+                lastError.clear();
+            }
+            vector<int> recheck = settleLocked(batch, results);
+            if (!recheck.empty() || loansStale) {
+                // The desk's optimistic view of these books and loans was wrong; read them back.
+                lock.unlock();
+                CachedBook book;
+                for (int bookID : recheck) catalogCache.reloadBook(bookID, book);
+                unordered_map<int, OpenLoan> loans;
+                bool reread = loansStale && readOpenLoans(loans);
+                lock.lock();
+                if (reread) {
+                    openLoans.swap(loans);
+                    recountLocked();
+                    loansStale = false;
+                }
+            }
+        }
+        jobOutput = nullptr;
+    }
+
+    // Stops at the first record that failed; broken says whether the link went.
+    void replay(const vector<JournalRecord>& batch, vector<CirculationResult>& results, bool& broken) {
+        OperationMetrics op("journal_replay");
+        ConnectionLease lease;
+        if (!lease) {
+            broken = true;
+            return;
+        }
+        const Config& config = configService.current();
+        for (const JournalRecord& rec : batch) {
+            CirculationResult result = replayOne(*lease, rec, config);
+            if (result.status == CirculationStatus::Failed) {
+                broken = lease->broken;
+                return;
+            }
+            results.push_back(result);
+        }
+    }
+
+    CirculationResult replayOne(StorageConnection& conn, const JournalRecord& rec, const Config& config) {
+        string key = keyFor(rec.seq);
+        switch (rec.kind) {
+            case JournalKind::Issue: return conn.issueBook(rec.bookID, rec.memberID, config, key);
+            case JournalKind::Reserve: return conn.reserveBook(rec.bookID, rec.memberID, config, key);
+            case JournalKind::Return: {
+                int transactionID = rec.transactionID;
+                if (transactionID < 0) {
+                    // The issue was replayed before this, and its key records the loan it became.
+                    ResultSet loan;
+                    string issueKey = keyFor((uint64_t)-(int64_t)transactionID);
+                    if (!conn.fetch("SELECT TransactionID FROM dbo.JournalApplied WHERE JournalKey = ?", {issueKey}, loan)) return CirculationResult();
+                    transactionID = loan.empty() ? 0 : atoi(loan.cellString(0, 0).c_str());
+                }
+                CirculationResult result;
+                result.status = CirculationStatus::NotFound;
+                return transactionID ? conn.returnBook(transactionID, config, key) : result;
+            }
+            case JournalKind::Applied: break;
+        }
+        return CirculationResult();
+    }
+
+    // Brings the caches and report aggregates up to date with what was written,
+    // and queues the Applied markers, which reach the disk with the next sync.
+    // Returns the books of operations that were refused.
+    vector<int> settleLocked(const vector<JournalRecord>& batch, const vector<CirculationResult>& results) {
+        vector<int> recheck;
+        for (size_t i = 0; i < results.size(); ++i) {
+            const JournalRecord& op = batch[i];
+            const CirculationResult& result = results[i];
+            auto issued = issuedBooks.find(op.bookID);
+            bool stillOut = issued != issuedBooks.end() && issued->second == op.seq;
+            if (op.kind == JournalKind::Issue && stillOut) issuedBooks.erase(issued);
+            if (op.kind == JournalKind::Return) {
+                returningLoans.erase(op.transactionID);
+                returningLoans.erase(result.transactionID);
+                if (op.transactionID < 0) replayedIssues.erase((uint64_t)-(int64_t)op.transactionID);
+            }
+
+            if (result.status == CirculationStatus::Done) {
+                applied++;
+                if (op.kind == JournalKind::Issue) {
+                    if (!result.replayed) openLoans[result.transactionID] = {op.bookID, op.memberID};
+                    // The stand-in now names the loan; a return of it already waiting covers both.
+                    replayedIssues[op.seq] = result.transactionID;
+                    if (returningLoans.count(-(int)op.seq)) returningLoans.insert(result.transactionID);
+                }
+                if (op.kind == JournalKind::Return) openLoans.erase(result.transactionID);
+                // A stand-in loan returned at the desk already put the book back on the shelf.
+                if (op.kind == JournalKind::Issue && stillOut) catalogCache.setAvailability(op.bookID, "No");
+                if (op.kind == JournalKind::Return) catalogCache.setAvailability(result.bookID, "Yes");
+                if (!result.replayed) {
+                    if (op.kind == JournalKind::Return) reportAggregates.recordReturn(result.memberID, result.fine);
+                    else reportAggregates.recordLoan(op.bookID, op.memberID);
+                }
+            } else {
+                conflictTotal++;
+                loansStale = true;
+                conflicts.push_back({op, result.status});
+                if (conflicts.size() > journalConflictsKept) conflicts.pop_front();
+                if (op.bookID) recheck.push_back(op.bookID);
+            }
+
+            JournalRecord marker = {};
+            marker.seq = op.seq;
+            marker.acceptedMillis = nowMillis();
+            marker.kind = JournalKind::Applied;
+            marker.bookID = op.bookID;
+            marker.memberID = op.memberID;
+            marker.transactionID = result.transactionID;
+            marker.outcome = (int32_t)result.status;
+            marker.crc = crc32(&marker, offsetof(JournalRecord, crc));
+            unsynced.push_back(marker);
+            pending.pop_front();
+        }
+        if (!results.empty()) syncWake.notify_one();
+        return recheck;
+    }
+
+    string path;
+    FILE* file = nullptr;
+    uint64_t journalID = 0;
+    uint64_t fileBytes = 0;
+
+    mutex mtx;
+    condition_variable syncWake, durableWake, flushWake, settledWake;
+    vector<JournalRecord> unsynced;     // queued for the syncer
+    deque<JournalRecord> pending;       // on disk, not yet replayed, in sequence order
+    unordered_map<int, uint64_t> issuedBooks;  // book -> seq of its waiting issue
+    unordered_set<int> returningLoans;         // loans with a waiting return
+    unordered_map<int, OpenLoan> openLoans;    // TransactionID -> open loan in the database
+    unordered_map<int, int> memberLoans;       // member -> loans out or waiting to go out
+    unordered_map<uint64_t, int> replayedIssues;  // seq of a replayed issue -> the loan its stand-in ID names
+    bool loansStale = false;                   // a refusal showed openLoans to be off
+    uint64_t nextSeq = 1;
+    uint64_t durableSeq = 0;
+    size_t accepted = 0, syncs = 0, applied = 0, conflictTotal = 0, seenConflicts = 0;
+    deque<JournalConflict> conflicts;
+    string lastError;
+    bool active = false;
+    bool writeFailed = false;
+    bool linkDown = false;
+    bool stopping = false;
+    chrono::steady_clock::time_point retryAt;
+    uint64_t stalledSeq = 0;
+    int stalledAttempts = 0;
+    thread syncer, flusher;
+};
+DeskJournal deskJournal;
+
+// The circulation operations without the console around them, shared by the
+// menus and the server. Each keeps the catalogue and report aggregates in step.
+// With --journal they go to the desk journal instead and reach the database later.
+CirculationResult issueLoan(int bookID, int memberID) {
+    OperationMetrics op("issue");
+    if (deskJournal.enabled()) return deskJournal.acceptIssue(bookID, memberID);
+    // Validation, the loan limit and both writes happen atomically in the backend.
+    const Config& config = configService.current();
+    CirculationResult result;
+    withConnection([&](StorageConnection& conn) {
+        result = conn.issueBook(bookID, memberID, config, "");
+        return result.status != CirculationStatus::Failed;
+    });
+    StepTimer timer(result.steps);
+    if (result.status == CirculationStatus::Done) {
+        catalogCache.setAvailability(bookID, "No");
+        reportAggregates.recordLoan(bookID, memberID);
+    } else if (result.status == CirculationStatus::Unavailable) {
+        catalogCache.setAvailability(bookID, "No");
+    }
+    timer.mark("cache");
+    return result;
+}
+
+CirculationResult returnLoan(int transactionID) {
+    OperationMetrics op("return");
+    if (deskJournal.enabled()) return deskJournal.acceptReturn(transactionID);
+    const Config& config = configService.current();
+    CirculationResult result;
+    withConnection([&](StorageConnection& conn) {
+        result = conn.returnBook(transactionID, config, "");
+        return result.status != CirculationStatus::Failed;
+    });
+    StepTimer timer(result.steps);
+    if (result.status == CirculationStatus::Done) {
+        catalogCache.setAvailability(result.bookID, "Yes");
+        reportAggregates.recordReturn(result.memberID, result.fine);
+    }
+    timer.mark("cache");
+    return result;
+}
+
+CirculationResult reserveLoan(int bookID, int memberID) {
+    OperationMetrics op("reserve");
+    if (deskJournal.enabled()) return deskJournal.acceptReserve(bookID, memberID);
+    CirculationResult result;
+    result.bookID = bookID;
+    result.memberID = memberID;
+    StepTimer timer(result.steps);
+    CachedBook book;
+    bool bookFound = catalogCache.find(bookID, book);
+    if (bookFound && book.availability == "Yes") bookFound = catalogCache.reloadBook(bookID, book);
+    ResultSet memberRes = fetchResultSet("SELECT MemberID FROM dbo.Members WHERE MemberID = ?", {memberID});
+    timer.mark("check");
+
+    if (!bookFound || memberRes.empty()) {
+        result.status = CirculationStatus::NotFound;
+        return result;
+    }
+    if (book.availability == "Yes") {
+        result.status = CirculationStatus::OnShelf;
+        return result;
+    }
+
+    const Config& config = configService.current();
+    string reserveQuery = "INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, Status) "
+                          "VALUES (?, ?, GETDATE(), DATEADD(day, ?, GETDATE()), 'Reserved')";
+    if (runQuery(reserveQuery, {bookID, memberID, config.reservationDurationDays})) {
+        reportAggregates.recordLoan(bookID, memberID);
+        result.status = CirculationStatus::Done;
+    }
+    timer.mark("insert");
+    return result;
+}
+
+void issueBook() {
+    string bookID, memberID;
+    cout << "Enter BookID: ";
+    cin >> bookID;
+    cout << "Enter MemberID: ";
+    cin >> memberID;
+
+    int book, member;
+    if (!parseId(bookID, book) || !parseId(memberID, member)) {
+        cout << "BookID and MemberID must be numeric!" << endl;
+        return;
     }
 
-    if (!hasUpdate) {
-        cout << "No changes provided!" << endl;
+    CirculationResult result = issueLoan(book, member);
+    switch (result.status) {
+        case CirculationStatus::Done:
+            if (result.journalSeq) {
+                cout << "Book issued (journal #" << result.journalSeq << ")! TransactionID " << result.transactionID
+                     << " stands in until the loan reaches the database." << endl;
+            } else {
+                cout << "Book issued successfully! TransactionID: " << result.transactionID << endl;
+            }
+            break;
+        case CirculationStatus::NotFound:
+            cout << "Book or Member not found!" << endl;
+            break;
+        case CirculationStatus::Unavailable:
+            cout << "Book not available!" << endl;
+            break;
+        case CirculationStatus::LimitReached:
+            cout << "Member has reached max limit (" << result.maxBooks << ")!" << endl;
+            break;
+        case CirculationStatus::OnShelf:
+        case CirculationStatus::Failed:
+            cout << "Failed to issue book." << endl;
+            break;
+    }
+    printCirculationTimings(result);
+}
+void reserveBook() {
+    string bookID, memberID;
+    cout << "Enter BookID: ";
+    cin >> bookID;
+    cout << "Enter MemberID: ";
+    cin >> memberID;
+
+    int book, member;
+    if (!parseId(bookID, book) || !parseId(memberID, member)) {
+        cout << "BookID and MemberID must be numeric!" << endl;
         return;
     }
 
-    query += " WHERE MemberID = '" + memberID + "'";
+    CirculationResult result = reserveLoan(book, member);
+    if (result.status == CirculationStatus::Done) {
+        cout << "Book reserved successfully!";
+        if (result.journalSeq) cout << " (journal #" << result.journalSeq << ")";
+        cout << endl;
+    } else if (result.status == CirculationStatus::NotFound) {
+        cout << "Book or Member not found!" << endl;
+    } else if (result.status == CirculationStatus::OnShelf) {
+        cout << "Book is available — consider issuing it instead!" << endl;
+    } else {
+        cout << "Failed to reserve book." << endl;
+    }
+}
+void returnBook() {
+    string transactionID;
+    cout << "Enter TransactionID: ";
+    cin >> transactionID;
+
+    int txn;
+    if (!parseId(transactionID, txn)) {
+        cout << "TransactionID must be numeric!" << endl;
+        return;
+    }
 
-    if (runQuery(query)) {
-        cout << "Member updated successfully!" << endl;
+    CirculationResult result = returnLoan(txn);
+    if (result.status == CirculationStatus::Done && result.journalSeq) {
+        cout << "Book returned (journal #" << result.journalSeq << ")! Any fine is charged when the return reaches the database." << endl;
+    } else if (result.status == CirculationStatus::Done) {
+        cout << "Book returned successfully!";
+        if (result.fine > 0) cout << " Fine due: " << fixed << setprecision(2) << result.fine;
+        cout << endl;
+    } else if (result.status == CirculationStatus::NotFound) {
+        cout << "Transaction not found or already returned!" << endl;
     } else {
-        cout << "Failed to update member." << endl;
+        cout << "Failed to return book." << endl;
     }
+    printCirculationTimings(result);
 }
-void deleteMember() {
+
+ 
+
+
+ 
+void viewHistory() {
     string memberID;
     cout << "Enter MemberID: ";
     cin >> memberID;
@@ -892,318 +7580,1534 @@ void deleteMember() {
         return;
     }
 
-    auto res = getResults("SELECT MemberID FROM dbo.Members WHERE MemberID = '" + memberID + "'");
-    if (res.empty()) {
-        cout << "Member not found!" << endl;
-        return;
+    // Newest first. TransactionIDs are assigned at issue time, so seeking on the
+    // ID gives the same order as IssueDate DESC without a composite key.
+    PageQuery history;
+    history.columns = columnList<transactionsTable, ColumnList::View>;
+    history.from = transactionsTable.table;
+    history.where = "MemberID = ?";
+    history.params = {memberID};
+    history.keyColumn = transactionsTable.columns[TransactionsTransactionID].name;
+    history.descending = true;
+
+    showPaged(history, transactionsView);
+}
+
+void transactionsMenu() {
+    int choice;
+    do {
+        cout << "\nTransactions\n";
+        cout << "1. Issue Book\n2. Return Book\n3. Reserve Book\n4. View History\n5. Desk Journal\n6. Back\nChoice: ";
+        cin >> choice;
+        while (cin.fail() || choice < 1 || choice > 6) {
+            cout << "Invalid choice! Try again: ";
+            cin.clear();
+            cin.ignore(10000, '\n');
+            cin >> choice;
+        }
+        switch (choice) {
+            case 1: issueBook(); break;
+            case 2: returnBook(); break;
+            case 3: reserveBook(); break;
+            case 4: viewHistory(); break;
+            case 5: deskJournal.printStatus(); break;
+            case 6: cout << "Returning to main menu..." << endl; break;
+        }
+    } while (choice != 6);
+}
+ 
+// Reads rows [offset, offset + count) of a ranked report and its total row count.
+using RankedPageSource = function<ResultSet(size_t offset, size_t count, size_t& total)>;
+
+// Pages through a ranked report one page at a time, fetching only the rows shown.
+void showRankedReport(const RankedPageSource& fetchPage, const ViewLayout& view) {
+    TerminalRenderer screen;
+    size_t total = 0;
+    size_t page = 0;
+    char choice;
+
+    do {
+        size_t pageSize = viewPageSize;
+        ResultSet rows = fetchPage(page * pageSize, pageSize, total);
+        if (total == 0) {
+            cout << "No " << view.name << " found." << endl;
+            return;
+        }
+        size_t totalPages = (total + pageSize - 1) / pageSize;
+        if (page >= totalPages) {
+            page = totalPages - 1;
+            continue;
+        }
+
+        drawPage(screen, view, rows, 0, rows.size(), "Page " + to_string(page + 1) + " of " + to_string(totalPages));
+
+        cin >> choice;
+        choice = toupper(choice);
+        cin.ignore(10000, '\n');  // clear input buffer after reading choice
+
+        if (choice == 'N' && page + 1 < totalPages)
+            ++page;
+        else if (choice == 'P' && page > 0)
+            --page;
+        else if (choice == 'S') {
+            screen.invalidate();
+            if (promptPageSize()) page = page * pageSize / viewPageSize;
+        }
+
+    } while (choice != 'Q');
+
+    cout << "Exiting view. Press Enter to continue...";
+    cin.ignore();
+    cin.get();
+}
+
+// Reports held by reportAggregates are read straight off the top-K structure.
+void showRankedReport(RankedReport report, const ViewLayout& view) {
+    showRankedReport([report](size_t offset, size_t count, size_t& total) { return reportAggregates.page(report, offset, count, total); }, view);
+}
+
+void topIssuedBooks() {
+    showRankedReport(RankedReport::TopBooks, topBooksView);
+}
+ 
+void activeMembers() {
+    showRankedReport(RankedReport::ActiveMembers, activeMembersView);
+}
+ 
+void fineSummary() {
+    showRankedReport(RankedReport::Fines, finesView);
+}
+
+void reconcileReports() {
+    size_t drift = reportAggregates.reconcile();
+    cout << "Report aggregates rebuilt from the base tables; " << drift << " row(s) had drifted." << endl;
+}
+ 
+void showStatementCacheStats() {
+    size_t open, idleCount, cached, hits, misses;
+    connectionPool.collectStats(open, idleCount, cached, hits, misses);
+    size_t total = hits + misses;
+    cout << "\n=== Prepared Statement Cache ===\n";
+    cout << "Pool connections:  " << open << " open, " << idleCount << " idle (max " << connectionPoolSize << ")" << endl;
+    cout << "Cached statements: " << cached << endl;
+    cout << "Prepare hits:      " << hits << endl;
+    cout << "Prepare misses:    " << misses << endl;
+    cout << "Hit rate:          " << fixed << setprecision(1)
+         << (total ? 100.0 * hits / total : 0.0) << "%" << endl;
+    cout << "Catalog cache:     " << catalogCache.size() << " books, " << catalogCache.hitCount() << " hits, "
+         << catalogCache.missCount() << " misses" << endl;
+    cout << setprecision(2);
+    configService.printStats();
+    reportAggregates.printStats();
+    cout.unsetf(ios::floatfield);
+}
+
+// ---- Diagnostics ----
+
+// A statement template on one line: whitespace collapsed, cut to width if nonzero.
+string statementLabel(const string& sql, size_t width) {
+    string out;
+    for (char c : sql) {
+        bool space = isspace((unsigned char)c) != 0;
+        if (space && (out.empty() || out.back() == ' ')) continue;
+        out += space ? ' ' : c;
     }
+    if (!out.empty() && out.back() == ' ') out.pop_back();
+    if (width && out.size() > width) out = out.substr(0, width - 3) + "...";
+    return out;
+}
 
-    string query = "DELETE FROM dbo.Members WHERE MemberID = '" + memberID + "'";
-    if (runQuery(query)) {
-        cout << "Member deleted successfully!" << endl;
-    } else {
-        cout << "Failed to delete member." << endl;
+string prometheusLabel(const string& value) {
+    string out;
+    for (char c : value) {
+        if (c == '\\' || c == '"') out += '\\';
+        if (c == '\n') out += "\\n";
+        else out += c;
     }
+    return out;
 }
 
-void viewMembers() {
-    auto res = getResults("SELECT MemberID, Name, Email, MembershipType FROM dbo.Members ORDER BY MemberID");
-    if (res.empty()) {
-        cout << "No members found." << endl;
+void writePrometheusHistogram(ostream& out, const string& metric, const string& labels, const MetricTotals& t) {
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b + 1 < metricBucketCount; ++b) {
+        cumulative += t.buckets[b];
+        out << metric << "_bucket{" << labels << ",le=\"" << metricBucketsMs[b] / 1000.0 << "\"} " << cumulative << "\n";
+    }
+    out << metric << "_bucket{" << labels << ",le=\"+Inf\"} " << t.calls << "\n";
+    out << metric << "_sum{" << labels << "} " << t.micros / 1e6 << "\n";
+    out << metric << "_count{" << labels << "} " << t.calls << "\n";
+}
+
+// Every counter in the Prometheus text exposition format.
+void writePrometheusMetrics(ostream& out) {
+    auto all = metricRegistry.collect();
+    out << setprecision(9);
+    vector<pair<string, const MetricTotals*>> statements, operations;
+    for (size_t i = 0; i < all.size(); ++i) {
+        string labels = all[i].first.kind == MetricKind::Statement
+                            ? "id=\"" + to_string(i) + "\",statement=\"" + prometheusLabel(statementLabel(all[i].first.name, 0)) + "\""
+                            : "operation=\"" + prometheusLabel(all[i].first.name) + "\"";
+        (all[i].first.kind == MetricKind::Statement ? statements : operations).emplace_back(labels, &all[i].second);
+    }
+
+    out << "# HELP library_statement_duration_seconds Time per statement template, from execute to the last row.\n"
+        << "# TYPE library_statement_duration_seconds histogram\n";
+    for (auto& s : statements) writePrometheusHistogram(out, "library_statement_duration_seconds", s.first, *s.second);
+    const pair<const char*, uint64_t MetricTotals::*> statementCounters[] = {
+        {"library_statement_errors_total", &MetricTotals::errors},
+        {"library_statement_rows_total", &MetricTotals::rows},
+        {"library_statement_bytes_total", &MetricTotals::bytes},
+        {"library_statement_allocations_total", &MetricTotals::allocations},
+    };
+    for (auto& counter : statementCounters) {
+        out << "# TYPE " << counter.first << " counter\n";
+        for (auto& s : statements) out << counter.first << "{" << s.first << "} " << s.second->*counter.second << "\n";
+    }
+
+    out << "# HELP library_operation_duration_seconds Time per desk operation.\n"
+        << "# TYPE library_operation_duration_seconds histogram\n";
+    for (auto& o : operations) writePrometheusHistogram(out, "library_operation_duration_seconds", o.first, *o.second);
+    out << "# HELP library_operation_round_trips_total Statements sent to the backend on behalf of each operation.\n"
+        << "# TYPE library_operation_round_trips_total counter\n";
+    for (auto& o : operations) out << "library_operation_round_trips_total{" << o.first << "} " << o.second->roundTrips << "\n";
+    out << "# HELP library_operation_allocations_total Heap allocations made by each operation on its own thread.\n"
+        << "# TYPE library_operation_allocations_total counter\n";
+    for (auto& o : operations) out << "library_operation_allocations_total{" << o.first << "} " << o.second->allocations << "\n";
+
+    size_t open, idleCount, cached, hits, misses;
+    connectionPool.collectStats(open, idleCount, cached, hits, misses);
+    out << "# TYPE library_statement_cache_hits_total counter\nlibrary_statement_cache_hits_total " << hits << "\n";
+    out << "# TYPE library_statement_cache_misses_total counter\nlibrary_statement_cache_misses_total " << misses << "\n";
+    out << "# TYPE library_catalog_cache_hits_total counter\nlibrary_catalog_cache_hits_total " << catalogCache.hitCount() << "\n";
+    out << "# TYPE library_catalog_cache_misses_total counter\nlibrary_catalog_cache_misses_total " << catalogCache.missCount() << "\n";
+    out << "# TYPE library_pool_connections gauge\nlibrary_pool_connections{state=\"open\"} " << open << "\n"
+        << "library_pool_connections{state=\"idle\"} " << idleCount << "\n";
+}
+
+bool writeMetricsFile(const string& path) {
+    string tempPath = path + ".tmp";
+    {
+        ofstream out(tempPath);
+        writePrometheusMetrics(out);
+        if (!out) return false;
+    }
+    // One atomic replace: a scraper never finds the file missing.
+    return replaceFile(tempPath, path);
+}
+
+// Rewrites the metrics file every interval, for a scraper or node_exporter's
+// textfile collector to pick up. Started by --metrics-file.
+class MetricsFileWriter {
+public:
+    ~MetricsFileWriter() { stop(); }
+
+    void start(const string& filePath, chrono::seconds every) {
+        path = filePath;
+        interval = every;
+        worker = thread([this] {
+            unique_lock<mutex> lock(mtx);
+            while (!wake.wait_for(lock, interval, [&] { return stopping; })) {
+                lock.unlock();
+                if (!writeMetricsFile(path)) cout << "Failed to write metrics to " << path << endl;
+                lock.lock();
+            }
+        });
+    }
+
+    // Writes once more so the file ends with the final counts.
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+        writeMetricsFile(path);
+    }
+
+    const string& file() const { return path; }
+
+private:
+    string path;
+    chrono::seconds interval{15};
+    mutex mtx;
+    condition_variable wake;
+    bool stopping = false;
+    thread worker;
+};
+MetricsFileWriter metricsFileWriter;
+
+void showStatementMetrics() {
+    auto all = metricRegistry.collect();
+    vector<pair<MetricKey, MetricTotals>> statements;
+    for (auto& entry : all) {
+        if (entry.first.kind == MetricKind::Statement && entry.second.calls) statements.push_back(entry);
+    }
+    sort(statements.begin(), statements.end(), [](auto& a, auto& b) { return a.second.micros > b.second.micros; });
+    if (statements.empty()) {
+        cout << "No statements recorded yet." << endl;
         return;
     }
-    showPaginated(res, "Members");
+    cout << "\n=== Statements by total time ===\n";
+    cout << right << setw(8) << "Calls" << setw(7) << "Errors" << setw(10) << "Total ms" << setw(9) << "Avg ms" << setw(9) << "p95 ms" << setw(10)
+         << "Rows" << setw(10) << "KB" << setw(9) << "Allocs" << "  Statement" << endl;
+    cout << string(129, '-') << endl;
+    cout << fixed;
+    for (size_t i = 0; i < statements.size() && i < 25; ++i) {
+        const MetricTotals& t = statements[i].second;
+        cout << setw(8) << t.calls << setw(7) << t.errors << setprecision(1) << setw(10) << t.micros / 1000.0 << setprecision(3) << setw(9)
+             << t.meanMs() << setw(9) << t.percentileMs(95) << setw(10) << t.rows << setprecision(1) << setw(10) << t.bytes / 1024.0 << setw(9)
+             << (double)t.allocations / t.calls << "  " << statementLabel(statements[i].first.name, 56) << endl;
+    }
+    if (statements.size() > 25) cout << "(" << statements.size() - 25 << " more in the metrics file)" << endl;
+    cout.unsetf(ios::floatfield);
+}
+
+void showOperationMetrics() {
+    auto all = metricRegistry.collect();
+    cout << "\n=== Operations ===\n";
+    cout << left << setw(18) << "Operation" << right << setw(8) << "Calls" << setw(9) << "Avg ms" << setw(9) << "p95 ms" << setw(14) << "Round trips"
+         << setw(10) << "Per op" << setw(10) << "Allocs" << endl;
+    cout << string(78, '-') << endl;
+    cout << fixed;
+    bool any = false;
+    for (auto& entry : all) {
+        const MetricTotals& t = entry.second;
+        if (entry.first.kind != MetricKind::Operation || !t.calls) continue;
+        any = true;
+        cout << left << setw(18) << entry.first.name << right << setw(8) << t.calls << setprecision(3) << setw(9) << t.meanMs() << setw(9)
+             << t.percentileMs(95) << setw(14) << t.roundTrips << setprecision(1) << setw(10) << (double)t.roundTrips / t.calls << setw(10)
+             << (double)t.allocations / t.calls << endl;
+    }
+    if (!any) cout << "No operations recorded yet." << endl;
+    cout.unsetf(ios::floatfield);
+}
+
+void diagnosticsMenu() {
+    int choice;
+    do {
+        cout << "\nDiagnostics\n";
+        cout << "1. Statement Latency\n2. Operations and Round Trips\n3. Cache Hit Rates\n4. Write Metrics File\n5. Back\nChoice: ";
+        cin >> choice;
+        while (cin.fail() || choice < 1 || choice > 5) {
+            cout << "Invalid choice! Try again: ";
+            cin.clear();
+            cin.ignore(10000, '\n');
+            cin >> choice;
+        }
+        switch (choice) {
+            case 1: showStatementMetrics(); break;
+            case 2: showOperationMetrics(); break;
+            case 3: showStatementCacheStats(); break;
+            case 4: {
+                string path = metricsFileWriter.file().empty() ? "library.prom" : metricsFileWriter.file();
+                cout << (writeMetricsFile(path) ? "Metrics written to " : "Failed to write ") << path << endl;
+                break;
+            }
+            case 5: cout << "Returning to main menu..." << endl; break;
+        }
+    } while (choice != 5);
+}
+
+bool exportSnapshotToCwd() {
+    char cwd[256];
+    if (_getcwd(cwd, sizeof(cwd)) == nullptr) {
+        statusOut() << "Failed to get current working directory." << endl;
+        return false;
+    }
+    return exportSnapshot(string(cwd) + pathSeparator + "library.snap");
+}
+
+void backgroundJobsMenu() {
+    int choice;
+    do {
+        cout << "\nBackground Jobs\n";
+        backgroundJobs.printList();
+        cout << "1. Refresh\n2. Cancel Job\n3. Show Job Log\n4. Back\nChoice: ";
+        cin >> choice;
+        while (cin.fail() || choice < 1 || choice > 4) {
+            cout << "Invalid choice! Try again: ";
+            cin.clear();
+            cin.ignore(10000, '\n');
+            cin >> choice;
+        }
+        if (choice == 2 || choice == 3) {
+            int id;
+            cout << "Job ID: ";
+            cin >> id;
+            if (cin.fail()) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                id = 0;
+            }
+            if (choice == 2) cout << (backgroundJobs.cancel(id) ? "Cancellation requested." : "No running job with that ID.") << endl;
+            else if (!backgroundJobs.printLog(id)) cout << "No job with that ID." << endl;
+        }
+    } while (choice != 4);
+}
+
+// Read-only views served from a snapshot, for a desk with no database.
+void offlineMenu() {
+    int choice;
+    do {
+        cout << "\n********** Library (offline snapshot) **********\n";
+        cout << "1. View Books\n2. Search Books\n3. Search Members\n4. Top Issued Books\n5. Active Members\n6. Fine Summary\n7. Exit\nChoice: ";
+        cin >> choice;
+        while (cin.fail() || choice < 1 || choice > 7) {
+            cout << "Invalid choice! Try again: ";
+            cin.clear();
+            cin.ignore(10000, '\n');
+            cin >> choice;
+        }
+        switch (choice) {
+            case 1: viewBooks(); break;
+            case 2: searchBooks(); break;
+            case 3: searchMembers(); break;
+            case 4: topIssuedBooks(); break;
+            case 5: activeMembers(); break;
+            case 6: fineSummary(); break;
+            case 7: cout << "Exiting..." << endl; break;
+        }
+    } while (choice != 7);
+}
+
+void reportsMenu() {
+    int choice;
+    do {
+        cout << "\nReports\n";
+        cout << "1. Top Issued Books\n2. Active Members\n3. Fine Summary\n4. Export Reports to CSV\n5. Statement Cache Stats\n6. Reload Config\n7. Reconcile Report Aggregates\n8. Export Snapshot\n9. Back\nChoice: ";
+        cin >> choice;
+        while (cin.fail() || choice < 1 || choice > 9) {
+            cout << "Invalid choice! Try again: ";
+            cin.clear();
+            cin.ignore(10000, '\n');
+            cin >> choice;
+        }
+        switch (choice) {
+            case 1: topIssuedBooks(); break;
+            case 2: activeMembers(); break;
+            case 3: fineSummary(); break;
+            case 4:
+                backgroundJobs.start("Export Reports to CSV", [] {
+                    exportReportsToCSV();
+                    return true;
+                });
+                break;
+            case 5: showStatementCacheStats(); break;
+            case 6: reloadConfig(); break;
+            case 7: reconcileReports(); break;
+            case 8: backgroundJobs.start("Export Snapshot", exportSnapshotToCwd); break;
+            case 9: cout << "Returning to main menu..." << endl; break;
+        }
+    } while (choice != 9);
+}
+// ---- Workflow benchmark (--bench-workflows) ----
+// Drives the desk operations directly, without the menus, from several threads
+// against a synthetic dataset, and reports throughput and latency percentiles
+// per operation. --json writes the same numbers for comparing releases.
+
+enum BenchOp { BenchIssue, BenchReturn, BenchReserve, BenchSearch, BenchImport, BenchOpCount };
+const char* benchOpNames[BenchOpCount] = {"issue", "return", "reserve", "search", "import"};
+
+struct WorkflowBenchOptions {
+    size_t books = 20000, members = 500, loans = 20000;  // synthetic rows added before the run
+    size_t threads = 4, opsPerThread = 2000;
+    size_t importRows = 200;                              // books per import operation
+    unsigned mix[BenchOpCount] = {30, 30, 5, 30, 5};      // relative weights
+    bool seed = true;
+    string jsonPath;
+    string journalPath;  // run the desk operations through the desk journal
+};
+
+struct BenchOpStats {
+    LatencyHistogram latency;
+    size_t refused = 0;  // the operation answered no: book out, limit reached, ...
+    size_t failed = 0;   // the backend reported an error
+};
+
+// Parses "issue=30,search=60,..."; operations not named get weight 0.
+bool parseBenchMix(const string& text, unsigned mix[BenchOpCount]) {
+    size_t parsed[BenchOpCount] = {};
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+        string name = item.substr(0, eq);
+        auto op = find_if(begin(benchOpNames), end(benchOpNames), [&](const char* n) { return name == n; });
+        if (op == end(benchOpNames) || !parseCount(item.substr(eq + 1), parsed[op - begin(benchOpNames)])) return false;
+    }
+    if (accumulate(begin(parsed), end(parsed), (size_t)0) == 0) return false;
+    for (size_t k = 0; k < BenchOpCount; ++k) mix[k] = (unsigned)parsed[k];
+    return true;
+}
+
+bool idRange(const string& table, const string& key, int& low, int& high) {
+    ResultSet res = fetchResultSet("SELECT MIN(" + key + "), MAX(" + key + ") FROM dbo." + table);
+    if (res.empty() || res.cellString(0, 0) == "NULL") return false;
+    low = stoi(res.cellString(0, 0));
+    high = stoi(res.cellString(0, 1));
+    return true;
+}
+
+// Adds the synthetic dataset: books through the import pipeline, then members
+// and a history of returned loans in batched transactions.
+bool seedBenchData(const WorkflowBenchOptions& options) {
+    auto start = chrono::steady_clock::now();
+    ResultSet existing = fetchResultSet("SELECT COUNT(*) FROM dbo.Books");
+    size_t firstBook = existing.empty() ? 0 : stoul(existing.cellString(0, 0));
+    istringstream csv(makeSyntheticBooksCsv(options.books, firstBook));
+    ostream discard(nullptr);
+    jobOutput = &discard;
+    size_t booksAdded = importBooksPipelined(csv, defaultImportBatchSize);
+    jobOutput = nullptr;
+
+    const char* types[] = {"Standard", "Premium", "Student"};
+    bool ok = withConnection([&](StorageConnection& conn) {
+        conn.begin();
+        for (size_t i = 0; i < options.members; ++i) {
+            string name = "Bench Member " + to_string(i);
+            if (!conn.execute("INSERT INTO dbo.Members (Name, Email, MembershipType, Role, Password) VALUES (?, ?, ?, 'User', 'bench')",
+                              {name, "member" + to_string(i) + "@bench.test", types[i % 3]}, nullptr)) {
+                conn.rollback();
+                return false;
+            }
+        }
+        return conn.commit();
+    });
+    int bookLow, bookHigh, memberLow, memberHigh;
+    if (!ok || !idRange("Books", "BookID", bookLow, bookHigh) || !idRange("Members", "MemberID", memberLow, memberHigh)) return false;
+
+    mt19937 rng(42);
+    const size_t loanBatch = 5000;
+    for (size_t done = 0; ok && done < options.loans; done += loanBatch) {
+        ok = withConnection([&](StorageConnection& conn) {
+            conn.begin();
+            for (size_t i = done; i < min(options.loans, done + loanBatch); ++i) {
+                int issued = -(int)(15 + rng() % 700), kept = (int)(rng() % 30);
+                double fine = kept > 14 ? (kept - 14) * 1.0 : 0.0;
+                if (!conn.execute("INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, ReturnDate, Status, FineAmount) "
+                                  "VALUES (?, ?, DATEADD(day, ?, GETDATE()), DATEADD(day, ?, GETDATE()), DATEADD(day, ?, GETDATE()), 'Returned', ?)",
+                                  {bookLow + (int)(rng() % (bookHigh - bookLow + 1)), memberLow + (int)(rng() % (memberHigh - memberLow + 1)), issued,
+                                   issued + 14, issued + kept, fine},
+                                  nullptr)) {
+                    conn.rollback();
+                    return false;
+                }
+            }
+            return conn.commit();
+        });
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Seeded " << booksAdded << " books, " << options.members << " members and " << options.loans << " loans in " << fixed
+         << setprecision(1) << seconds << " s" << endl;
+    cout.unsetf(ios::floatfield);
+    return ok;
+}
+
+void writeBenchJson(const string& path, const WorkflowBenchOptions& options, const BenchOpStats (&stats)[BenchOpCount], double seconds) {
+    ofstream out(path);
+    size_t total = 0;
+    for (auto& op : stats) total += op.latency.count();
+    out << fixed << setprecision(4);
+    out << "{\n  \"benchmark\": \"workflows\",\n  \"backend\": \"" << storageBackend->name() << "\",\n";
+    out << "  \"dataset\": {\"books\": " << options.books << ", \"members\": " << options.members << ", \"loans\": " << options.loans << "},\n";
+    out << "  \"threads\": " << options.threads << ",\n  \"mix\": {";
+    for (size_t k = 0; k < BenchOpCount; ++k) out << (k ? ", " : "") << "\"" << benchOpNames[k] << "\": " << options.mix[k];
+    out << "},\n  \"seconds\": " << seconds << ",\n  \"ops_per_second\": " << (seconds > 0 ? total / seconds : 0.0) << ",\n";
+    out << "  \"operations\": {";
+    bool firstOp = true;
+    for (size_t k = 0; k < BenchOpCount; ++k) {
+        const LatencyHistogram& h = stats[k].latency;
+        if (h.count() == 0) continue;
+        out << (firstOp ? "\n" : ",\n") << "    \"" << benchOpNames[k] << "\": {\"count\": " << h.count() << ", \"refused\": " << stats[k].refused
+            << ", \"failed\": " << stats[k].failed << ", \"ops_per_second\": " << h.count() / seconds << ", \"mean_ms\": " << h.mean()
+            << ", \"p50_ms\": " << h.percentile(50) << ", \"p95_ms\": " << h.percentile(95) << ", \"p99_ms\": " << h.percentile(99)
+            << ", \"max_ms\": " << h.maximum() << ",\n      \"histogram\": [";
+        bool firstBucket = true;
+        for (size_t b = 0; b < LatencyHistogram::bucketCount; ++b) {
+            if (!h.bucket(b)) continue;
+            out << (firstBucket ? "" : ", ") << "[" << LatencyHistogram::upperMs(b) << ", " << h.bucket(b) << "]";
+            firstBucket = false;
+        }
+        out << "]}";
+        firstOp = false;
+    }
+    out << "\n  }\n}\n";
+    if (!out) cout << "Failed to write " << path << endl;
+    else cout << "Results written to " << path << endl;
+}
+
+bool runWorkflowBenchmark(const WorkflowBenchOptions& options) {
+    if (options.seed && !seedBenchData(options)) {
+        cout << "Failed to seed the benchmark data." << endl;
+        return false;
+    }
+    int bookLow, bookHigh, memberLow, memberHigh;
+    if (!idRange("Books", "BookID", bookLow, bookHigh) || !idRange("Members", "MemberID", memberLow, memberHigh)) {
+        cout << "The database has no books or members to work with." << endl;
+        return false;
+    }
+    configService.reload();
+    catalogCache.warm();
+    size_t ignored;
+    reportAggregates.page(RankedReport::TopBooks, 0, 1, ignored);
+    if (!options.journalPath.empty()) {
+        memberDirectory.warm();  // the journal checks members locally
+        if (!deskJournal.open(options.journalPath)) return false;
+    }
+
+    unsigned weightTotal = accumulate(begin(options.mix), end(options.mix), 0u);
+    vector<array<BenchOpStats, BenchOpCount>> perThread(options.threads);
+    atomic<size_t> importSerial{0};
+    ResultSet existing = fetchResultSet("SELECT COUNT(*) FROM dbo.Books");
+    size_t importBase = (existing.empty() ? 0 : stoul(existing.cellString(0, 0))) + 1000000;
+
+    cout << "Running " << options.threads << " threads x " << options.opsPerThread << " operations..." << endl;
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (size_t t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t] {
+            ostream discard(nullptr);  // per-batch import messages and refusals are not part of the run
+            jobOutput = &discard;
+            mt19937 rng((unsigned)(t * 104729 + 1));
+            auto randomBook = [&] { return bookLow + (int)(rng() % (bookHigh - bookLow + 1)); };
+            auto randomMember = [&] { return memberLow + (int)(rng() % (memberHigh - memberLow + 1)); };
+            vector<pair<int, int>> loans;  // transactionID, bookID issued by this thread
+            auto& stats = perThread[t];
+
+            for (size_t i = 0; i < options.opsPerThread; ++i) {
+                unsigned roll = rng() % weightTotal;
+                size_t op = 0;
+                while (roll >= options.mix[op]) roll -= options.mix[op++];
+                // Returns and reservations need a book this thread has out; issue one first.
+                if ((op == BenchReturn || op == BenchReserve) && loans.empty()) op = BenchIssue;
+
+                auto began = chrono::steady_clock::now();
+                CirculationStatus status = CirculationStatus::Done;
+                switch (op) {
+                    case BenchIssue: {
+                        CirculationResult result = issueLoan(randomBook(), randomMember());
+                        status = result.status;
+                        if (status == CirculationStatus::Done) loans.emplace_back(result.transactionID, result.bookID);
+                        break;
+                    }
+                    case BenchReturn: {
+                        size_t pick = rng() % loans.size();
+                        status = returnLoan(loans[pick].first).status;
+                        loans[pick] = loans.back();
+                        loans.pop_back();
+                        break;
+                    }
+                    case BenchReserve:
+                        status = reserveLoan(loans[rng() % loans.size()].second, randomMember()).status;
+                        break;
+                    case BenchSearch: {
+                        unsigned kind = rng() % 3;
+                        string term = kind == 0 ? "Author " + to_string(rng() % 997) : kind == 1 ? "Number " + to_string(rng() % 5000) : "Volume";
+                        bookSearchResults(term);
+                        break;
+                    }
+                    case BenchImport: {
+                        istringstream csv(makeSyntheticBooksCsv(options.importRows, importBase + importSerial.fetch_add(options.importRows)));
+                        if (importBooksPipelined(csv, options.importRows) < options.importRows) status = CirculationStatus::Failed;
+                        break;
+                    }
+                }
+                stats[op].latency.record(chrono::duration<double, milli>(chrono::steady_clock::now() - began).count());
+                if (status == CirculationStatus::Failed) stats[op].failed++;
+                else if (status != CirculationStatus::Done) stats[op].refused++;
+            }
+            for (auto& loan : loans) returnLoan(loan.first);
+            jobOutput = nullptr;
+        });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    BenchOpStats stats[BenchOpCount];
+    size_t total = 0;
+    for (auto& threadStats : perThread) {
+        for (size_t k = 0; k < BenchOpCount; ++k) {
+            stats[k].latency.merge(threadStats[k].latency);
+            stats[k].refused += threadStats[k].refused;
+            stats[k].failed += threadStats[k].failed;
+        }
+    }
+    cout << left << setw(9) << "Op" << right << setw(8) << "Count" << setw(9) << "Refused" << setw(8) << "Failed" << setw(10) << "ops/s"
+         << setw(10) << "p50 ms" << setw(10) << "p95 ms" << setw(10) << "p99 ms" << setw(10) << "max ms" << endl;
+    cout << string(84, '-') << endl;
+    for (size_t k = 0; k < BenchOpCount; ++k) {
+        const LatencyHistogram& h = stats[k].latency;
+        total += h.count();
+        if (h.count() == 0) continue;
+        cout << left << setw(9) << benchOpNames[k] << right << setw(8) << h.count() << setw(9) << stats[k].refused << setw(8) << stats[k].failed
+             << fixed << setprecision(0) << setw(10) << h.count() / seconds << setprecision(3) << setw(10) << h.percentile(50) << setw(10)
+             << h.percentile(95) << setw(10) << h.percentile(99) << setw(10) << h.maximum() << endl;
+    }
+    cout << setprecision(1) << total << " operations in " << seconds << " s (" << setprecision(0) << total / seconds << " ops/s) on "
+         << storageBackend->name() << endl;
+    cout.unsetf(ios::floatfield);
+    if (deskJournal.enabled()) {
+        // The desk timings above stop at the journal; this is how far behind the database was.
+        auto drainStart = chrono::steady_clock::now();
+        bool drained = deskJournal.drain(chrono::minutes(5));
+        double drainSeconds = chrono::duration<double>(chrono::steady_clock::now() - drainStart).count();
+        cout << fixed << setprecision(2) << "Journal " << (drained ? "replayed" : "still replaying") << " " << drainSeconds << " s after the run" << endl;
+        cout.unsetf(ios::floatfield);
+        deskJournal.printStatus();
+        deskJournal.close();
+    }
+    if (!options.jsonPath.empty()) writeBenchJson(options.jsonPath, options, stats, seconds);
+    return true;
+}
+
+#ifndef _WIN32
+// ---- Server mode ----
+// One process serves every desk over a local (Unix domain) socket, sharing its
+// connection pool and caches. The protocol is line based: a request is one line
+// of tab-separated fields, verb first:
+//   LOGIN <Admin|User> <name> <password>   ISSUE <bookID> <memberID>
+//   RETURN <transactionID>                 RESERVE <bookID> <memberID>
+//   SEARCH <text>                          REPORT <top|members|fines> <offset> <count>
+//   STATS   PING   QUIT
+// A reply is "OK\t<lines>\t<total>" followed by that many lines, a header row
+// and then data rows, or a single "ERR\t<message>" line. Tabs, newlines and
+// backslashes inside fields are escaped as \t, \n and \\.
+
+const size_t maxRequestBytes = 64 * 1024;
+const size_t maxReportPage = 1000;
+
+string escapeField(string_view field) {
+    string out;
+    out.reserve(field.size());
+    for (char c : field) {
+        if (c == '\t') out += "\\t";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\\') out += "\\\\";
+        else out += c;
+    }
+    return out;
 }
 
-void searchMembers() {
-    string value;
-    cout << "Enter Name or Email to search: ";
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    getline(cin, value);
-
-    // Escape single quotes to prevent SQL injection or errors
-    for (size_t i = 0; i < value.length(); ++i) {
-        if (value[i] == '\'') value.insert(i++, "'");
+vector<string> splitFields(string_view line) {
+    vector<string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '\t') {
+            fields.emplace_back();
+        } else if (c == '\\' && i + 1 < line.size()) {
+            char next = line[++i];
+            fields.back() += next == 't' ? '\t' : next == 'n' ? '\n' : next == 'r' ? '\r' : next;
+        } else {
+            fields.back() += c;
+        }
     }
+    return fields;
+}
 
-    string query = "SELECT MemberID, Name, Email, MembershipType FROM dbo.Members "
-                   "WHERE Name LIKE '%" + value + "%' OR Email LIKE '%" + value + "%'";
-    auto res = getResults(query);
-
-    if (res.empty()) {
-        cout << "No matching members found." << endl;
-        return;
+string joinFields(const vector<string>& fields) {
+    string line;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i) line += '\t';
+        line += escapeField(fields[i]);
     }
-
-    showPaginated(res, "Members");
+    return line + '\n';
 }
 
-void membersMenu() {
-    int choice;
-    do {
-        cout << "\n===== Members Management =====\n";
-        cout << "1. Add Member\n";
-        cout << "2. Update Member\n";
-        cout << "3. Delete Member\n";
-        cout << "4. View Members\n";
-        cout << "5. Search Members\n";
-        cout << "6. Back to Main Menu\n";
-        cout << "Choice: ";
-        cin >> choice;
-
-        while (cin.fail() || choice < 1 || choice > 6) {
-            cout << "Invalid choice! Try again: ";
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cin >> choice;
+string okReply(const ResultSet& rows, size_t total) {
+    string out = "OK\t" + to_string(rows.size() + 1) + "\t" + to_string(total) + "\n";
+    char buf[64];
+    for (size_t c = 0; c < rows.columnCount(); ++c) {
+        if (c) out += '\t';
+        out += escapeField(rows.columns[c].name);
+    }
+    out += '\n';
+    for (size_t r = 0; r < rows.size(); ++r) {
+        for (size_t c = 0; c < rows.columnCount(); ++c) {
+            if (c) out += '\t';
+            out += escapeField(rows.cell(r, c, buf, sizeof(buf)));
         }
+        out += '\n';
+    }
+    return out;
+}
 
-        switch (choice) {
-            case 1: addMember(); break;
-            case 2: updateMember(); break;
-            case 3: deleteMember(); break;
-            case 4: viewMembers(); break;
-            case 5: searchMembers(); break;
-            case 6: cout << "Returning to main menu...\n"; break;
-        }
-    } while (choice != 6);
+string okReply(const string& column, const string& value) {
+    ResultSet rows;
+    rows.addTextColumn(column);
+    rows.addTextRow({value});
+    return okReply(rows, 1);
 }
 
- 
-void issueBook() {
-    string bookID, memberID;
-    cout << "Enter BookID: ";
-    cin >> bookID;
-    cout << "Enter MemberID: ";
-    cin >> memberID;
+string errorReply(const string& message) {
+    return "ERR\t" + escapeField(message) + "\n";
+}
 
-    if (!all_of(bookID.begin(), bookID.end(), ::isdigit) || !all_of(memberID.begin(), memberID.end(), ::isdigit)) {
-        cout << "BookID and MemberID must be numeric!" << endl;
-        return;
+bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += (size_t)n;
     }
+    return true;
+}
 
-    auto bookRes = getResults("SELECT Availability FROM dbo.Books WITH (ROWLOCK, UPDLOCK) WHERE BookID = '" + bookID + "'");
-    auto memberRes = getResults("SELECT MemberID FROM dbo.Members WHERE MemberID = '" + memberID + "'");
-
-    if (bookRes.empty() || memberRes.empty()) {
-        cout << "Book or Member not found!" << endl;
-        return;
+// Hands requests to a fixed set of workers in two lanes. Desk requests (logins,
+// circulation, searches) always go first; at most reportSlots workers run report
+// requests at once, so a burst of reports cannot hold up the counter.
+class RequestScheduler {
+public:
+    void start(size_t workerCount) {
+        reportSlots = max<size_t>(1, workerCount / 2);
+        for (size_t i = 0; i < workerCount; ++i) workers.emplace_back([this] { run(); });
     }
 
-    if (bookRes[0][0] == "No") {
-        cout << "Book not available!" << endl;
-        return;
+    void stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+        workers.clear();
     }
 
-    Config config = getConfig();
-    auto issuedCount = getResults("SELECT COUNT(*) FROM dbo.Transactions WHERE MemberID = '" + memberID + "' AND Status = 'Issued'");
+    void submit(bool report, function<void()> task) {
+        {
+            lock_guard<mutex> lock(mtx);
+            (report ? reports : desk).push_back(move(task));
+        }
+        wake.notify_one();
+    }
 
-    if (!issuedCount.empty() && stoi(issuedCount[0][0]) >= config.maxBooksPerMember) {
-        cout << "Member has reached max limit (" << config.maxBooksPerMember << ")!" << endl;
-        return;
+    void queued(size_t& deskCount, size_t& reportCount) {
+        lock_guard<mutex> lock(mtx);
+        deskCount = desk.size();
+        reportCount = reports.size();
     }
 
-    string issueQuery = "INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, Status) "
-                        "VALUES ('" + bookID + "', '" + memberID + "', GETDATE(), "
-                        "DATEADD(day, " + to_string(config.reservationDurationDays) + ", GETDATE()), 'Issued')";
+private:
+    void run() {
+        while (true) {
+            function<void()> task;
+            bool report = false;
+            {
+                unique_lock<mutex> lock(mtx);
+                wake.wait(lock, [&] { return stopping || !desk.empty() || (!reports.empty() && reportsRunning < reportSlots); });
+                if (stopping) return;
+                if (!desk.empty()) {
+                    task = move(desk.front());
+                    desk.pop_front();
+                } else {
+                    task = move(reports.front());
+                    reports.pop_front();
+                    report = true;
+                    reportsRunning++;
+                }
+            }
+            task();
+            if (report) {
+                lock_guard<mutex> lock(mtx);
+                reportsRunning--;
+                // A report slot opened up; a worker may be waiting for it.
+                wake.notify_one();
+            }
+        }
+    }
 
-    string updateBookQuery = "UPDATE dbo.Books SET Availability = 'No' WHERE BookID = '" + bookID + "'";
+    mutex mtx;
+    condition_variable wake;
+    deque<function<void()>> desk, reports;
+    size_t reportSlots = 1, reportsRunning = 0;
+    bool stopping = false;
+    vector<thread> workers;
+};
 
-    bool success = true;
-    SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, 0);
+struct ServerSession {
+    int fd = -1;
+    string input;              // bytes received but not yet a whole line
+    deque<string> requests;    // whole lines waiting their turn
+    bool busy = false;         // one request at a time is with the workers
+    bool closed = false;       // the client hung up
+    string role;               // set by LOGIN; touched only by the worker serving the session
+};
 
-    if (!runQuery(issueQuery)) success = false;
-    if (success && !runQuery(updateBookQuery)) success = false;
+volatile sig_atomic_t serverStopRequested = 0;
+int serverWakeFd = -1;
 
-    if (success) {
-        SQLEndTran(SQL_HANDLE_DBC, connHandle, SQL_COMMIT);
-        cout << "Book issued successfully!" << endl;
-    } else {
-        SQLEndTran(SQL_HANDLE_DBC, connHandle, SQL_ROLLBACK);
-        cout << "Failed to issue book." << endl;
+void requestServerStop(int) {
+    serverStopRequested = 1;
+    if (serverWakeFd >= 0) {
+        ssize_t ignored = write(serverWakeFd, "s", 1);
+        (void)ignored;
     }
-
-    SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0);
 }
-void reserveBook() {
-    string bookID, memberID;
-    cout << "Enter BookID: ";
-    cin >> bookID;
-    cout << "Enter MemberID: ";
-    cin >> memberID;
-
-    if (!all_of(bookID.begin(), bookID.end(), ::isdigit) || !all_of(memberID.begin(), memberID.end(), ::isdigit)) {
-        cout << "BookID and MemberID must be numeric!" << endl;
-        return;
-    }
 
-    auto bookRes = getResults("SELECT Availability FROM dbo.Books WHERE BookID = '" + bookID + "'");
-    auto memberRes = getResults("SELECT MemberID FROM dbo.Members WHERE MemberID = '" + memberID + "'");
+// The poll loop owns the sockets: it accepts, reads and splits requests, and
+// passes each session's next request to the scheduler once the previous one
+// has been answered. Workers write the reply and hand the session back through
+// the wake pipe.
+class LibraryServer {
+public:
+    bool run(const string& path, size_t workerCount) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            cout << "Socket path is too long: " << path << endl;
+            return false;
+        }
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+            cout << "Failed to listen on " << path << ": " << strerror(errno) << endl;
+            if (listenFd >= 0) close(listenFd);
+            return false;
+        }
+        if (pipe(wakePipe) != 0) {
+            cout << "Failed to create the wake pipe: " << strerror(errno) << endl;
+            close(listenFd);
+            return false;
+        }
+        serverWakeFd = wakePipe[1];
+        signal(SIGINT, requestServerStop);
+        signal(SIGTERM, requestServerStop);
+        started = chrono::steady_clock::now();
+        scheduler.start(workerCount);
+        cout << "Serving " << path << " with " << workerCount << " workers. Ctrl+C stops the server." << endl;
+
+        while (!serverStopRequested) {
+            vector<pollfd> fds = {{listenFd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+            for (auto& entry : sessions) {
+                if (!entry.second->closed) fds.push_back({entry.first, POLLIN, 0});
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                cout << "poll failed: " << strerror(errno) << endl;
+                break;
+            }
+            if (fds[1].revents & POLLIN) finishRequests();
+            if (fds[0].revents & POLLIN) acceptClient();
+            for (size_t i = 2; i < fds.size(); ++i) {
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) readFrom(fds[i].fd);
+            }
+        }
 
-    if (bookRes.empty() || memberRes.empty()) {
-        cout << "Book or Member not found!" << endl;
-        return;
+        cout << "Stopping server..." << endl;
+        scheduler.stop();
+        for (auto& entry : sessions) close(entry.first);
+        sessions.clear();
+        close(listenFd);
+        unlink(path.c_str());
+        serverWakeFd = -1;
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        cout << "Served " << served << " requests (" << rejected << " rejected)." << endl;
+        return true;
     }
 
-    if (bookRes[0][0] == "Yes") {
-        cout << "Book is available — consider issuing it instead!" << endl;
-        return;
+private:
+    void acceptClient() {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) return;
+        auto session = make_shared<ServerSession>();
+        session->fd = fd;
+        sessions[fd] = session;
+        openSessions++;
     }
 
-    Config config = getConfig();
-
-    string reserveQuery = "INSERT INTO dbo.Transactions (BookID, MemberID, IssueDate, DueDate, Status) "
-                          "VALUES ('" + bookID + "', '" + memberID + "', GETDATE(), "
-                          "DATEADD(day, " + to_string(config.reservationDurationDays) + ", GETDATE()), 'Reserved')";
-
-    if (runQuery(reserveQuery)) {
-        cout << "Book reserved successfully!" << endl;
-    } else {
-        cout << "Failed to reserve book." << endl;
+    void readFrom(int fd) {
+        auto it = sessions.find(fd);
+        if (it == sessions.end()) return;
+        ServerSession& session = *it->second;
+        char buf[16384];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            hangUp(fd);
+            return;
+        }
+        session.input.append(buf, (size_t)n);
+        size_t start = 0, end;
+        while ((end = session.input.find('\n', start)) != string::npos) {
+            size_t len = end - start;
+            if (len && session.input[end - 1] == '\r') len--;
+            session.requests.emplace_back(session.input, start, len);
+            start = end + 1;
+        }
+        session.input.erase(0, start);
+        if (session.input.size() > maxRequestBytes) {
+            sendAll(fd, errorReply("Request too long"));
+            hangUp(fd);
+            return;
+        }
+        dispatch(it->second);
     }
-}
-void returnBook() {
-    string transactionID;
-    cout << "Enter TransactionID: ";
-    cin >> transactionID;
 
-    if (!all_of(transactionID.begin(), transactionID.end(), ::isdigit)) {
-        cout << "TransactionID must be numeric!" << endl;
-        return;
+    // Sessions are closed by the poll loop only when no worker is using them.
+    void hangUp(int fd) {
+        auto it = sessions.find(fd);
+        if (it == sessions.end()) return;
+        it->second->closed = true;
+        if (it->second->busy) return;
+        close(fd);
+        sessions.erase(it);
+        openSessions--;
     }
 
-    auto res = getResults("SELECT BookID FROM dbo.Transactions WHERE TransactionID = '" + transactionID + "' AND Status = 'Issued'");
-    if (res.empty()) {
-        cout << "Transaction not found or already returned!" << endl;
-        return;
+    void finishRequests() {
+        char drain[256];
+        while (read(wakePipe[0], drain, sizeof(drain)) == (ssize_t)sizeof(drain)) {
+        }
+        vector<int> finished;
+        {
+            lock_guard<mutex> lock(doneMtx);
+            finished.swap(done);
+        }
+        for (int fd : finished) {
+            auto it = sessions.find(fd);
+            if (it == sessions.end()) continue;
+            it->second->busy = false;
+            if (it->second->closed) hangUp(fd);
+            else dispatch(it->second);
+        }
     }
 
-    string bookID = res[0][0];
-    Config config = getConfig();
-
-    string updateTransaction = "UPDATE dbo.Transactions SET "
-                               "Status = 'Returned', "
-                               "ReturnDate = GETDATE(), "
-                               "FineAmount = CASE WHEN GETDATE() > DueDate "
-                               "THEN DATEDIFF(day, DueDate, GETDATE()) * " + to_string(config.fineRate) + 
-                               " ELSE 0 END "
-                               "WHERE TransactionID = '" + transactionID + "'";
+    void dispatch(const shared_ptr<ServerSession>& session) {
+        if (session->busy || session->closed || session->requests.empty()) return;
+        vector<string> request = splitFields(session->requests.front());
+        session->requests.pop_front();
+        if (request[0] == "QUIT") {
+            sendAll(session->fd, okReply("Status", "Bye"));
+            hangUp(session->fd);
+            return;
+        }
+        session->busy = true;
+        scheduler.submit(request[0] == "REPORT", [this, session, request] {
+            string reply = handle(*session, request);
+            served++;
+            if (reply.compare(0, 3, "ERR") == 0) rejected++;
+            sendAll(session->fd, reply);
+            {
+                lock_guard<mutex> lock(doneMtx);
+                done.push_back(session->fd);
+            }
+            ssize_t ignored = write(wakePipe[1], "d", 1);
+            (void)ignored;
+        });
+    }
 
-    string updateBook = "UPDATE dbo.Books SET Availability = 'Yes' WHERE BookID = '" + bookID + "'";
+    string handle(ServerSession& session, const vector<string>& request) {
+        const string& verb = request[0];
+        if (verb == "PING") return okReply("Status", "Pong");
+        if (verb == "LOGIN") {
+            OperationMetrics op("login");
+            if (request.size() != 4 || (request[1] != "Admin" && request[1] != "User")) return errorReply("Usage: LOGIN Admin|User name password");
+            ResultSet res = fetchResultSet("SELECT Role FROM dbo.Members WHERE Name = ? AND Password = ? AND Role = ?", {request[2], request[3], request[1]});
+            if (res.empty()) return errorReply("Invalid credentials for " + request[1] + "!");
+            session.role = res.cellString(0, 0);
+            return okReply("Role", session.role);
+        }
+        if (session.role.empty()) return errorReply("Log in first.");
+
+        if (verb == "ISSUE" || verb == "RESERVE") {
+            int book, member;
+            if (request.size() != 3 || !parseId(request[1], book) || !parseId(request[2], member)) return errorReply("BookID and MemberID must be numeric!");
+            CirculationResult result = verb == "ISSUE" ? issueLoan(book, member) : reserveLoan(book, member);
+            switch (result.status) {
+                case CirculationStatus::Done:
+                    return verb == "ISSUE" ? okReply("TransactionID", to_string(result.transactionID)) : okReply("Status", "Reserved");
+                case CirculationStatus::NotFound: return errorReply("Book or Member not found!");
+                case CirculationStatus::Unavailable: return errorReply("Book not available!");
+                case CirculationStatus::LimitReached: return errorReply("Member has reached max limit (" + to_string(result.maxBooks) + ")!");
+                case CirculationStatus::OnShelf: return errorReply("Book is available, consider issuing it instead!");
+                case CirculationStatus::Failed: break;
+            }
+            return errorReply(verb == "ISSUE" ? "Failed to issue book." : "Failed to reserve book.");
+        }
+        if (verb == "RETURN") {
+            int txn;
+            if (request.size() != 2 || !parseId(request[1], txn)) return errorReply("TransactionID must be numeric!");
+            CirculationResult result = returnLoan(txn);
+            if (result.status == CirculationStatus::NotFound) return errorReply("Transaction not found or already returned!");
+            if (result.status != CirculationStatus::Done) return errorReply("Failed to return book.");
+            char fine[32];
+            snprintf(fine, sizeof(fine), "%.2f", result.fine);
+            ResultSet rows;
+            rows.addTextColumn("BookID");
+            rows.addTextColumn("Fine");
+            rows.addTextRow({to_string(result.bookID), fine});
+            return okReply(rows, 1);
+        }
+        if (verb == "SEARCH") {
+            if (request.size() != 2) return errorReply("Usage: SEARCH text");
+            ResultSet rows = bookSearchResults(request[1]);
+            return okReply(rows, rows.size());
+        }
+        if (verb == "REPORT") {
+            if (session.role != "Admin") return errorReply("Reports are for Admin only.");
+            size_t offset = 0, count = 0;
+            if (request.size() != 4 || !parseCount(request[2], offset) || !parseCount(request[3], count)) return errorReply("Usage: REPORT top|members|fines offset count");
+            RankedReport report;
+            if (request[1] == "top") report = RankedReport::TopBooks;
+            else if (request[1] == "members") report = RankedReport::ActiveMembers;
+            else if (request[1] == "fines") report = RankedReport::Fines;
+            else return errorReply("Unknown report " + request[1]);
+            size_t total = 0;
+            ResultSet rows = reportAggregates.page(report, offset, min(count, maxReportPage), total);
+            return okReply(rows, total);
+        }
+        if (verb == "STATS") {
+            size_t deskQueued, reportsQueued;
+            scheduler.queued(deskQueued, reportsQueued);
+            double uptime = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            ResultSet rows;
+            rows.addTextColumn("Metric");
+            rows.addTextColumn("Value");
+            rows.addTextRow({"sessions", to_string(openSessions.load())});
+            rows.addTextRow({"requests_served", to_string(served.load())});
+            rows.addTextRow({"requests_rejected", to_string(rejected.load())});
+            rows.addTextRow({"desk_queue", to_string(deskQueued)});
+            rows.addTextRow({"report_queue", to_string(reportsQueued)});
+            rows.addTextRow({"uptime_seconds", to_string((long long)uptime)});
+            return okReply(rows, rows.size());
+        }
+        return errorReply("Unknown request " + verb);
+    }
 
-    bool success = true;
-    SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, 0);
+    int listenFd = -1;
+    int wakePipe[2] = {-1, -1};
+    unordered_map<int, shared_ptr<ServerSession>> sessions;  // poll thread only
+    mutex doneMtx;
+    vector<int> done;                                         // sessions whose request was answered
+    RequestScheduler scheduler;
+    chrono::steady_clock::time_point started;
+    atomic<size_t> openSessions{0}, served{0}, rejected{0};
+};
 
-    if (!runQuery(updateTransaction)) success = false;
-    if (success && !runQuery(updateBook)) success = false;
+struct ServerReply {
+    bool ok = false;
+    string error;
+    size_t total = 0;
+    ResultSet rows;
+};
 
-    if (success) {
-        SQLEndTran(SQL_HANDLE_DBC, connHandle, SQL_COMMIT);
-        cout << "Book returned successfully!" << endl;
-    } else {
-        SQLEndTran(SQL_HANDLE_DBC, connHandle, SQL_ROLLBACK);
-        cout << "Failed to return book." << endl;
+// The client end of the protocol: one request in flight at a time.
+class ServerClient {
+public:
+    ~ServerClient() {
+        if (fd >= 0) close(fd);
     }
 
-    SQLSetConnectAttr(connHandle, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0);
-}
-
- 
-
+    bool open(const string& path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) == 0) return true;
+        if (fd >= 0) close(fd);
+        fd = -1;
+        return false;
+    }
 
- 
-void viewHistory() {
-    string memberID;
-    cout << "Enter MemberID: ";
-    cin >> memberID;
+    // Returns false only if the connection failed; a refused request comes back
+    // with reply.ok false and the server's message in reply.error.
+    bool call(const vector<string>& request, ServerReply& reply) {
+        reply = ServerReply();
+        string line;
+        if (fd < 0 || !sendAll(fd, joinFields(request)) || !readLine(line)) return false;
+        vector<string> status = splitFields(line);
+        if (status[0] == "ERR") {
+            reply.error = status.size() > 1 ? status[1] : "";
+            return true;
+        }
+        if (status[0] != "OK" || status.size() < 3) return false;
+        size_t lines = stoul(status[1]);
+        reply.total = stoul(status[2]);
+        for (size_t i = 0; i < lines; ++i) {
+            if (!readLine(line)) return false;
+            vector<string> fields = splitFields(line);
+            if (i == 0) {
+                for (auto& name : fields) reply.rows.addTextColumn(name);
+            } else {
+                fields.resize(reply.rows.columnCount());
+                reply.rows.addTextRow(fields);
+            }
+        }
+        reply.ok = true;
+        return true;
+    }
 
-    if (!all_of(memberID.begin(), memberID.end(), ::isdigit)) {
-        cout << "MemberID must be numeric!" << endl;
-        return;
+private:
+    bool readLine(string& line) {
+        size_t end;
+        while ((end = buffer.find('\n', scanned)) == string::npos) {
+            scanned = buffer.size();
+            char buf[16384];
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buffer.append(buf, (size_t)n);
+        }
+        line.assign(buffer, 0, end);
+        buffer.erase(0, end + 1);
+        scanned = 0;
+        return true;
     }
 
-    string query =
-        "SELECT TransactionID, BookID, MemberID, IssueDate, DueDate, Status, "
-        "ISNULL(FineAmount, 0) AS FineAmount "
-        "FROM dbo.Transactions "
-        "WHERE MemberID = '" + memberID + "' "
-        "ORDER BY IssueDate DESC";
+    int fd = -1;
+    string buffer;
+    size_t scanned = 0;
+};
 
-    auto res = getResults(query);
+// The desk console as a thin client of a running server.
+bool clientLogin(ServerClient& client, string& role) {
+    int roleChoice;
+    string username, password;
+    cout << "Who wants to login?\n1) Admin\n2) User\nChoice: ";
+    cin >> roleChoice;
+    while (cin.fail() || roleChoice < 1 || roleChoice > 2) {
+        cout << "Invalid choice! Enter 1 for Admin or 2 for User: ";
+        cin.clear();
+        cin.ignore(10000, '\n');
+        cin >> roleChoice;
+    }
+    cout << "Enter Username: ";
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    getline(cin, username);
+    cout << "Enter Password: ";
+    cin >> password;
 
-    cout << "Transactions found: " << res.size() << endl;
-    if (res.empty()) {
-        cout << "No transaction history found for MemberID " << memberID << endl;
-        return;
+    ServerReply reply;
+    if (!client.call({"LOGIN", roleChoice == 1 ? "Admin" : "User", username, password}, reply)) {
+        cout << "Lost the connection to the server." << endl;
+        return false;
+    }
+    if (!reply.ok) {
+        cout << reply.error << endl;
+        return false;
     }
+    role = string(reply.rows.text(0, 0));
+    cout << "Logged in as " << role << endl;
+    return true;
+}
 
-    showPaginated(res, "Transaction History");
+// Sends a request and prints the server's message on refusal; times the round trip.
+bool clientCall(ServerClient& client, const vector<string>& request, ServerReply& reply) {
+    auto start = chrono::steady_clock::now();
+    if (!client.call(request, reply)) {
+        cout << "Lost the connection to the server." << endl;
+        return false;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (!reply.ok) cout << reply.error << endl;
+    cout << fixed << setprecision(2) << "  (" << ms << " ms round trip)" << endl;
+    cout.unsetf(ios::floatfield);
+    return reply.ok;
 }
 
-void transactionsMenu() {
+void clientMenu(ServerClient& client, const string& role) {
     int choice;
     do {
-        cout << "\nTransactions\n";
-        cout << "1. Issue Book\n2. Return Book\n3. Reserve Book\n4. View History\n5. Back\nChoice: ";
+        cout << "\n********** Library Desk (server) **********\n";
+        cout << "1. Search Books\n2. Issue Book\n3. Return Book\n4. Reserve Book\n5. Top Issued Books\n6. Active Members\n7. Fine Summary\n8. Exit\nChoice: ";
         cin >> choice;
-        while (cin.fail() || choice < 1 || choice > 5) {
+        while (cin.fail() || choice < 1 || choice > 8) {
             cout << "Invalid choice! Try again: ";
             cin.clear();
             cin.ignore(10000, '\n');
             cin >> choice;
         }
+        ServerReply reply;
+        string first, second;
         switch (choice) {
-            case 1: issueBook(); break;
-            case 2: returnBook(); break;
-            case 3: reserveBook(); break;
-            case 4: viewHistory(); break;
-            case 5: cout << "Returning to main menu..." << endl; break;
+            case 1:
+                cout << "Enter Title or Author to search: ";
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                getline(cin, first);
+                if (clientCall(client, {"SEARCH", first}, reply)) {
+                    cout << reply.rows.size() << " match(es)" << endl;
+                    showPaginated(reply.rows, booksView);
+                }
+                break;
+            case 2:
+            case 4:
+                cout << "Enter BookID: ";
+                cin >> first;
+                cout << "Enter MemberID: ";
+                cin >> second;
+                if (clientCall(client, {choice == 2 ? "ISSUE" : "RESERVE", first, second}, reply)) {
+                    if (choice == 2) cout << "Book issued successfully! TransactionID: " << reply.rows.text(0, 0) << endl;
+                    else cout << "Book reserved successfully!" << endl;
+                }
+                break;
+            case 3:
+                cout << "Enter TransactionID: ";
+                cin >> first;
+                if (clientCall(client, {"RETURN", first}, reply)) {
+                    cout << "Book returned successfully!";
+                    if (atof(string(reply.rows.text(0, 1)).c_str()) > 0) cout << " Fine due: " << reply.rows.text(0, 1);
+                    cout << endl;
+                }
+                break;
+            case 5:
+            case 6:
+            case 7: {
+                if (role != "Admin") {
+                    cout << "Reports are for Admin only." << endl;
+                    break;
+                }
+                const char* names[] = {"top", "members", "fines"};
+                const ViewLayout* views[] = {&topBooksView, &activeMembersView, &finesView};
+                string report = names[choice - 5];
+                showRankedReport(
+                    [&client, report](size_t offset, size_t count, size_t& total) {
+                        ServerReply page;
+                        total = 0;
+                        if (!client.call({"REPORT", report, to_string(offset), to_string(count)}, page) || !page.ok) return ResultSet();
+                        total = page.total;
+                        return move(page.rows);
+                    },
+                    *views[choice - 5]);
+                break;
+            }
+            case 8: cout << "Exiting..." << endl; break;
         }
-    } while (choice != 5);
-}
- 
-void topIssuedBooks() {
-    auto res = getResults("SELECT b.BookID, b.Title, COUNT(t.TransactionID) as IssueCount FROM dbo.Books b LEFT JOIN dbo.Transactions t ON b.BookID = t.BookID GROUP BY b.BookID, b.Title ORDER BY IssueCount DESC");
-    showPaginated(res, "TopBooks");
-}
- 
-void activeMembers() {
-    auto res = getResults("SELECT m.MemberID, m.Name, COUNT(t.TransactionID) as BooksIssued FROM dbo.Members m LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID, m.Name ORDER BY BooksIssued DESC");
-    showPaginated(res, "ActiveMembers");
+    } while (choice != 8);
 }
- 
-void fineSummary() {
-    auto res = getResults("SELECT m.MemberID, m.Name, SUM(t.FineAmount) as TotalFine FROM dbo.Members m LEFT JOIN dbo.Transactions t ON m.MemberID = t.MemberID GROUP BY m.MemberID, m.Name ORDER BY TotalFine DESC");
-    showPaginated(res, "Fines");
+
+// A stand-in for a room full of desks: each client thread logs in and sends a
+// mix of searches, issues, returns of its own loans and report pages, then the
+// latencies are printed per request type.
+bool runLoadClients(const string& path, size_t clients, size_t requestsPerClient, const string& user, const string& password, int books,
+                    int members) {
+    const vector<string> verbs = {"SEARCH", "ISSUE", "RETURN", "REPORT"};
+    const vector<string> searchTerms = {"the", "and", "history", "book", "an", "love", "title", "war", "of", "science"};
+    vector<vector<LatencyHistogram>> latencies(clients, vector<LatencyHistogram>(verbs.size()));
+    vector<vector<size_t>> refused(clients, vector<size_t>(verbs.size()));
+    atomic<size_t> brokenClients{0};
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (size_t c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            ServerClient client;
+            ServerReply reply;
+            if (!client.open(path) || !client.call({"LOGIN", "Admin", user, password}, reply) || !reply.ok) {
+                brokenClients++;
+                return;
+            }
+            mt19937 rng((unsigned)(c * 7919 + 17));
+            vector<string> loans;
+            for (size_t i = 0; i < requestsPerClient; ++i) {
+                unsigned roll = rng() % 10;
+                size_t kind = roll < 5 ? 0 : roll < 7 ? 1 : roll < 9 ? 2 : 3;
+                if (kind == 2 && loans.empty()) kind = 0;
+                vector<string> request;
+                if (kind == 0) request = {"SEARCH", searchTerms[rng() % searchTerms.size()]};
+                else if (kind == 1) request = {"ISSUE", to_string(1 + rng() % books), to_string(1 + rng() % members)};
+                else if (kind == 2) request = {"RETURN", loans.back()};
+                else request = {"REPORT", "top", "0", "20"};
+
+                auto sent = chrono::steady_clock::now();
+                if (!client.call(request, reply)) {
+                    brokenClients++;
+                    return;
+                }
+                latencies[c][kind].record(chrono::duration<double, milli>(chrono::steady_clock::now() - sent).count());
+                if (!reply.ok) refused[c][kind]++;
+                if (kind == 1 && reply.ok) loans.push_back(string(reply.rows.text(0, 0)));
+                if (kind == 2) loans.pop_back();
+            }
+            for (auto& txn : loans) client.call({"RETURN", txn}, reply);
+        });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t total = 0;
+    cout << left << setw(10) << "Request" << right << setw(9) << "Count" << setw(9) << "Refused" << setw(10) << "p50 ms" << setw(10) << "p95 ms"
+         << setw(10) << "p99 ms" << setw(10) << "max ms" << endl;
+    cout << string(68, '-') << endl;
+    for (size_t k = 0; k < verbs.size(); ++k) {
+        LatencyHistogram all;
+        size_t refusedCount = 0;
+        for (size_t c = 0; c < clients; ++c) {
+            all.merge(latencies[c][k]);
+            refusedCount += refused[c][k];
+        }
+        total += all.count();
+        cout << left << setw(10) << verbs[k] << right << setw(9) << all.count() << setw(9) << refusedCount << fixed << setprecision(3) << setw(10)
+             << all.percentile(50) << setw(10) << all.percentile(95) << setw(10) << all.percentile(99) << setw(10) << all.maximum() << endl;
+    }
+    cout << setprecision(1) << total << " requests from " << clients << " clients in " << seconds << " s (" << (seconds > 0 ? total / seconds : 0.0)
+         << " req/s)" << endl;
+    cout.unsetf(ios::floatfield);
+    if (brokenClients) cout << brokenClients << " client(s) could not connect, log in or lost the connection." << endl;
+    return brokenClients == 0;
 }
- 
-void reportsMenu() {
-    int choice;
-    do {
-        cout << "\nReports\n";
-        cout << "1. Top Issued Books\n2. Active Members\n3. Fine Summary\n4. Export Reports to CSV\n5. Back\nChoice: ";
-        cin >> choice;
-        while (cin.fail() || choice < 1 || choice > 5) {
-            cout << "Invalid choice! Try again: ";
-            cin.clear();
-            cin.ignore(10000, '\n');
-            cin >> choice;
+#endif
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench-csv") {
+        runCsvBenchmark(argc > 2 ? stoul(argv[2]) : 200000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-text") {
+        runTextBenchmark(argc > 2 ? stoul(argv[2]) : 200000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--check-snapshot") return runSnapshotChecks() ? 0 : 1;
+    if (argc > 1 && string(argv[1]) == "--bench-workflows") {
+        // Seeds synthetic data, so it defaults to its own SQLite file rather than library.db.
+        WorkflowBenchOptions options;
+        string backendName;
+#if LIBRARY_WITH_SQLITE
+        sqliteDatabasePath = "bench.db";
+#endif
+        for (int i = 2; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--no-seed") {
+                options.seed = false;
+                continue;
+            }
+            if (i + 1 >= argc) break;
+            string value = argv[++i];
+            if (arg == "--books") options.books = stoul(value);
+            else if (arg == "--members") options.members = max<size_t>(1, stoul(value));
+            else if (arg == "--loans") options.loans = stoul(value);
+            else if (arg == "--threads") options.threads = max<size_t>(1, stoul(value));
+            else if (arg == "--ops") options.opsPerThread = stoul(value);
+            else if (arg == "--import-rows") options.importRows = max<size_t>(1, stoul(value));
+            else if (arg == "--json") options.jsonPath = value;
+            else if (arg == "--journal") options.journalPath = value;
+            else if (arg == "--backend") backendName = value;
+#if LIBRARY_WITH_SQLITE
+            else if (arg == "--db") sqliteDatabasePath = value;
+#endif
+            else if (arg == "--mix" && !parseBenchMix(value, options.mix)) {
+                cout << "Bad --mix; expected e.g. issue=30,return=30,reserve=5,search=30,import=5" << endl;
+                return 1;
+            }
         }
-        switch (choice) {
-            case 1: topIssuedBooks(); break;
-            case 2: activeMembers(); break;
-            case 3: fineSummary(); break;
-            case 4: exportReportsToCSV(); break;
-            case 5: cout << "Returning to main menu..." << endl; break;
+        if (!selectBackend(backendName)) {
+            cout << "Storage backend '" << backendName << "' is not available in this build." << endl;
+            return 1;
         }
-    } while (choice != 5);
-}
- 
-int main() {
+        if (!connectDB()) {
+            cout << "Failed to connect to database!" << endl;
+            return 1;
+        }
+        bool ok = runWorkflowBenchmark(options);
+        disconnectDB();
+        return ok ? 0 : 1;
+    }
+    if (argc > 2 && string(argv[1]) == "--analyze-history") {
+        size_t topN = 100, threads = max(1u, thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 1u);
+        string outDir;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string arg = argv[i];
+            if (arg == "--top") topN = stoul(argv[i + 1]);
+            else if (arg == "--threads") threads = stoul(argv[i + 1]);
+            else if (arg == "--out") outDir = argv[i + 1];
+        }
+        return analyzeTransactionHistory(argv[2], topN, threads, outDir) ? 0 : 1;
+    }
+    string backendName, snapshotPath, servePath, connectPath, loadPath, loadUser = "Admin", loadPassword, metricsPath, journalPath;
+    int metricsSeconds = 15;
+    size_t serverWorkers = connectionPoolSize * 2, loadClients = 8, loadRequests = 500;
+    int loadBooks = 1000, loadMembers = 100;
+    for (int i = 1; i + 1 < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--page-size") viewPageSize = max(1, min(1000, atoi(argv[i + 1])));
+        else if (arg == "--serve") servePath = argv[i + 1];
+        else if (arg == "--metrics-file") metricsPath = argv[i + 1];
+        else if (arg == "--metrics-interval") metricsSeconds = max(1, atoi(argv[i + 1]));
+        else if (arg == "--journal") journalPath = argv[i + 1];
+        else if (arg == "--workers") serverWorkers = max(1, atoi(argv[i + 1]));
+        else if (arg == "--connect") connectPath = argv[i + 1];
+        else if (arg == "--load-client") loadPath = argv[i + 1];
+        else if (arg == "--clients") loadClients = max(1, atoi(argv[i + 1]));
+        else if (arg == "--requests") loadRequests = max(1, atoi(argv[i + 1]));
+        else if (arg == "--user") loadUser = argv[i + 1];
+        else if (arg == "--password") loadPassword = argv[i + 1];
+        else if (arg == "--books") loadBooks = max(1, atoi(argv[i + 1]));
+        else if (arg == "--members") loadMembers = max(1, atoi(argv[i + 1]));
+        else if (arg == "--backend") backendName = argv[i + 1];
+        else if (arg == "--snapshot") snapshotPath = argv[i + 1];
+        else if (arg == "--offline") {
+            snapshotPath = argv[i + 1];
+            offlineMode = true;
+        }
+#if LIBRARY_WITH_SQLITE
+        else if (arg == "--db") sqliteDatabasePath = argv[i + 1];
+#endif
+#if LIBRARY_WITH_ODBC
+        else if (arg == "--odbc-text") {
+            string mode = argv[i + 1];
+            odbcTextMode = mode == "wide" ? OdbcTextMode::Wide : mode == "utf8" ? OdbcTextMode::Utf8 : OdbcTextMode::Auto;
+        }
+#endif
+    }
+    if (offlineMode) {
+        if (!loadSnapshot(snapshotPath)) return 1;
+        offlineMenu();
+        return 0;
+    }
+#ifndef _WIN32
+    // Client modes talk to a running server and never open the database.
+    if (!connectPath.empty()) {
+        ServerClient client;
+        if (!client.open(connectPath)) {
+            cout << "Failed to connect to the server at " << connectPath << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        string role;
+        int loginAttempts = 3;
+        while (loginAttempts > 0 && !clientLogin(client, role)) loginAttempts--;
+        if (loginAttempts == 0) return 1;
+        clientMenu(client, role);
+        return 0;
+    }
+    if (!loadPath.empty()) return runLoadClients(loadPath, loadClients, loadRequests, loadUser, loadPassword, loadBooks, loadMembers) ? 0 : 1;
+#else
+    if (!servePath.empty() || !connectPath.empty() || !loadPath.empty()) {
+        cout << "Server mode needs a build with Unix domain sockets." << endl;
+        return 1;
+    }
+#endif
+    if (!selectBackend(backendName)) {
+        cout << "Storage backend '" << backendName << "' is not available in this build." << endl;
+        return 1;
+    }
     if (!connectDB()) {
         cout << "Failed to connect to database!" << endl;
         return 1;
     }
+    if (!metricsPath.empty()) metricsFileWriter.start(metricsPath, chrono::seconds(metricsSeconds));
+#ifndef _WIN32
+    // Sessions log in over the socket; the server itself needs no console login.
+    if (!servePath.empty()) {
+        configService.reload();
+        if (!snapshotPath.empty() && loadSnapshot(snapshotPath)) printSnapshotFreshness(*librarySnapshot);
+        catalogCache.warm();
+        memberDirectory.warm();  // sessions look members up concurrently, and so does the journal
+        if (!journalPath.empty() && !deskJournal.open(journalPath)) {
+            disconnectDB();
+            return 1;
+        }
+        LibraryServer server;
+        bool served = server.run(servePath, serverWorkers);
+        deskJournal.close();
+        metricsFileWriter.stop();
+        disconnectDB();
+        return served ? 0 : 1;
+    }
+#endif
     char cwd[256];
     _getcwd(cwd, sizeof(cwd));
     int attempts = 3;
@@ -1216,15 +9120,30 @@ int main() {
         disconnectDB();
         return 1;
     }
+    // Build the search indexes up front so the first search is as fast as the rest.
+    // A snapshot fills them without scanning the tables; warm() then only
+    // refetches what changed since it was taken.
+    configService.reload();
+    if (!snapshotPath.empty() && loadSnapshot(snapshotPath)) printSnapshotFreshness(*librarySnapshot);
+    catalogCache.warm();
+    if (currentUserRole == "Admin") memberDirectory.warm();
+    if (!journalPath.empty() && !deskJournal.open(journalPath)) {
+        disconnectDB();
+        return 1;
+    }
     int choice;
     do {
         cout << "\n********** Library Management **********\n";
+        backgroundJobs.printStatus();
+        deskJournal.printNotice();
         if (currentUserRole == "Admin") {
             cout << "1. Books Management\n"
                  << "2. Members Management\n"
                  << "3. Transactions\n"
                  << "4. Reports\n"
-                 << "5. Exit\n"
+                 << "5. Background Jobs\n"
+                 << "6. Diagnostics\n"
+                 << "7. Exit\n"
                  << "Choice: ";
         } else {
             cout << "1. View Books\n"
@@ -1234,7 +9153,7 @@ int main() {
                  << "Choice: ";
         }
         cin >> choice;
-        while (cin.fail() || (currentUserRole == "Admin" ? (choice < 1 || choice > 5) : (choice < 1 || choice > 4))) {
+        while (cin.fail() || (currentUserRole == "Admin" ? (choice < 1 || choice > 7) : (choice < 1 || choice > 4))) {
             cout << "Invalid choice! Try again: ";
             cin.clear();
             cin.ignore(10000, '\n');
@@ -1246,7 +9165,9 @@ int main() {
                 case 2: membersMenu(); break;
                 case 3: transactionsMenu(); break;
                 case 4: reportsMenu(); break;
-                case 5: cout << "Exiting..." << endl; break;
+                case 5: backgroundJobsMenu(); break;
+                case 6: diagnosticsMenu(); break;
+                case 7: cout << "Exiting..." << endl; break;
             }
         } else {
             switch (choice) {
@@ -1257,7 +9178,10 @@ int main() {
             }
         }
  
-    } while (choice != (currentUserRole == "Admin" ? 5 : 4));
+    } while (choice != (currentUserRole == "Admin" ? 7 : 4));
+    backgroundJobs.waitAll();
+    deskJournal.close();
+    metricsFileWriter.stop();
     disconnectDB();
     return 0;
 }
\ No newline at end of file